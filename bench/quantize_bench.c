@@ -0,0 +1,305 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+/* Times the color matching functions on synthetic images and on any image
+   files given, for every palette of palette_tables.h or only the one
+   named, and prints the results as JSON.
+
+   quantize_bench [--quick] [--palette <name>] [image...]
+
+   Nothing here needs a display, only GdkPixbuf is used. */
+
+#ifdef OS_LINUX
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <gtk/gtk.h>
+
+#ifdef OS_LINUX
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "../version"
+#include "glib_compat.h"
+#include "data_structures.h"
+#include "progress.h"
+#include "generate.h"
+#include "quantize.h"
+#include "palette_tables.h"
+
+static int quick = 0;
+static int first_result = 1;
+
+typedef struct bench_image
+{
+  const char * name;
+  GdkPixbuf * pixbuf;
+} bench_image_t;
+
+/* Counts the cache misses of this thread, if the kernel lets us. Every
+   function timed here runs on the calling thread only. */
+static int miss_counter = -1;
+
+static void misses_open(void)
+{
+#ifdef OS_LINUX
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  miss_counter = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void misses_start(void)
+{
+#ifdef OS_LINUX
+  if(miss_counter >= 0)
+    {
+      ioctl(miss_counter, PERF_EVENT_IOC_RESET, 0);
+      ioctl(miss_counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+/* Returns -1 if misses can't be counted. */
+static long long misses_stop(void)
+{
+#ifdef OS_LINUX
+  long long count;
+
+  if(miss_counter >= 0)
+    {
+      ioctl(miss_counter, PERF_EVENT_IOC_DISABLE, 0);
+      if(read(miss_counter, &count, sizeof(count)) == sizeof(count))
+	return count;
+    }
+#endif
+  return -1;
+}
+
+/* Smooth gradients with some noise on top, like a photo. */
+static GdkPixbuf * synthetic_image(int width, int height)
+{
+  GdkPixbuf * pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  int rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  guchar * pixels = gdk_pixbuf_get_pixels(pixbuf);
+  unsigned int seed = 12345;
+  int x, y;
+
+  for(y = 0; y < height; y++)
+    for(x = 0; x < width; x++)
+      {
+	guchar * p = &(pixels[y * rowstride + x * 3]);
+	int noise;
+
+	seed = seed * 1103515245 + 12345;
+	noise = (int)((seed >> 16) & 31) - 16;
+	p[0] = CLAMP(x * 255 / width + noise, 0, 255);
+	p[1] = CLAMP(y * 255 / height + noise, 0, 255);
+	p[2] = CLAMP((x + y) * 255 / (width + height) - noise, 0, 255);
+      }
+  return pixbuf;
+}
+
+/* Image names come from the command line and may need escaping. */
+static void print_json_string(const char * string)
+{
+  putchar('"');
+  for(; *string != '\0'; string++)
+    {
+      unsigned char c = (unsigned char)*string;
+
+      if(c == '"' || c == '\\')
+	printf("\\%c", c);
+      else if(c < 0x20)
+	printf("\\u%04x", c);
+      else
+	putchar(c);
+    }
+  putchar('"');
+}
+
+static void print_result(const char * function, const char * palette, const char * image, int yuv,
+			 int width, int height, int iterations, gint64 elapsed, long long misses)
+{
+  double pixels = (double)width * height * iterations;
+
+  printf("%s\n    {\"function\": \"%s\", \"palette\": \"%s\", \"image\": ",
+	 first_result ? "" : ",", function, palette);
+  print_json_string(image);
+  printf(", \"yuv\": %i, \"width\": %i, \"height\": %i, \"iterations\": %i, "
+	 "\"mpixels_per_second\": %.3f, \"ns_per_pixel\": %.3f, \"cache_misses_per_pixel\": ",
+	 yuv, width, height, iterations, pixels / elapsed, elapsed * 1000.0 / pixels);
+  if(misses < 0)
+    printf("null}");
+  else
+    printf("%.4f}", misses / pixels);
+  first_result = 0;
+}
+
+/* Enough iterations for about min_time microseconds, at least one. */
+static int iterations_for(gint64 once, gint64 min_time)
+{
+  if(once <= 0)
+    return 1000;
+  return MAX(1, (int)MIN(1000, min_time / once));
+}
+
+static void bench_closest(int palette, bench_image_t * image, int yuv)
+{
+  int width = MIN(gdk_pixbuf_get_width(image->pixbuf), 256);
+  int height = MIN(gdk_pixbuf_get_height(image->pixbuf), 256);
+  int channels = gdk_pixbuf_get_n_channels(image->pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride(image->pixbuf);
+  guchar * pixels = gdk_pixbuf_get_pixels(image->pixbuf);
+  volatile int sink = 0;
+  gint64 start, elapsed;
+  long long misses;
+  int i, x, y, iterations = 1;
+
+  for(i = 0; i < 2; i++)
+    {
+      int k;
+
+      misses_start();
+      start = g_get_monotonic_time();
+      for(k = 0; k < iterations; k++)
+	for(y = 0; y < height; y++)
+	  for(x = 0; x < width; x++)
+	    {
+	      guchar * p = &(pixels[y * rowstride + x * channels]);
+	      if(yuv)
+		sink += closest_color_YUV(p[0], p[1], p[2], palettes[palette].colors, palettes[palette].count);
+	      else
+		sink += closest_color_RGB(p[0], p[1], p[2], palettes[palette].colors, palettes[palette].count);
+	    }
+      elapsed = g_get_monotonic_time() - start;
+      misses = misses_stop();
+      if(i == 0)
+	iterations = iterations_for(elapsed, quick ? 20000 : 200000);
+    }
+
+  print_result(yuv ? "closest_color_YUV" : "closest_color_RGB", palettes[palette].name, image->name, yuv,
+	       width, height, iterations, elapsed, misses);
+}
+
+static void bench_generate(int palette, bench_image_t * image, int yuv, int dithered, int maps)
+{
+  int width = maps * 128, height = maps * 128;
+  unsigned char * data = malloc(width * height);
+  gint64 start, elapsed;
+  long long misses;
+  int i, k, iterations;
+
+  /* the first run also builds the lookup table, which is kept */
+  start = g_get_monotonic_time();
+  if(dithered)
+    generate_image_dithered_pixbuf(data, width, height, yuv, image->pixbuf, palette, NULL);
+  else
+    generate_image_pixbuf(data, width, height, yuv, image->pixbuf, palette, NULL);
+  iterations = iterations_for(g_get_monotonic_time() - start, quick ? 50000 : 500000);
+
+  misses_start();
+  start = g_get_monotonic_time();
+  for(k = 0; k < iterations; k++)
+    if(dithered)
+      generate_image_dithered_pixbuf(data, width, height, yuv, image->pixbuf, palette, NULL);
+    else
+      generate_image_pixbuf(data, width, height, yuv, image->pixbuf, palette, NULL);
+  elapsed = g_get_monotonic_time() - start;
+  misses = misses_stop();
+
+  for(i = 0; i < width * height && data[i] < palettes[palette].count; i++);
+  if(i != width * height)
+    fprintf(stderr, "%s gave an index outside the palette\n", dithered ? "generate_image_dithered_pixbuf" : "generate_image_pixbuf");
+
+  print_result(dithered ? "generate_image_dithered_pixbuf" : "generate_image_pixbuf", palettes[palette].name, image->name, yuv,
+	       width, height, iterations, elapsed, misses);
+  free(data);
+}
+
+int main(int argc, char ** argv)
+{
+  int map_sizes[] = {1, 2, 4};
+  bench_image_t * images;
+  int image_count = 0, only = -1, i, p, s, yuv;
+
+  glib_compat_init();
+  images = malloc((argc + 1) * sizeof(bench_image_t));
+  images[image_count].name = "synthetic";
+  images[image_count++].pixbuf = synthetic_image(1024, 768);
+  for(i = 1; i < argc; i++)
+    {
+      if(strcmp(argv[i], "--quick") == 0)
+	quick = 1;
+      else if(strcmp(argv[i], "--palette") == 0 && i + 1 < argc)
+	{
+	  if((only = palette_find(argv[++i])) < 0)
+	    {
+	      fprintf(stderr, "Unknown palette %s\n", argv[i]);
+	      return 1;
+	    }
+	}
+      else
+	{
+	  GError * error = NULL;
+	  GdkPixbuf * pixbuf = gdk_pixbuf_new_from_file(argv[i], &error);
+
+	  if(pixbuf == NULL)
+	    {
+	      fprintf(stderr, "Could not read %s: %s\n", argv[i], error->message);
+	      g_error_free(error);
+	      return 1;
+	    }
+	  images[image_count].name = argv[i];
+	  images[image_count++].pixbuf = pixbuf;
+	}
+    }
+
+  misses_open();
+
+  /* generate_image_pixbuf and the dithered one convert on one thread */
+  printf("{\n  \"benchmark\": \"quantize\",\n  \"version\": \"%s\",\n  \"threads\": 1,\n  \"results\": [",
+	 VERSION_NUMBER);
+  for(p = 0; p < PALETTES; p++)
+    if(only < 0 || p == only)
+      for(i = 0; i < image_count; i++)
+	for(yuv = 0; yuv < 2; yuv++)
+	  {
+	    bench_closest(p, &(images[i]), yuv);
+	    for(s = 0; s < (int)(sizeof(map_sizes) / sizeof(int)); s++)
+	      {
+		bench_generate(p, &(images[i]), yuv, 0, map_sizes[s]);
+		bench_generate(p, &(images[i]), yuv, 1, map_sizes[s]);
+	      }
+	  }
+  printf("\n  ]\n}\n");
+
+  for(i = 0; i < image_count; i++)
+    g_object_unref(images[i].pixbuf);
+  free(images);
+  return 0;
+}
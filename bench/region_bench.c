@@ -0,0 +1,216 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+/* Times reading a world, step by step for every chunk of every region
+   file in a directory, then whole maps the way Render World does, and
+   prints the results as JSON.
+
+   region_bench <region dir> [--maps <n>] [--scale <0-4>]
+
+   tools/make_world writes worlds to run it on. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "../version"
+#include "data_structures.h"
+#include "progress.h"
+#include "nbtsave.h"
+#include "parallel.h"
+#include "map_render.h"
+
+typedef struct stage_times
+{
+  gint64 open, header, inflate, walk, columns, shade;
+  long regions, chunks, sections;
+  double inflated;
+  unsigned long checksum; /* of the shaded colors, to compare runs */
+} stage_times_t;
+
+static void bench_region(const char * dir, int rx, int rz, stage_times_t * times)
+{
+  char path[1024];
+  uint32_t locations[1024];
+  block_info_t columns[16 * 16];
+  FILE * file;
+  gint64 start;
+  int k;
+
+  snprintf(path, sizeof(path), "%s/r.%i.%i.mca", dir, rx, rz);
+  start = g_get_monotonic_time();
+  file = fopen(path, "rb");
+  times->open += g_get_monotonic_time() - start;
+  if(file == NULL)
+    return;
+
+  start = g_get_monotonic_time();
+  if(read_region_file_header(file, locations, NULL) != 0)
+    {
+      fclose(file);
+      return;
+    }
+  times->header += g_get_monotonic_time() - start;
+  times->regions++;
+
+  for(k = 0; k < 1024; k++)
+    {
+      int cx = rx * 32 + k % 32, cz = rz * 32 + k / 32;
+      chunk_sections_t sections;
+      unsigned char * data;
+      long size;
+      int i, j;
+
+      start = g_get_monotonic_time();
+      data = read_region_chunk_data(file, locations[k], &size);
+      times->inflate += g_get_monotonic_time() - start;
+      if(data == NULL)
+	continue;
+      times->chunks++;
+      times->inflated += size;
+
+      start = g_get_monotonic_time();
+      times->sections += read_chunk_sections(data, size, &sections);
+      times->walk += g_get_monotonic_time() - start;
+
+      memset(columns, 0, sizeof(columns));
+      start = g_get_monotonic_time();
+      read_chunk_columns(&sections, cx, cz, columns, cx * 16, cz * 16, 16, 16);
+      times->columns += g_get_monotonic_time() - start;
+
+      /* what render_map does for every pixel, at scale 0 */
+      start = g_get_monotonic_time();
+      for(i = 0; i < 16; i++)
+	{
+	  double lasth = 0.0;
+
+	  for(j = 0; j < 16; j++)
+	    {
+	      map_cell_t cell;
+
+	      render_reduce_cell(columns, 16, 0, i, j, &cell);
+	      times->checksum += render_shade_cell(&cell, lasth, 0, i, j) * (unsigned long)(i + j * 16 + 1);
+	      lasth = cell.h;
+	    }
+	}
+      times->shade += g_get_monotonic_time() - start;
+
+      free(data);
+    }
+  fclose(file);
+}
+
+static void print_stage(const char * name, gint64 elapsed, long count, int last)
+{
+  printf("    \"%s\": {\"total_ms\": %.3f, \"us_each\": %.3f}%s\n", name, elapsed / 1000.0,
+	 count ? (double)elapsed / count : 0.0, last ? "" : ",");
+}
+
+int main(int argc, char ** argv)
+{
+  stage_times_t times;
+  const char * dir, * name;
+  GDir * gdir;
+  int minrx = 0, minrz = 0, maxrx = -1, maxrz = -1;
+  int maps = 4, scale = 3, i;
+  gint64 read_time = 0, render_time = 0;
+
+  if(argc < 2)
+    {
+      fprintf(stderr, "usage: %s <region dir> [--maps <n>] [--scale <0-4>]\n", argv[0]);
+      return 1;
+    }
+  dir = argv[1];
+  for(i = 2; i < argc; i++)
+    if(strcmp(argv[i], "--maps") == 0 && i + 1 < argc)
+      maps = atoi(argv[++i]);
+    else if(strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+      scale = atoi(argv[++i]);
+  maps = MAX(maps, 0);
+  scale = CLAMP(scale, 0, 4);
+
+  gdir = g_dir_open(dir, 0, NULL);
+  if(gdir == NULL)
+    {
+      fprintf(stderr, "Could not open %s\n", dir);
+      return 1;
+    }
+
+  memset(&times, 0, sizeof(times));
+  while((name = g_dir_read_name(gdir)) != NULL)
+    {
+      int rx, rz, end = 0;
+
+      /* %d, %i would read r.010.0.mca as octal */
+      if(sscanf(name, "r.%d.%d.mca%n", &rx, &rz, &end) != 2 || end == 0 || name[end] != '\0')
+	continue;
+      if(maxrx < minrx)
+	{
+	  minrx = maxrx = rx;
+	  minrz = maxrz = rz;
+	}
+      minrx = MIN(minrx, rx);
+      minrz = MIN(minrz, rz);
+      maxrx = MAX(maxrx, rx);
+      maxrz = MAX(maxrz, rz);
+      bench_region(dir, rx, rz, &times);
+    }
+  g_dir_close(gdir);
+
+  if(times.regions == 0)
+    {
+      fprintf(stderr, "No region files in %s\n", dir);
+      return 1;
+    }
+
+  /* whole maps, laid out from the corner of the world */
+  {
+    int size = 128 << scale;
+    int across = MAX(1, (maxrx - minrx + 1) * 512 / size);
+    block_info_t * blocks = malloc((size_t)size * size * sizeof(block_info_t));
+    unsigned char data[128 * 128];
+
+    for(i = 0; i < maps; i++)
+      {
+	int x = minrx * 512 + (i % across) * size, z = minrz * 512 + (i / across) * size;
+	gint64 start = g_get_monotonic_time();
+
+	memset(blocks, 0, (size_t)size * size * sizeof(block_info_t));
+	read_region_area(dir, blocks, x, z, size, size, NULL);
+	read_time += g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	render_map(NULL, blocks, data, scale, NULL);
+	render_time += g_get_monotonic_time() - start;
+      }
+    free(blocks);
+  }
+
+  printf("{\n  \"benchmark\": \"region\",\n  \"version\": \"%s\",\n", VERSION_NUMBER);
+  printf("  \"regions\": %li,\n  \"chunks\": %li,\n  \"sections_per_chunk\": %.2f,\n  \"inflated_bytes_per_chunk\": %.0f,\n",
+	 times.regions, times.chunks, times.chunks ? (double)times.sections / times.chunks : 0.0,
+	 times.chunks ? times.inflated / times.chunks : 0.0);
+  printf("  \"checksum\": %lu,\n  \"per_region\": {\n", times.checksum);
+  print_stage("open", times.open, times.regions, 0);
+  print_stage("header", times.header, times.regions, 1);
+  printf("  },\n  \"per_chunk\": {\n");
+  print_stage("inflate", times.inflate, times.chunks, 0);
+  print_stage("nbt_walk", times.walk, times.chunks, 0);
+  print_stage("columns", times.columns, times.chunks, 0);
+  print_stage("shade", times.shade, times.chunks, 1);
+  printf("  },\n  \"per_map\": {\"maps\": %i, \"scale\": %i, \"read_ms\": %.3f, \"render_ms\": %.3f}\n}\n",
+	 maps, scale, maps ? read_time / 1000.0 / maps : 0.0, maps ? render_time / 1000.0 / maps : 0.0);
+  return 0;
+}
@@ -12,6 +12,25 @@ SRCDIRS := src src/* src/*/* src/*/*/*
 SOURCES := $(foreach DIR, $(SRCDIRS), $(wildcard $(DIR)/*.c))
 OBJECTS = $(patsubst %.c, $(OBJ)%.o, $(SOURCES))
 
+# libimagetomap, built without GTK so nothing in it can depend on it
+LIB_OBJ := $(OBJ)lib/
+LIB_CFLAGS := -Wall -Werror -std=c99 -pedantic -g -Os -fPIC `pkg-config --cflags glib-2.0` -DOS_LINUX
+LIB_LFLAGS := `pkg-config --libs glib-2.0` -lm -lz
+LIB_SOURCES := src/imagetomap.c src/convert.c src/palette_tables.c src/quantize.c src/parallel.c src/progress.c src/stats.c src/trace.c src/nbtsave.c src/map_render.c
+LIB_OBJECTS = $(patsubst %.c, $(LIB_OBJ)%.o, $(LIB_SOURCES))
+
+BENCH := $(BIN)quantize_bench
+BENCH_SOURCES := bench/quantize_bench.c src/generate.c src/convert.c src/palette_tables.c src/quantize.c src/parallel.c src/progress.c src/stats.c src/trace.c
+BENCH_OBJECTS = $(patsubst %.c, $(OBJ)%.o, $(BENCH_SOURCES))
+
+REGION_BENCH := $(BIN)region_bench
+REGION_BENCH_SOURCES := bench/region_bench.c src/nbtsave.c src/map_render.c src/parallel.c src/progress.c src/stats.c src/trace.c
+REGION_BENCH_OBJECTS = $(patsubst %.c, $(OBJ)%.o, $(REGION_BENCH_SOURCES))
+
+MAKE_WORLD := $(BIN)make_world
+MAKE_WORLD_SOURCES := tools/make_world.c src/nbtsave.c src/progress.c src/stats.c src/trace.c
+MAKE_WORLD_OBJECTS = $(patsubst %.c, $(OBJ)%.o, $(MAKE_WORLD_SOURCES))
+
 BEG = 	echo -e -n "  \033[32m$(1)$(2)...\033[0m" ; echo -n > /tmp/.`whoami`-build-errors
 END = 	if [[ -s /tmp/.`whoami`-build-errors ]] ; then \
 		echo -e -n "\r\033[1;33m$(1)$(2)\033[0m\n"; \
@@ -33,7 +52,7 @@ ERRORSS = >>/tmp/.`whoami`-build-errors || { $(call ERRORFUNC) }
 BEGRM = echo -e -n "  \033[31m$(1)$(2)...\033[0m" && echo -n > /tmp/.`whoami`-build-errors
 ENDRM = echo -e -n "\r  \033[1;31m$(1)$(2)\033[0m\033[K\n"
 
-.PHONY: all clean init
+.PHONY: all clean init bench lib
 
 all: init $(TARGET)
 	@$(call BEG, "CP", "resources")
@@ -56,6 +75,48 @@ $(TARGET): $(OBJECTS)
 	@$(CC) $(OBJECTS) -o $(TARGET) $(LFLAGS) $(ERRORS)
 	@$(call END, "LD", "$<")
 
+lib: $(BIN)libimagetomap.a $(BIN)libimagetomap.so
+
+$(LIB_OBJ)%.o: %.c
+	@$(call BEG, "CC", "$<")
+	@mkdir -p $(dir $@)
+	@$(CC) -c $< -o $@ $(LIB_CFLAGS) $(ERRORS)
+	@$(call END, "CC", "$<")
+
+$(BIN)libimagetomap.a: $(LIB_OBJECTS)
+	@$(call BEG, "AR", "$@")
+	@mkdir -p $(dir $@)
+	@$(AR) rcs $@ $(LIB_OBJECTS) $(ERRORS)
+	@$(call END, "AR", "$@")
+
+$(BIN)libimagetomap.so: $(LIB_OBJECTS)
+	@$(call BEG, "LD", "$@")
+	@mkdir -p $(dir $@)
+	@$(CC) -shared $(LIB_OBJECTS) -o $@ $(LIB_LFLAGS) $(ERRORS)
+	@$(call END, "LD", "$@")
+
+bench: $(BENCH) $(REGION_BENCH) $(MAKE_WORLD)
+
+$(OBJ)bench/%.o $(OBJ)tools/%.o: CFLAGS += -Isrc
+
+$(BENCH): $(BENCH_OBJECTS)
+	@$(call BEG, "LD", "$@")
+	@mkdir -p $(dir $@)
+	@$(CC) $(BENCH_OBJECTS) -o $(BENCH) $(LFLAGS) $(ERRORS)
+	@$(call END, "LD", "$@")
+
+$(REGION_BENCH): $(REGION_BENCH_OBJECTS)
+	@$(call BEG, "LD", "$@")
+	@mkdir -p $(dir $@)
+	@$(CC) $(REGION_BENCH_OBJECTS) -o $(REGION_BENCH) $(LFLAGS) $(ERRORS)
+	@$(call END, "LD", "$@")
+
+$(MAKE_WORLD): $(MAKE_WORLD_OBJECTS)
+	@$(call BEG, "LD", "$@")
+	@mkdir -p $(dir $@)
+	@$(CC) $(MAKE_WORLD_OBJECTS) -o $(MAKE_WORLD) $(LFLAGS) $(ERRORS)
+	@$(call END, "LD", "$@")
+
 clean:
 	@$(call BEGRM, "RM", "$(BIN) $(OBJ)")
 	@$(RM) -rf $(BIN) $(OBJ)
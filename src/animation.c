@@ -0,0 +1,446 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "generate.h"
+#include "nbtsave.h"
+#include "parallel.h"
+#include "animation.h"
+#include "stats.h"
+
+#define MAP_SIZE (128 * 128)
+#define SOURCE_SIZE (128 * 128 * 4)
+/* how many bytes of sources and maps a batch of frames may use */
+#define BATCH_BUDGET (64 * 1024 * 1024)
+
+typedef struct frame_reader
+{
+  /* an animated GIF is read frame by frame through an iterator */
+  GdkPixbufAnimation * animation;
+  GdkPixbufAnimationIter * iter;
+  gint64 time; /* of the current frame, in milliseconds */
+
+  /* otherwise frame i is <prefix><first + i, digits wide><suffix> */
+  char * prefix, * suffix;
+  int first, digits;
+
+  int count;
+} frame_reader_t;
+
+typedef struct convert_pass
+{
+  animation_t * animation;
+  frame_reader_t * reader;
+  int dithered, yuv;
+  int palette;
+  int tiles; /* per frame */
+
+  /* the frames of the current batch */
+  int start, frames;
+  unsigned char * sources; /* frames * tiles */
+  unsigned char * previous; /* the tiles of the frame before the batch, or NULL */
+  unsigned char * maps;
+  unsigned char * changed;
+  GError ** errors;
+
+  /* the GIF frame being sampled */
+  GdkPixbuf * pixbuf;
+  int frame;
+} convert_pass_t;
+
+static int gif_skip_sub_blocks(FILE * file)
+{
+  int size;
+
+  while((size = fgetc(file)) > 0)
+    if(fseek(file, size, SEEK_CUR) != 0)
+      return -1;
+  return size == 0 ? 0 : -1;
+}
+
+/* GdkPixbufAnimation loops forever and has no frame count, so the image
+   descriptors are counted from the file. Returns 0 if it isn't a GIF. */
+static int gif_frame_count(const char * filename)
+{
+  unsigned char header[13], descriptor[9];
+  FILE * file = fopen(filename, "rb");
+  int count = 0, c;
+
+  if(file == NULL)
+    return 0;
+  if(fread(header, 1, 13, file) != 13 || memcmp(header, "GIF8", 4) != 0)
+    {
+      fclose(file);
+      return 0;
+    }
+  if(header[10] & 0x80)
+    fseek(file, 3 << ((header[10] & 7) + 1), SEEK_CUR);
+
+  while((c = fgetc(file)) != EOF && c != 0x3B)
+    {
+      if(c == 0x21)
+	{
+	  fgetc(file);
+	  if(gif_skip_sub_blocks(file) != 0)
+	    break;
+	}
+      else if(c == 0x2C)
+	{
+	  if(fread(descriptor, 1, 9, file) != 9)
+	    break;
+	  if(descriptor[8] & 0x80)
+	    fseek(file, 3 << ((descriptor[8] & 7) + 1), SEEK_CUR);
+	  fgetc(file);
+	  if(gif_skip_sub_blocks(file) != 0)
+	    break;
+	  count++;
+	}
+      else
+	break;
+    }
+
+  fclose(file);
+  return count;
+}
+
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+static void gif_seek(frame_reader_t * reader)
+{
+  GTimeVal time;
+
+  time.tv_sec = reader->time / 1000;
+  time.tv_usec = (reader->time % 1000) * 1000;
+  if(reader->iter == NULL)
+    reader->iter = gdk_pixbuf_animation_get_iter(reader->animation, &time);
+  else
+    gdk_pixbuf_animation_iter_advance(reader->iter, &time);
+}
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+static char * sequence_path(frame_reader_t * reader, int i)
+{
+  char * path = malloc(strlen(reader->prefix) + strlen(reader->suffix) + 32);
+  sprintf(path, "%s%0*i%s", reader->prefix, reader->digits, reader->first + i, reader->suffix);
+  return path;
+}
+
+static int reader_open(frame_reader_t * reader, const char * filename, GError ** error)
+{
+  const char * name = strrchr(filename, '/'), * end, * digits;
+  struct stat info;
+
+#ifdef OS_WINDOWS
+  if(strrchr(filename, '\\') > name)
+    name = strrchr(filename, '\\');
+#endif
+
+  memset(reader, 0, sizeof(frame_reader_t));
+  reader->count = gif_frame_count(filename);
+  if(reader->count > 1)
+    {
+      gint64 start = stats_start();
+
+      reader->animation = gdk_pixbuf_animation_new_from_file(filename, error);
+      if(reader->animation == NULL)
+	return -1;
+      stats_add(STATS_DECODE, start, (gint64)gdk_pixbuf_animation_get_width(reader->animation)
+		* gdk_pixbuf_animation_get_height(reader->animation) * 4 * reader->count, reader->count);
+      gif_seek(reader);
+      return 0;
+    }
+
+  /* the last run of digits in the file name is the frame number */
+  if(name == NULL)
+    name = filename;
+  end = strrchr(name, '.');
+  if(end == NULL)
+    end = name + strlen(name);
+  for(digits = end; digits > name && digits[-1] >= '0' && digits[-1] <= '9'; digits--);
+
+  reader->prefix = malloc(digits - filename + 1);
+  memcpy(reader->prefix, filename, digits - filename);
+  reader->prefix[digits - filename] = 0;
+  reader->suffix = malloc(strlen(end) + 1);
+  strcpy(reader->suffix, end);
+  reader->digits = end - digits;
+  reader->first = atoi(digits);
+
+  if(reader->digits == 0)
+    reader->count = 1;
+  else
+    for(reader->count = 0;; reader->count++)
+      {
+	char * path = sequence_path(reader, reader->count);
+	int found = stat(path, &info) == 0;
+	free(path);
+	if(!found)
+	  break;
+      }
+  return 0;
+}
+
+static void reader_close(frame_reader_t * reader)
+{
+  if(reader->iter != NULL)
+    g_object_unref(reader->iter);
+  if(reader->animation != NULL)
+    g_object_unref(reader->animation);
+  free(reader->prefix);
+  free(reader->suffix);
+}
+
+static void sample_tiles(convert_pass_t * pass, GdkPixbuf * pixbuf, int frame, int start, int end)
+{
+  int w = pass->animation->width * 128, h = pass->animation->height * 128;
+  int k;
+
+  for(k = start; k < end; k++)
+    generate_source_area(&(pass->sources[((size_t)frame * pass->tiles + k) * SOURCE_SIZE]), w, h,
+			 (k / pass->animation->height) * 128, (k % pass->animation->height) * 128, 128, 128, pixbuf);
+}
+
+static void sample_gif_tiles(int start, int end, void * user_data)
+{
+  convert_pass_t * pass = (convert_pass_t *)user_data;
+  sample_tiles(pass, pass->pixbuf, pass->frame, start, end);
+}
+
+static void read_sequence_frames(int start, int end, void * user_data)
+{
+  convert_pass_t * pass = (convert_pass_t *)user_data;
+  int f;
+
+  for(f = start; f < end; f++)
+    {
+      char * path = sequence_path(pass->reader, pass->start + f);
+      GdkPixbuf * pixbuf = generate_load_pixbuf(path, &(pass->errors[f]));
+
+      free(path);
+      if(pixbuf == NULL)
+	continue;
+      sample_tiles(pass, pixbuf, f, 0, pass->tiles);
+      g_object_unref(pixbuf);
+    }
+}
+
+/* Tiles are only converted if they differ from the frame before. */
+static void convert_tiles(int start, int end, void * user_data)
+{
+  convert_pass_t * pass = (convert_pass_t *)user_data;
+  int p;
+
+  for(p = start; p < end; p++)
+    {
+      unsigned char * source = &(pass->sources[(size_t)p * SOURCE_SIZE]);
+      unsigned char * before = NULL;
+
+      if(p >= pass->tiles)
+	before = source - (size_t)pass->tiles * SOURCE_SIZE;
+      else if(pass->previous != NULL)
+	before = &(pass->previous[(size_t)p * SOURCE_SIZE]);
+
+      pass->changed[p] = before == NULL || memcmp(before, source, SOURCE_SIZE) != 0;
+      if(!pass->changed[p])
+	continue;
+      if(pass->dithered)
+	generate_from_source_ordered(&(pass->maps[(size_t)p * MAP_SIZE]), source, pass->yuv, pass->palette);
+      else
+	generate_from_source(&(pass->maps[(size_t)p * MAP_SIZE]), source, 0, pass->yuv, pass->palette);
+    }
+}
+
+static int read_batch(convert_pass_t * pass, GError ** error)
+{
+  frame_reader_t * reader = pass->reader;
+  int f;
+
+  if(reader->animation == NULL)
+    {
+      memset(pass->errors, 0, pass->frames * sizeof(GError *));
+      parallel_for(pass->frames, 1, read_sequence_frames, pass);
+      for(f = 0; f < pass->frames; f++)
+	if(pass->errors[f] != NULL)
+	  {
+	    if(*error == NULL)
+	      *error = pass->errors[f];
+	    else
+	      g_error_free(pass->errors[f]);
+	  }
+      return *error == NULL ? 0 : -1;
+    }
+
+  for(f = 0; f < pass->frames; f++)
+    {
+      int delay = gdk_pixbuf_animation_iter_get_delay_time(reader->iter);
+
+      pass->pixbuf = gdk_pixbuf_animation_iter_get_pixbuf(reader->iter);
+      pass->frame = f;
+      parallel_for(pass->tiles, 1, sample_gif_tiles, pass);
+
+      pass->animation->delays[pass->start + f] = delay > 0 ? delay : 0;
+      reader->time += delay > 0 ? delay : 100;
+      gif_seek(reader);
+    }
+  return 0;
+}
+
+/* Numbers the maps in frame order, unchanged tiles take the map of the
+   frame before. */
+static void store_batch(convert_pass_t * pass)
+{
+  animation_t * animation = pass->animation;
+  int p, new_maps = 0;
+
+  for(p = 0; p < pass->frames * pass->tiles; p++)
+    new_maps += pass->changed[p];
+  animation->maps = realloc(animation->maps, (size_t)(animation->map_count + new_maps) * MAP_SIZE);
+
+  for(p = 0; p < pass->frames * pass->tiles; p++)
+    {
+      int tile = pass->start * pass->tiles + p;
+
+      if(pass->changed[p])
+	{
+	  memcpy(&(animation->maps[(size_t)animation->map_count * MAP_SIZE]), &(pass->maps[(size_t)p * MAP_SIZE]), MAP_SIZE);
+	  animation->tiles[tile] = animation->map_count++;
+	}
+      else
+	animation->tiles[tile] = animation->tiles[tile - pass->tiles];
+    }
+}
+
+animation_t * animation_convert(const char * filename, int width, int height, int dithered, int yuv,
+				int palette, GError ** error, progress_t * progress)
+{
+  animation_t * animation;
+  frame_reader_t reader;
+  convert_pass_t pass;
+  int batch, tiles = width * height;
+
+  if(reader_open(&reader, filename, error) != 0)
+    return NULL;
+  if(reader.count == 0)
+    {
+      reader_close(&reader);
+      return NULL;
+    }
+
+  animation = calloc(1, sizeof(animation_t));
+  animation->width = width;
+  animation->height = height;
+  animation->frame_count = reader.count;
+  animation->delays = calloc(reader.count, sizeof(int));
+  animation->tiles = malloc((size_t)reader.count * tiles * sizeof(int));
+
+  batch = BATCH_BUDGET / (tiles * (SOURCE_SIZE + MAP_SIZE));
+  batch = CLAMP(batch, 1, reader.count);
+
+  memset(&pass, 0, sizeof(pass));
+  pass.animation = animation;
+  pass.reader = &reader;
+  pass.dithered = dithered;
+  pass.yuv = yuv;
+  pass.palette = palette;
+  pass.tiles = tiles;
+  pass.sources = malloc((size_t)batch * tiles * SOURCE_SIZE);
+  pass.maps = malloc((size_t)batch * tiles * MAP_SIZE);
+  pass.changed = malloc((size_t)batch * tiles);
+  pass.errors = malloc(batch * sizeof(GError *));
+
+  for(pass.start = 0; pass.start < reader.count; pass.start += pass.frames)
+    {
+      pass.frames = MIN(batch, reader.count - pass.start);
+      if(progress_set(progress, pass.start, reader.count) || read_batch(&pass, error) != 0)
+	break;
+      parallel_for(pass.frames * tiles, 1, convert_tiles, &pass);
+      store_batch(&pass);
+
+      if(pass.previous == NULL)
+	pass.previous = malloc((size_t)tiles * SOURCE_SIZE);
+      memcpy(pass.previous, &(pass.sources[(size_t)(pass.frames - 1) * tiles * SOURCE_SIZE]), (size_t)tiles * SOURCE_SIZE);
+    }
+
+  free(pass.sources);
+  free(pass.previous);
+  free(pass.maps);
+  free(pass.changed);
+  free(pass.errors);
+  reader_close(&reader);
+
+  if(pass.start < reader.count)
+    {
+      animation_free(animation);
+      return NULL;
+    }
+  progress_set(progress, 1, 1);
+  return animation;
+}
+
+void animation_free(animation_t * animation)
+{
+  if(animation == NULL)
+    return;
+  free(animation->delays);
+  free(animation->tiles);
+  free(animation->maps);
+  free(animation);
+}
+
+int animation_save(animation_t * animation, const char * dirname, int first)
+{
+  char path[1024];
+  FILE * file;
+  int i, k, tiles = animation->width * animation->height;
+
+  for(i = 0; i < animation->map_count; i++)
+    {
+#ifdef OS_WINDOWS
+      snprintf(path, sizeof(path), "%s\\map_%i.dat", dirname, first + i);
+#else
+      snprintf(path, sizeof(path), "%s/map_%i.dat", dirname, first + i);
+#endif
+      file = fopen(path, "wb");
+      if(file == NULL)
+	return -1;
+      nbt_write_map(file, 0, 3, 128, 128, 13371337, -13371337, &(animation->maps[(size_t)i * MAP_SIZE]));
+      if(fclose(file) != 0)
+	return -1;
+    }
+
+#ifdef OS_WINDOWS
+  snprintf(path, sizeof(path), "%s\\frames.txt", dirname);
+#else
+  snprintf(path, sizeof(path), "%s/frames.txt", dirname);
+#endif
+  file = fopen(path, "w");
+  if(file == NULL)
+    return -1;
+  fprintf(file, "# %i x %i maps per frame, column by column: delay in ms, then the map numbers\n",
+	  animation->width, animation->height);
+  for(i = 0; i < animation->frame_count; i++)
+    {
+      fprintf(file, "%i", animation->delays[i]);
+      for(k = 0; k < tiles; k++)
+	fprintf(file, " %i", first + animation->tiles[i * tiles + k]);
+      fprintf(file, "\n");
+    }
+  return fclose(file) == 0 ? 0 : -1;
+}
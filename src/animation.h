@@ -0,0 +1,34 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+/* An animated GIF or a numbered sequence of images converted into a
+   width * height grid of maps per frame. A tile that looks the same as
+   in the frame before isn't converted or stored again, it uses the same
+   map. */
+typedef struct animation
+{
+  int width, height; /* the grid, in maps */
+  int frame_count;
+  int * delays; /* milliseconds each frame is shown, 0 if not known */
+  /* tiles[frame * width * height + k] is the map of tile k, tiles are
+     numbered column by column like Open Grid Image does */
+  int * tiles;
+  int map_count;
+  unsigned char * maps;
+} animation_t;
+
+/* Converts every frame of the GIF at filename, or if it isn't animated
+   of the images numbered like it, e.g. frame_007.png, frame_008.png and
+   so on for as long as they exist. Frames are converted in parallel, a
+   dithered conversion uses the ordered dither of
+   generate_from_source_ordered so unchanged parts stay unchanged. Returns
+   NULL if a frame couldn't be read or progress was cancelled. */
+animation_t * animation_convert(const char * filename, int width, int height, int dithered, int yuv,
+				int palette, GError ** error, progress_t * progress);
+void animation_free(animation_t * animation);
+
+/* Saves map i as <dirname>/map_<first + i>.dat and a frames.txt listing,
+   for every frame, its delay and the map numbers of its tiles. */
+int animation_save(animation_t * animation, const char * dirname, int first);
+
+#endif
@@ -0,0 +1,618 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <gtk/gtk.h>
+
+#include "glib_compat.h"
+#include "data_structures.h"
+#include "buffer_store.h"
+
+#define MAP_SIZE (128 * 128)
+#define SOURCE_SIZE (128 * 128 * 4)
+/* maps are allocated 64 at a time, 1 MB per slab */
+#define SLAB_MAPS 64
+/* the most recently used buffers are never packed */
+#define KEEP_RECENT 4
+
+typedef struct buffer_entry
+{
+  /* NULL while the buffer is packed, see buffer_store_trim */
+  unsigned char * data;
+  unsigned char * source; /* see buffer_store_set_source, or NULL */
+  /* the map, followed by the source if packed_source, deflated */
+  unsigned char * packed; /* NULL if resident or spilled */
+  unsigned long packed_size;
+  long spill_offset; /* of the packed bytes in the spill file, or -1 */
+  int packed_source;
+  volatile gint last_use;
+  map_data_t info;
+  unsigned int version;
+  int next_free; /* the next unused entry, -2 while the entry is in use */
+} buffer_entry_t;
+
+struct buffer_store
+{
+  buffer_entry_t * entries;
+  int entry_count, entry_size;
+  int free_entry;
+
+  /* order[position] is the handle of the buffer at position */
+  buffer_handle_t * order;
+  int count, order_size;
+
+  unsigned char ** slabs;
+  int slab_count;
+  /* unused maps are chained through their first bytes */
+  unsigned char * free_map;
+
+  /* unpacking happens on whatever thread asks for the data */
+  GMutex lock;
+  volatile gint clock;
+  size_t budget;
+  buffer_store_usage_t usage;
+  FILE * spill;
+  long spill_end;
+};
+
+buffer_store_t * buffer_store_new(void)
+{
+  buffer_store_t * store = calloc(1, sizeof(buffer_store_t));
+  store->free_entry = -1;
+  g_mutex_init(&(store->lock));
+  return store;
+}
+
+void buffer_store_free(buffer_store_t * store)
+{
+  int i;
+
+  if(store == NULL)
+    return;
+  for(i = 0; i < store->entry_count; i++)
+    if(store->entries[i].next_free == -2)
+      {
+	free(store->entries[i].source);
+	free(store->entries[i].packed);
+      }
+  for(i = 0; i < store->slab_count; i++)
+    free(store->slabs[i]);
+  if(store->spill != NULL)
+    fclose(store->spill);
+  g_mutex_clear(&(store->lock));
+  free(store->slabs);
+  free(store->entries);
+  free(store->order);
+  free(store);
+}
+
+static unsigned char * map_alloc(buffer_store_t * store)
+{
+  unsigned char * map;
+
+  if(store->free_map == NULL)
+    {
+      unsigned char * slab = malloc((size_t)SLAB_MAPS * MAP_SIZE);
+      int i;
+
+      store->slabs = realloc(store->slabs, (store->slab_count + 1) * sizeof(unsigned char *));
+      store->slabs[store->slab_count++] = slab;
+      for(i = SLAB_MAPS - 1; i >= 0; i--)
+	{
+	  unsigned char * m = slab + (size_t)i * MAP_SIZE;
+	  memcpy(m, &(store->free_map), sizeof(unsigned char *));
+	  store->free_map = m;
+	}
+    }
+
+  map = store->free_map;
+  memcpy(&(store->free_map), map, sizeof(unsigned char *));
+  return map;
+}
+
+static void map_release(buffer_store_t * store, unsigned char * map)
+{
+  memcpy(map, &(store->free_map), sizeof(unsigned char *));
+  store->free_map = map;
+}
+
+static void usage_changed(buffer_store_t * store)
+{
+  size_t total = store->usage.resident + store->usage.packed;
+  if(total > store->usage.peak)
+    store->usage.peak = total;
+}
+
+static void entry_use(buffer_store_t * store, buffer_entry_t * entry)
+{
+  g_atomic_int_set(&(entry->last_use), g_atomic_int_add(&(store->clock), 1));
+}
+
+/* The usage counts and the spill file are only changed with the lock
+   held. */
+
+static void entry_pack(buffer_store_t * store, buffer_entry_t * entry)
+{
+  uLongf size = MAP_SIZE, packed_size;
+  unsigned char * raw = entry->data;
+
+  if(entry->source != NULL)
+    {
+      size += SOURCE_SIZE;
+      raw = malloc(size);
+      memcpy(raw, entry->data, MAP_SIZE);
+      memcpy(raw + MAP_SIZE, entry->source, SOURCE_SIZE);
+    }
+
+  packed_size = compressBound(size);
+  entry->packed = malloc(packed_size);
+  if(compress2(entry->packed, &packed_size, raw, size, 1) != Z_OK)
+    {
+      free(entry->packed);
+      entry->packed = NULL;
+      if(raw != entry->data)
+	free(raw);
+      return;
+    }
+  entry->packed = realloc(entry->packed, packed_size);
+  entry->packed_size = packed_size;
+  entry->packed_source = entry->source != NULL;
+  entry->spill_offset = -1;
+  if(raw != entry->data)
+    free(raw);
+
+  store->usage.resident -= size;
+  store->usage.packed += packed_size;
+  map_release(store, entry->data);
+  entry->data = NULL;
+  free(entry->source);
+  entry->source = NULL;
+}
+
+static void entry_spill(buffer_store_t * store, buffer_entry_t * entry)
+{
+  if(store->spill == NULL && (store->spill = tmpfile()) == NULL)
+    return;
+
+  if(fseek(store->spill, store->spill_end, SEEK_SET) != 0
+     || fwrite(entry->packed, 1, entry->packed_size, store->spill) != entry->packed_size)
+    return;
+
+  entry->spill_offset = store->spill_end;
+  store->spill_end += entry->packed_size;
+  free(entry->packed);
+  entry->packed = NULL;
+  store->usage.packed -= entry->packed_size;
+  store->usage.spilled += entry->packed_size;
+}
+
+/* Forgets the packed bytes of an entry, the space in the spill file is
+   reused once nothing is left in it. */
+static void entry_drop_packed(buffer_store_t * store, buffer_entry_t * entry)
+{
+  if(entry->packed != NULL)
+    {
+      free(entry->packed);
+      entry->packed = NULL;
+      store->usage.packed -= entry->packed_size;
+    }
+  else if(entry->spill_offset >= 0)
+    {
+      entry->spill_offset = -1;
+      store->usage.spilled -= entry->packed_size;
+      if(store->usage.spilled == 0)
+	store->spill_end = 0;
+    }
+}
+
+/* Inflates the packed bytes of an entry into raw, which has room for the
+   map and the source if there is one. */
+static void entry_read_packed(buffer_store_t * store, buffer_entry_t * entry, unsigned char * raw)
+{
+  uLongf size = MAP_SIZE + (entry->packed_source ? SOURCE_SIZE : 0);
+  unsigned char * packed = entry->packed;
+
+  if(packed == NULL)
+    {
+      packed = malloc(entry->packed_size);
+      if(fseek(store->spill, entry->spill_offset, SEEK_SET) != 0
+	 || fread(packed, 1, entry->packed_size, store->spill) != entry->packed_size)
+	fprintf(stderr, "Could not read back a buffer from the spill file\n");
+    }
+  if(uncompress(raw, &size, packed, entry->packed_size) != Z_OK)
+    fprintf(stderr, "Could not unpack a buffer\n");
+  if(packed != entry->packed)
+    free(packed);
+}
+
+static void entry_unpack(buffer_store_t * store, buffer_entry_t * entry)
+{
+  unsigned char * raw = calloc(1, MAP_SIZE + (entry->packed_source ? SOURCE_SIZE : 0));
+  unsigned char * data = map_alloc(store);
+
+  entry_read_packed(store, entry, raw);
+  memcpy(data, raw, MAP_SIZE);
+  if(entry->packed_source)
+    {
+      entry->source = malloc(SOURCE_SIZE);
+      memcpy(entry->source, raw + MAP_SIZE, SOURCE_SIZE);
+    }
+  free(raw);
+
+  entry_drop_packed(store, entry);
+  store->usage.resident += MAP_SIZE + (entry->packed_source ? SOURCE_SIZE : 0);
+  usage_changed(store);
+  /* other threads check data without the lock */
+  g_atomic_pointer_set(&(entry->data), data);
+}
+
+static void entry_ensure(buffer_store_t * store, buffer_entry_t * entry)
+{
+  if(g_atomic_pointer_get(&(entry->data)) == NULL)
+    {
+      g_mutex_lock(&(store->lock));
+      if(entry->data == NULL)
+	entry_unpack(store, entry);
+      g_mutex_unlock(&(store->lock));
+    }
+  entry_use(store, entry);
+}
+
+static buffer_entry_t * get_entry(buffer_store_t * store, buffer_handle_t handle)
+{
+  if(handle < 0 || handle >= store->entry_count || store->entries[handle].next_free != -2)
+    return NULL;
+  return &(store->entries[handle]);
+}
+
+static void order_insert(buffer_store_t * store, buffer_handle_t handle, int position)
+{
+  if(store->count == store->order_size)
+    {
+      store->order_size = store->order_size ? store->order_size * 2 : 64;
+      store->order = realloc(store->order, store->order_size * sizeof(buffer_handle_t));
+    }
+  memmove(&(store->order[position + 1]), &(store->order[position]),
+	  (store->count - position) * sizeof(buffer_handle_t));
+  store->order[position] = handle;
+  store->count++;
+}
+
+static void entry_init(buffer_store_t * store, buffer_entry_t * entry)
+{
+  g_mutex_lock(&(store->lock));
+  entry->data = map_alloc(store);
+  store->usage.resident += MAP_SIZE;
+  usage_changed(store);
+  g_mutex_unlock(&(store->lock));
+
+  entry->source = NULL;
+  entry->packed = NULL;
+  entry->spill_offset = -1;
+  memset(&(entry->info), 0, sizeof(map_data_t));
+  /* versions carry on through reuse, so stale caches of a reused handle
+     never match */
+  entry->version++;
+  entry->next_free = -2;
+  entry_use(store, entry);
+}
+
+int buffer_store_count(buffer_store_t * store)
+{
+  return store->count;
+}
+
+int buffer_store_add(buffer_store_t * store)
+{
+  buffer_handle_t handle;
+
+  if(store->free_entry >= 0)
+    {
+      handle = store->free_entry;
+      store->free_entry = store->entries[handle].next_free;
+    }
+  else
+    {
+      if(store->entry_count == store->entry_size)
+	{
+	  store->entry_size = store->entry_size ? store->entry_size * 2 : 64;
+	  store->entries = realloc(store->entries, store->entry_size * sizeof(buffer_entry_t));
+	}
+      handle = store->entry_count++;
+      store->entries[handle].version = 0;
+    }
+
+  entry_init(store, &(store->entries[handle]));
+  order_insert(store, handle, store->count);
+  return store->count - 1;
+}
+
+int buffer_store_restore(buffer_store_t * store, buffer_handle_t handle, int position)
+{
+  buffer_entry_t * entry;
+  int * link;
+
+  if(handle < 0 || handle >= store->entry_count || position < 0 || position > store->count)
+    return -1;
+
+  /* unlink the handle from wherever it is in the free list */
+  for(link = &(store->free_entry); *link >= 0 && *link != handle; link = &(store->entries[*link].next_free));
+  if(*link != handle)
+    return -1;
+  entry = &(store->entries[handle]);
+  *link = entry->next_free;
+
+  entry_init(store, entry);
+  order_insert(store, handle, position);
+  return position;
+}
+
+void buffer_store_remove(buffer_store_t * store, int position)
+{
+  buffer_handle_t handle = buffer_store_handle(store, position);
+  buffer_entry_t * entry = get_entry(store, handle);
+
+  if(entry == NULL)
+    return;
+
+  g_mutex_lock(&(store->lock));
+  if(entry->data != NULL)
+    {
+      store->usage.resident -= MAP_SIZE + (entry->source ? SOURCE_SIZE : 0);
+      map_release(store, entry->data);
+    }
+  else
+    entry_drop_packed(store, entry);
+  g_mutex_unlock(&(store->lock));
+  entry->data = NULL;
+  free(entry->source);
+  entry->source = NULL;
+  entry->next_free = store->free_entry;
+  store->free_entry = handle;
+
+  memmove(&(store->order[position]), &(store->order[position + 1]),
+	  (store->count - position - 1) * sizeof(buffer_handle_t));
+  store->count--;
+}
+
+void buffer_store_swap(buffer_store_t * store, int a, int b)
+{
+  buffer_handle_t handle;
+
+  if(a < 0 || a >= store->count || b < 0 || b >= store->count)
+    return;
+  handle = store->order[a];
+  store->order[a] = store->order[b];
+  store->order[b] = handle;
+}
+
+buffer_handle_t buffer_store_handle(buffer_store_t * store, int position)
+{
+  if(position < 0 || position >= store->count)
+    return -1;
+  return store->order[position];
+}
+
+unsigned char * buffer_store_data(buffer_store_t * store, int position)
+{
+  return buffer_store_handle_data(store, buffer_store_handle(store, position));
+}
+
+map_data_t * buffer_store_info(buffer_store_t * store, int position)
+{
+  return buffer_store_handle_info(store, buffer_store_handle(store, position));
+}
+
+unsigned char * buffer_store_handle_data(buffer_store_t * store, buffer_handle_t handle)
+{
+  buffer_entry_t * entry = get_entry(store, handle);
+
+  if(entry == NULL)
+    return NULL;
+  entry_ensure(store, entry);
+  return entry->data;
+}
+
+int buffer_store_peek(buffer_store_t * store, int position, unsigned char * map)
+{
+  buffer_entry_t * entry = get_entry(store, buffer_store_handle(store, position));
+  unsigned char * raw;
+
+  if(entry == NULL)
+    return -1;
+  if(g_atomic_pointer_get(&(entry->data)) != NULL)
+    {
+      memcpy(map, entry->data, MAP_SIZE);
+      return 0;
+    }
+
+  g_mutex_lock(&(store->lock));
+  if(entry->data != NULL)
+    memcpy(map, entry->data, MAP_SIZE);
+  else
+    {
+      raw = calloc(1, MAP_SIZE + (entry->packed_source ? SOURCE_SIZE : 0));
+      entry_read_packed(store, entry, raw);
+      memcpy(map, raw, MAP_SIZE);
+      free(raw);
+    }
+  g_mutex_unlock(&(store->lock));
+  return 0;
+}
+
+map_data_t * buffer_store_handle_info(buffer_store_t * store, buffer_handle_t handle)
+{
+  buffer_entry_t * entry = get_entry(store, handle);
+  return entry ? &(entry->info) : NULL;
+}
+
+unsigned int buffer_store_version(buffer_store_t * store, int position)
+{
+  buffer_entry_t * entry = get_entry(store, buffer_store_handle(store, position));
+  return entry ? entry->version : 0;
+}
+
+void buffer_store_touch(buffer_store_t * store, int position)
+{
+  buffer_entry_t * entry = get_entry(store, buffer_store_handle(store, position));
+  if(entry != NULL)
+    entry->version++;
+}
+
+void buffer_store_set_source(buffer_store_t * store, int position, unsigned char * source)
+{
+  buffer_entry_t * entry = get_entry(store, buffer_store_handle(store, position));
+
+  if(entry == NULL)
+    {
+      free(source);
+      return;
+    }
+  entry_ensure(store, entry);
+  g_mutex_lock(&(store->lock));
+  if(entry->source != NULL)
+    store->usage.resident -= SOURCE_SIZE;
+  if(source != NULL)
+    store->usage.resident += SOURCE_SIZE;
+  usage_changed(store);
+  g_mutex_unlock(&(store->lock));
+  free(entry->source);
+  entry->source = source;
+}
+
+unsigned char * buffer_store_source(buffer_store_t * store, int position)
+{
+  buffer_entry_t * entry = get_entry(store, buffer_store_handle(store, position));
+
+  if(entry == NULL)
+    return NULL;
+  entry_ensure(store, entry);
+  return entry->source;
+}
+
+void buffer_store_set_budget(buffer_store_t * store, size_t budget)
+{
+  store->budget = budget;
+}
+
+typedef struct
+{
+  unsigned int age;
+  buffer_handle_t handle;
+} lru_item_t;
+
+static int lru_compare(const void * a, const void * b)
+{
+  unsigned int x = ((const lru_item_t *)a)->age, y = ((const lru_item_t *)b)->age;
+  return x > y ? -1 : x < y;
+}
+
+static int over_budget(buffer_store_t * store)
+{
+  return store->usage.resident + store->usage.packed > store->budget;
+}
+
+/* Writes the spilled bytes still in use to a new spill file, once the ones
+   unpacked since take more room than they do. */
+static void spill_compact(buffer_store_t * store)
+{
+  long * offsets;
+  unsigned char * packed;
+  FILE * spill;
+  long end = 0;
+  int i;
+
+  if(store->spill_end - (long)store->usage.spilled <= (long)store->usage.spilled
+     || (spill = tmpfile()) == NULL)
+    return;
+
+  /* the old file stays in use until every entry made it to the new one */
+  offsets = malloc(store->entry_count * sizeof(long));
+  for(i = 0; i < store->entry_count; i++)
+    {
+      buffer_entry_t * entry = &(store->entries[i]);
+
+      offsets[i] = -1;
+      if(entry->next_free != -2 || entry->spill_offset < 0)
+	continue;
+
+      packed = malloc(entry->packed_size);
+      if(fseek(store->spill, entry->spill_offset, SEEK_SET) != 0
+	 || fread(packed, 1, entry->packed_size, store->spill) != entry->packed_size
+	 || fwrite(packed, 1, entry->packed_size, spill) != entry->packed_size)
+	{
+	  free(packed);
+	  free(offsets);
+	  fclose(spill);
+	  return;
+	}
+      free(packed);
+      offsets[i] = end;
+      end += entry->packed_size;
+    }
+
+  for(i = 0; i < store->entry_count; i++)
+    if(offsets[i] >= 0)
+      store->entries[i].spill_offset = offsets[i];
+  free(offsets);
+  fclose(store->spill);
+  store->spill = spill;
+  store->spill_end = end;
+}
+
+void buffer_store_trim(buffer_store_t * store, int keep)
+{
+  buffer_handle_t keep_handle = buffer_store_handle(store, keep);
+  unsigned int now;
+  lru_item_t * lru;
+  int i, n = 0;
+
+  if(store->budget == 0 || !over_budget(store))
+    return;
+
+  g_mutex_lock(&(store->lock));
+  now = g_atomic_int_get(&(store->clock));
+  lru = malloc(store->count * sizeof(lru_item_t));
+  for(i = 0; i < store->count; i++)
+    if(store->order[i] != keep_handle)
+      {
+	/* ages rather than use times, so the clock may wrap */
+	lru[n].age = now - (unsigned int)store->entries[store->order[i]].last_use;
+	lru[n++].handle = store->order[i];
+      }
+  qsort(lru, n, sizeof(lru_item_t), lru_compare);
+
+  /* pack the least recently used first, then move the oldest packed
+     buffers out to the spill file if that wasn't enough */
+  for(i = 0; i < n - KEEP_RECENT && over_budget(store); i++)
+    if(store->entries[lru[i].handle].data != NULL)
+      entry_pack(store, &(store->entries[lru[i].handle]));
+  for(i = 0; i < n && over_budget(store); i++)
+    if(store->entries[lru[i].handle].packed != NULL)
+      entry_spill(store, &(store->entries[lru[i].handle]));
+  spill_compact(store);
+
+  free(lru);
+  g_mutex_unlock(&(store->lock));
+}
+
+void buffer_store_get_usage(buffer_store_t * store, buffer_store_usage_t * usage)
+{
+  g_mutex_lock(&(store->lock));
+  *usage = store->usage;
+  g_mutex_unlock(&(store->lock));
+}
@@ -0,0 +1,71 @@
+#ifndef BUFFER_STORE_H
+#define BUFFER_STORE_H
+
+/* Identifies a buffer for as long as it exists, whatever its position. */
+typedef int buffer_handle_t;
+
+typedef struct buffer_store buffer_store_t;
+
+buffer_store_t * buffer_store_new(void);
+void buffer_store_free(buffer_store_t * store);
+
+int buffer_store_count(buffer_store_t * store);
+
+/* Adding, restoring, removing and swapping change the lists other threads
+   read without the lock, so like buffer_store_trim they must not overlap
+   with any other use of the store. */
+
+/* Appends a buffer and returns its position, the map data is left
+   uninitialized. */
+int buffer_store_add(buffer_store_t * store);
+void buffer_store_remove(buffer_store_t * store, int position);
+/* Brings a removed buffer back under its old handle, inserted at
+   position, for undo. The map data is left uninitialized. Returns -1 if
+   the handle is in use or has never existed. */
+int buffer_store_restore(buffer_store_t * store, buffer_handle_t handle, int position);
+/* Reordering only moves handles, never map data. */
+void buffer_store_swap(buffer_store_t * store, int a, int b);
+
+/* These return NULL / -1 for positions and handles that don't exist. */
+buffer_handle_t buffer_store_handle(buffer_store_t * store, int position);
+unsigned char * buffer_store_data(buffer_store_t * store, int position);
+map_data_t * buffer_store_info(buffer_store_t * store, int position);
+unsigned char * buffer_store_handle_data(buffer_store_t * store, buffer_handle_t handle);
+map_data_t * buffer_store_handle_info(buffer_store_t * store, buffer_handle_t handle);
+/* Copies the map data at position into map without unpacking the buffer
+   or counting it as used, for readers that shouldn't keep it resident.
+   Returns -1 if there is no buffer at position. */
+int buffer_store_peek(buffer_store_t * store, int position, unsigned char * map);
+
+/* Every buffer has a version that is bumped whenever it's touched, for
+   caches of anything derived from the map data. */
+unsigned int buffer_store_version(buffer_store_t * store, int position);
+void buffer_store_touch(buffer_store_t * store, int position);
+
+/* Buffers converted from an image keep the 128 * 128 RGBA pixels they were
+   made from, so they can be converted again with other settings. The store
+   takes ownership of source, NULL drops it. */
+void buffer_store_set_source(buffer_store_t * store, int position, unsigned char * source);
+unsigned char * buffer_store_source(buffer_store_t * store, int position);
+
+/* Buffers that haven't been used for a while can be packed with zlib to
+   stay within a memory budget, and moved out to a temporary file if the
+   packed bytes still don't fit. The data, source and handle_data calls
+   unpack them again on any thread, so their pointers stay valid until the
+   next trim. Sizes are in bytes. */
+typedef struct
+{
+  size_t resident, packed, spilled;
+  /* the most resident and packed bytes there have been at once */
+  size_t peak;
+} buffer_store_usage_t;
+
+/* 0, the default, means no limit. */
+void buffer_store_set_budget(buffer_store_t * store, size_t budget);
+/* Packs the least recently used buffers until the store fits its budget,
+   leaving the buffer at position and the few used last as they are. Only
+   call this while no other thread uses the store. */
+void buffer_store_trim(buffer_store_t * store, int keep);
+void buffer_store_get_usage(buffer_store_t * store, buffer_store_usage_t * usage);
+
+#endif
@@ -0,0 +1,357 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+ 
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "quantize.h"
+#include "palette_tables.h"
+#include "nbtsave.h"
+#include "world_watch.h"
+#include "world_export.h"
+#include "world_overview.h"
+#include "parallel.h"
+#include "convert_server.h"
+#include "animation.h"
+#include "stats.h"
+#include "trace.h"
+#include "cli.h"
+
+static void usage(const char * name)
+{
+  fprintf(stderr,
+	  "usage: %s --watch-add <state> <region dir> <map_N.dat> <x> <z> <scale> [dimension]\n"
+	  "       %s --watch-update <state>\n"
+	  "       %s --watch <state> [poll seconds]\n"
+	  "       %s --export-world <region dir> <out.png> <x> <z> <width> <height> [scale]\n"
+	  "       %s --overview <region dir> <out.png> [--heights]\n"
+	  "       %s --serve <socket> [jobs] [--palette <name>]\n"
+	  "       %s --animation <gif or first frame> <out dir> <width> <height> [first map] [--dither] [--yuv] [--palette <name>]\n"
+	  "palettes are legacy, 1.8 (the default), 1.12, 1.16 and 1.17\n"
+	  "any of them can end with --stats <file.json or -> to write the time spent in every stage,\n"
+	  "and with --trace <file.json> to write a timeline of every thread for chrome://tracing\n",
+	  name, name, name, name, name, name, name);
+}
+
+static int cli_watch_add(int argc, char ** argv)
+{
+  world_watch_t * watch;
+  int dimension = 0;
+
+  if(argc < 8)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  if(argc > 8)
+    dimension = atoi(argv[8]);
+
+  /* a state that can't be read is kept rather than replaced, it may hold
+     maps of an older version */
+  if(!g_file_test(argv[2], G_FILE_TEST_EXISTS))
+    watch = world_watch_new();
+  else if((watch = world_watch_load(argv[2])) == NULL)
+    {
+      fprintf(stderr, "Could not read %s\n", argv[2]);
+      return 1;
+    }
+
+  world_watch_add_map(watch, argv[3], argv[4], atoi(argv[5]), atoi(argv[6]), atoi(argv[7]), dimension);
+
+  if(world_watch_save(watch, argv[2]) != 0)
+    {
+      fprintf(stderr, "Could not write %s\n", argv[2]);
+      world_watch_free(watch);
+      return 1;
+    }
+  world_watch_free(watch);
+  return 0;
+}
+
+static int cli_watch(int argc, char ** argv, int loop)
+{
+  world_watch_t * watch;
+  int interval = 10;
+
+  if(argc < 3)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  if(argc > 3)
+    interval = atoi(argv[3]);
+
+  watch = world_watch_load(argv[2]);
+  if(watch == NULL)
+    {
+      fprintf(stderr, "Could not read %s\n", argv[2]);
+      return 1;
+    }
+
+  do
+    {
+      int saved = world_watch_update(watch);
+      if(saved > 0)
+	{
+	  printf("%i of %i maps updated\n", saved, watch->map_count);
+	  if(world_watch_save(watch, argv[2]) != 0)
+	    fprintf(stderr, "Could not write %s\n", argv[2]);
+	}
+      if(loop)
+	g_usleep((gulong)interval * G_USEC_PER_SEC);
+    } while(loop);
+
+  world_watch_free(watch);
+  return 0;
+}
+
+static int cli_export_world(int argc, char ** argv)
+{
+  int scale = 0;
+
+  if(argc < 8)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  if(argc > 8)
+    scale = atoi(argv[8]);
+
+  if(world_export_png(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]), atoi(argv[6]), atoi(argv[7]),
+		      scale, palettes[PALETTE_DEFAULT].colors, 6, NULL) != 0)
+    {
+      fprintf(stderr, "Could not write %s\n", argv[3]);
+      return 1;
+    }
+  return 0;
+}
+
+static int cli_overview(int argc, char ** argv)
+{
+  world_overview_t * overview;
+  int shaded = (argc > 4 && strcmp(argv[4], "--heights") == 0);
+  gint64 start = g_get_monotonic_time();
+
+  if(argc < 4)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+
+  overview = world_overview_scan(argv[2]);
+  if(overview == NULL)
+    {
+      fprintf(stderr, "No region files in %s, or they span too large an area\n", argv[2]);
+      return 1;
+    }
+  if(shaded && world_overview_read_heights(overview, argv[2]) != 0)
+    {
+      fprintf(stderr, "Not enough memory for the heights of %s\n", argv[2]);
+      world_overview_free(overview);
+      return 1;
+    }
+
+  printf("%i chunks in %i regions, chunks %i, %i to %i, %i, read in %.1f ms\n",
+	 overview->chunk_count, overview->region_count, overview->x, overview->z,
+	 overview->x + overview->width - 1, overview->z + overview->height - 1,
+	 (g_get_monotonic_time() - start) / 1000.0);
+
+  if(world_overview_write_png(overview, argv[3], shaded, 6) != 0)
+    {
+      fprintf(stderr, "Could not write %s\n", argv[3]);
+      world_overview_free(overview);
+      return 1;
+    }
+  world_overview_free(overview);
+  return 0;
+}
+
+/* The palette named by the argument after --palette, --old-colors is
+   still taken for the legacy one. Returns -1 for unknown names. */
+static int palette_argument(int argc, char ** argv, int * i, int * palette)
+{
+  if(strcmp(argv[*i], "--old-colors") == 0)
+    *palette = PALETTE_LEGACY;
+  else if(strcmp(argv[*i], "--palette") == 0 && *i + 1 < argc)
+    *palette = palette_find(argv[++(*i)]);
+  else
+    return 0;
+  if(*palette < 0)
+    {
+      fprintf(stderr, "Unknown palette %s\n", argv[*i]);
+      return -1;
+    }
+  return 1;
+}
+
+static int cli_serve(int argc, char ** argv)
+{
+  int jobs = parallel_get_thread_count(), palette = PALETTE_DEFAULT, i, ret;
+
+  if(argc < 3)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  for(i = 3; i < argc; i++)
+    if((ret = palette_argument(argc, argv, &i, &palette)) < 0)
+      return 1;
+    else if(ret == 0)
+      jobs = atoi(argv[i]);
+  if(jobs < 1)
+    jobs = 1;
+
+  if(convert_server_run(argv[2], jobs, palettes[palette].name) != 0)
+    {
+      fprintf(stderr, "Could not listen on %s\n", argv[2]);
+      return 1;
+    }
+  return 0;
+}
+
+static int cli_animation(int argc, char ** argv)
+{
+  animation_t * animation;
+  GError * error = NULL;
+  int width, height, first = 0, dithered = 0, yuv = 0, palette = PALETTE_DEFAULT, i, ret;
+  gint64 start = g_get_monotonic_time();
+
+  if(argc < 6)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  width = atoi(argv[4]);
+  height = atoi(argv[5]);
+  for(i = 6; i < argc; i++)
+    if((ret = palette_argument(argc, argv, &i, &palette)) < 0)
+      return 1;
+    else if(ret > 0)
+      continue;
+    else if(strcmp(argv[i], "--dither") == 0)
+      dithered = 1;
+    else if(strcmp(argv[i], "--yuv") == 0)
+      yuv = 1;
+    else
+      first = atoi(argv[i]);
+  if(width < 1 || height < 1)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+
+  animation = animation_convert(argv[2], width, height, dithered, yuv, palette, &error, NULL);
+  if(animation == NULL)
+    {
+      fprintf(stderr, "Could not read %s%s%s\n", argv[2], error ? ": " : "", error ? error->message : "");
+      if(error != NULL)
+	g_error_free(error);
+      return 1;
+    }
+
+  printf("%i frames, %i of %i maps kept, converted in %.1f ms\n", animation->frame_count, animation->map_count,
+	 animation->frame_count * width * height, (g_get_monotonic_time() - start) / 1000.0);
+  if(animation_save(animation, argv[3], first) != 0)
+    {
+      fprintf(stderr, "Could not write to %s\n", argv[3]);
+      animation_free(animation);
+      return 1;
+    }
+  animation_free(animation);
+  return 0;
+}
+
+static int cli_run(int argc, char ** argv)
+{
+  if(strcmp(argv[1], "--watch-add") == 0)
+    return cli_watch_add(argc, argv);
+  else if(strcmp(argv[1], "--watch-update") == 0)
+    return cli_watch(argc, argv, 0);
+  else if(strcmp(argv[1], "--watch") == 0)
+    return cli_watch(argc, argv, 1);
+  else if(strcmp(argv[1], "--export-world") == 0)
+    return cli_export_world(argc, argv);
+  else if(strcmp(argv[1], "--overview") == 0)
+    return cli_overview(argc, argv);
+  else if(strcmp(argv[1], "--serve") == 0)
+    return cli_serve(argc, argv);
+  else if(strcmp(argv[1], "--animation") == 0)
+    return cli_animation(argc, argv);
+  else if(strcmp(argv[1], "--help") == 0)
+    {
+      usage(argv[0]);
+      return 0;
+    }
+
+  return -1;
+}
+
+static int write_stats(const char * path)
+{
+  FILE * file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+
+  if(file == NULL)
+    return -1;
+  stats_write_json(file);
+  if(file != stdout)
+    fclose(file);
+  return 0;
+}
+
+int cli_main(int argc, char ** argv)
+{
+  const char * stats_path = NULL, * trace_path = NULL;
+  int ret;
+
+  while(argc > 3)
+    if(strcmp(argv[argc - 2], "--stats") == 0)
+      {
+	stats_path = argv[argc - 1];
+	argc -= 2;
+      }
+    else if(strcmp(argv[argc - 2], "--trace") == 0)
+      {
+	trace_path = argv[argc - 1];
+	argc -= 2;
+      }
+    else
+      break;
+  if(argc < 2)
+    return -1;
+
+  stats_reset();
+  if(trace_path != NULL)
+    {
+      trace_enable();
+      trace_name_thread("main");
+    }
+  ret = cli_run(argc, argv);
+  trace_disable();
+
+  if(ret >= 0 && stats_path != NULL && write_stats(stats_path) != 0)
+    {
+      fprintf(stderr, "Could not write %s\n", stats_path);
+      return 1;
+    }
+  if(ret >= 0 && trace_path != NULL && trace_write_json(trace_path) != 0)
+    {
+      fprintf(stderr, "Could not write %s\n", trace_path);
+      return 1;
+    }
+  return ret;
+}
@@ -0,0 +1,8 @@
+#ifndef CLI_H
+#define CLI_H
+
+/* Runs a headless command if argv asks for one. Returns the exit status,
+   or -1 if the GUI should be started instead. */
+int cli_main(int argc, char ** argv);
+
+#endif
@@ -0,0 +1,228 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <glib.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "quantize.h"
+#include "imagetomap.h"
+#include "convert.h"
+#include "stats.h"
+
+static color_t get_pixel(const imagetomap_image_t * image, double x, double y, int * alpha)
+{
+  const unsigned char * p = image->pixels + ((int)y) * image->rowstride + ((int)x) * image->channels;
+  color_t color;
+
+  color.r = p[0];
+  color.g = p[1];
+  color.b = p[2];
+
+  if(alpha != NULL)
+    *alpha = (image->channels == 4) ? (p[3] == 0) : 0;
+
+  return color;
+}
+
+void convert_area(unsigned char * data, int w, int h, int ax, int ay, int aw, int ah,
+		  const imagetomap_image_t * image, quantize_lut_t * lut, progress_t * progress)
+{
+  double xi = image->width / (double)w, yi = image->height / (double)h;
+  double x, y;
+  int i, alpha;
+  gint64 start = stats_start();
+
+  for(i = 0; i < aw * ah; i++)
+    {
+      if(i % aw == 0 && progress_set(progress, i, aw * ah))
+	return;
+
+      x = (double)(ax + i % aw) * xi;
+      y = (double)(ay + i / aw) * yi;
+
+      color_t c = get_pixel(image, x, y, &alpha);
+
+      if(alpha)
+	data[i] = 0;
+      else
+	data[i] = quantize_closest(lut, c.r, c.g, c.b);
+    }
+  stats_add(STATS_QUANTIZE, start, (gint64)aw * ah * image->channels, (gint64)aw * ah);
+  progress_set(progress, 1, 1);
+}
+
+void convert_source_area(unsigned char * rgba, int w, int h, int ax, int ay, int aw, int ah,
+			 const imagetomap_image_t * image)
+{
+  double xi = image->width / (double)w, yi = image->height / (double)h;
+  int i, alpha;
+  gint64 start = stats_start();
+
+  for(i = 0; i < aw * ah; i++)
+    {
+      color_t c = get_pixel(image, (double)(ax + i % aw) * xi, (double)(ay + i / aw) * yi, &alpha);
+
+      rgba[i * 4] = c.r;
+      rgba[i * 4 + 1] = c.g;
+      rgba[i * 4 + 2] = c.b;
+      rgba[i * 4 + 3] = alpha ? 0 : 0xFF;
+    }
+  stats_add(STATS_RESAMPLE, start, (gint64)aw * ah * image->channels, (gint64)aw * ah);
+}
+
+static void add_without_overflow(unsigned char * i, int j)
+{
+  if(*i + j < 256 && *i + j >= 0)
+    *i += j;
+  else if(*i + j >= 256)
+    *i = 0xFF;
+  else if(*i + j < 0)
+    *i = 0;
+}
+
+/* Floyd-Steinberg over a w * h image that is changed in place, walked
+   column by column. */
+static void dither_image(unsigned char * data, color_t * image_scaled, int w, int h, quantize_lut_t * lut,
+			 const color_t * colors, progress_t * progress)
+{
+  int x, y, i;
+  gint64 start = stats_start();
+
+  for(x = 0; x < w; x++)
+    {
+      if(progress_set(progress, x, w))
+	break;
+    for(y = 0; y < h; y++)
+      {
+	i = x + y * w;
+	double re, ge, be;
+
+	color_t c = image_scaled[i];
+	data[i] = quantize_closest(lut, c.r, c.g, c.b);
+	color_t qc = colors[data[i]];
+	re = (c.r - qc.r) / 16.;
+	ge = (c.g - qc.g) / 16.;
+	be = (c.b - qc.b) / 16.;
+
+	if(x != w - 1)
+	  {
+	    add_without_overflow(&(image_scaled[i + 1].r), (int)(re * 7));
+	    add_without_overflow(&(image_scaled[i + 1].g), (int)(ge * 7));
+	    add_without_overflow(&(image_scaled[i + 1].b), (int)(be * 7));
+	  }
+
+	if(y != h - 1)
+	  {
+	    if(x != 0)
+	      {
+		add_without_overflow(&(image_scaled[i + w - 1].r), (int)(re * 3));
+		add_without_overflow(&(image_scaled[i + w - 1].g), (int)(ge * 3));
+		add_without_overflow(&(image_scaled[i + w - 1].b), (int)(be * 3));
+	      }
+
+	    add_without_overflow(&(image_scaled[i + w].r), (int)(re * 5));
+	    add_without_overflow(&(image_scaled[i + w].g), (int)(ge * 5));
+	    add_without_overflow(&(image_scaled[i + w].b), (int)(be * 5));
+
+	    if(x != w - 1)
+	      {
+		add_without_overflow(&(image_scaled[i + w].r), (int)(re * 1));
+		add_without_overflow(&(image_scaled[i + w].g), (int)(ge * 1));
+		add_without_overflow(&(image_scaled[i + w].b), (int)(be * 1));
+	      }
+	  }
+      }
+    }
+  stats_add(STATS_DITHER, start, (gint64)x * h * sizeof(color_t), (gint64)x * h);
+  progress_set(progress, w, w);
+}
+
+void convert_dithered(unsigned char * data, int w, int h, const imagetomap_image_t * image,
+		      quantize_lut_t * lut, const color_t * colors, progress_t * progress)
+{
+  double xi = image->width / (double)w, yi = image->height / (double)h;
+  color_t * image_scaled = malloc((size_t)w * h * sizeof(color_t));
+  gint64 start = stats_start();
+  int i;
+
+  for(i = 0; i < w * h; i++)
+    image_scaled[i] = get_pixel(image, (double)(i % w) * xi, (double)(i / w) * yi, NULL);
+  stats_add(STATS_RESAMPLE, start, (gint64)w * h * image->channels, (gint64)w * h);
+
+  dither_image(data, image_scaled, w, h, lut, colors, progress);
+  free(image_scaled);
+}
+
+void convert_from_source(unsigned char * data, const unsigned char * rgba, int dithered,
+			 quantize_lut_t * lut, const color_t * colors)
+{
+  int i;
+
+  if(dithered)
+    {
+      color_t * image_scaled = malloc(128 * 128 * sizeof(color_t));
+
+      for(i = 0; i < 128 * 128; i++)
+	{
+	  image_scaled[i].r = rgba[i * 4];
+	  image_scaled[i].g = rgba[i * 4 + 1];
+	  image_scaled[i].b = rgba[i * 4 + 2];
+	}
+      dither_image(data, image_scaled, 128, 128, lut, colors, NULL);
+      free(image_scaled);
+    }
+  else
+    {
+      gint64 start = stats_start();
+
+      for(i = 0; i < 128 * 128; i++)
+	data[i] = rgba[i * 4 + 3] ? quantize_closest(lut, rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2]) : 0;
+      stats_add(STATS_QUANTIZE, start, 128 * 128 * 4, 128 * 128);
+    }
+}
+
+/* 8 * 8 Bayer thresholds, 0-63 */
+static const unsigned char bayer[64] =
+  {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+  };
+
+void convert_from_source_ordered(unsigned char * data, const unsigned char * rgba, quantize_lut_t * lut)
+{
+  gint64 start = stats_start();
+  int i;
+
+  for(i = 0; i < 128 * 128; i++)
+    {
+      /* about +-16 levels, roughly the gap between palette shades */
+      int t = ((int)bayer[((i / 128) & 7) * 8 + (i & 7)] * 2 - 63) / 4;
+
+      if(rgba[i * 4 + 3] == 0)
+	data[i] = 0;
+      else
+	data[i] = quantize_closest(lut, CLAMP(rgba[i * 4] + t, 0, 255), CLAMP(rgba[i * 4 + 1] + t, 0, 255),
+				   CLAMP(rgba[i * 4 + 2] + t, 0, 255));
+    }
+  stats_add(STATS_DITHER, start, 128 * 128 * 4, 128 * 128);
+}
@@ -0,0 +1,25 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+/* The conversions of generate.c on an imagetomap_image_t, so they don't
+   need GTK. The image is scaled to w * h by taking the nearest pixel, and
+   only the aw * ah part at ax, ay of that is converted. */
+
+void convert_area(unsigned char * data, int w, int h, int ax, int ay, int aw, int ah,
+		  const imagetomap_image_t * image, quantize_lut_t * lut, progress_t * progress);
+/* The pixels convert_area would convert, as RGBA with an alpha of 0 where
+   they are transparent. */
+void convert_source_area(unsigned char * rgba, int w, int h, int ax, int ay, int aw, int ah,
+			 const imagetomap_image_t * image);
+/* Floyd-Steinberg over the whole scaled image, alpha is ignored. colors are
+   the ones lut was made of. */
+void convert_dithered(unsigned char * data, int w, int h, const imagetomap_image_t * image,
+		      quantize_lut_t * lut, const color_t * colors, progress_t * progress);
+
+/* Converts a 128 * 128 source from convert_source_area again. */
+void convert_from_source(unsigned char * data, const unsigned char * rgba, int dithered,
+			 quantize_lut_t * lut, const color_t * colors);
+/* Ordered dithering of a source, see generate_from_source_ordered. */
+void convert_from_source_ordered(unsigned char * data, const unsigned char * rgba, quantize_lut_t * lut);
+
+#endif
@@ -0,0 +1,508 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "glib_compat.h"
+#include "data_structures.h"
+#include "progress.h"
+#include "nbtsave.h"
+#include "imagetomap.h"
+#include "convert_server.h"
+
+#ifndef OS_WINDOWS
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* the most requests of one connection waiting for their answer */
+#define MAX_QUEUED 64
+#define MAX_IMAGE_SIZE (256 * 1024 * 1024)
+#define MAX_GRID 64
+/* the bytes of images and maps of all connections held at once, and the
+   connections served at once; further ones wait in the listen backlog */
+#define MAX_IN_FLIGHT (1024L * 1024 * 1024)
+#define MAX_CONNECTIONS 64
+
+typedef struct server_request
+{
+  int width, height, dithered, yuv;
+  map_data_t info;
+  int first;
+  char * dir;
+  unsigned char * image;
+  size_t size;
+  long reserved; /* of MAX_IN_FLIGHT */
+
+  /* set by the worker, the maps as map_N.dat files or paths */
+  const char * error;
+  char ** blobs;
+  size_t * blob_sizes;
+  int done;
+
+  struct connection * connection;
+  struct server_request * next;
+} server_request_t;
+
+typedef struct connection
+{
+  FILE * in, * out;
+  GMutex lock;
+  GCond cond;
+  /* the requests that haven't been answered, oldest first */
+  server_request_t * head, * tail;
+  int queued;
+  int closed;
+} connection_t;
+
+static GThreadPool * pool;
+static GMutex limit_lock;
+static GCond limit_cond;
+static long in_flight;
+static int connections;
+/* one context per dithered, yuv combination, requests run on the pool
+   so they convert on their own thread */
+static imagetomap_t * contexts[4];
+
+/* Waits until bytes more fit within MAX_IN_FLIGHT. A single request
+   always fits once nothing else is held. */
+static void reserve(long bytes)
+{
+  g_mutex_lock(&limit_lock);
+  while(in_flight > 0 && in_flight + bytes > MAX_IN_FLIGHT)
+    g_cond_wait(&limit_cond, &limit_lock);
+  in_flight += bytes;
+  g_mutex_unlock(&limit_lock);
+}
+
+static void release(long bytes)
+{
+  g_mutex_lock(&limit_lock);
+  in_flight -= bytes;
+  g_cond_broadcast(&limit_cond);
+  g_mutex_unlock(&limit_lock);
+}
+
+static void request_free(server_request_t * request)
+{
+  int i;
+
+  if(request->reserved > 0)
+    release(request->reserved);
+
+  if(request->blobs != NULL)
+    for(i = 0; i < request->width * request->height; i++)
+      free(request->blobs[i]);
+  free(request->blobs);
+  free(request->blob_sizes);
+  free(request->image);
+  free(request->dir);
+  free(request);
+}
+
+static GdkPixbuf * decode_image(unsigned char * image, size_t size)
+{
+  GdkPixbufLoader * loader = gdk_pixbuf_loader_new();
+  GdkPixbuf * pixbuf = NULL;
+
+  if(gdk_pixbuf_loader_write(loader, image, size, NULL) && gdk_pixbuf_loader_close(loader, NULL))
+    {
+      pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+      if(pixbuf != NULL)
+	g_object_ref(pixbuf);
+    }
+  else
+    gdk_pixbuf_loader_close(loader, NULL);
+  g_object_unref(loader);
+  return pixbuf;
+}
+
+/* Converts the maps like Open Grid Image does, into data column by column. */
+static void convert_maps(server_request_t * request, GdkPixbuf * pixbuf, unsigned char * data)
+{
+  imagetomap_image_t image;
+
+  image.pixels = gdk_pixbuf_get_pixels(pixbuf);
+  image.width = gdk_pixbuf_get_width(pixbuf);
+  image.height = gdk_pixbuf_get_height(pixbuf);
+  image.rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  image.channels = gdk_pixbuf_get_n_channels(pixbuf);
+  imagetomap_convert_maps(contexts[request->dithered * 2 + request->yuv], &image, request->width, request->height,
+			  data, NULL);
+}
+
+static int write_map(server_request_t * request, int k, unsigned char * data)
+{
+  map_data_t * info = &(request->info);
+  char * blob = NULL;
+  size_t size = 0;
+  FILE * dest;
+  int ret;
+
+  if(request->dir != NULL)
+    {
+      blob = malloc(strlen(request->dir) + 32);
+      sprintf(blob, "%s/map_%i.dat", request->dir, request->first + k);
+      size = strlen(blob);
+      dest = fopen(blob, "wb");
+    }
+  else
+    dest = open_memstream(&blob, &size);
+  if(dest == NULL)
+    {
+      free(blob);
+      return -1;
+    }
+
+  ret = nbt_write_map(dest, info->dimension, info->scale, 128, 128, info->xpos, info->zpos, data);
+  if(fclose(dest) != 0)
+    ret = -1;
+
+  /* the map_N.dat, or the path it was saved to */
+  request->blobs[k] = blob;
+  request->blob_sizes[k] = size;
+  return ret;
+}
+
+static void request_run(gpointer data, gpointer user_data)
+{
+  server_request_t * request = (server_request_t *)data;
+  connection_t * connection = request->connection;
+  int count = request->width * request->height;
+  GdkPixbuf * pixbuf = decode_image(request->image, request->size);
+  int k;
+
+  free(request->image);
+  request->image = NULL;
+
+  if(pixbuf == NULL)
+    request->error = "could not decode the image";
+  else
+    {
+      unsigned char * maps = malloc(count * 128 * 128);
+
+      convert_maps(request, pixbuf, maps);
+      g_object_unref(pixbuf);
+
+      request->blobs = calloc(count, sizeof(char *));
+      request->blob_sizes = calloc(count, sizeof(size_t));
+      for(k = 0; k < count && request->error == NULL; k++)
+	if(write_map(request, k, &(maps[k * 128 * 128])) != 0)
+	  request->error = "could not write a map";
+      free(maps);
+    }
+
+  g_mutex_lock(&(connection->lock));
+  request->done = 1;
+  g_cond_broadcast(&(connection->cond));
+  g_mutex_unlock(&(connection->lock));
+}
+
+/* Fills request from the options of a request line, NULL if it's fine. */
+static const char * parse_request(char * line, server_request_t * request)
+{
+  char * token, * rest = line, * save;
+  long size = -1;
+
+  if(strncmp(line, "convert", 7) != 0 || (line[7] != ' ' && line[7] != 0))
+    return "unknown request";
+  rest += 7;
+
+  request->width = request->height = 1;
+  request->info.xpos = 13371337;
+  request->info.zpos = -13371337;
+  request->info.scale = 3;
+
+  while((token = strtok_r(rest, " ", &save)) != NULL)
+    {
+      rest = NULL;
+      if(strncmp(token, "dir=", 4) == 0)
+	{
+	  /* the directory may have spaces, it takes the rest of the line */
+	  char * end = strtok_r(NULL, "", &save);
+	  if(end != NULL)
+	    end[-1] = ' ';
+	  request->dir = malloc(strlen(token + 4) + 1);
+	  strcpy(request->dir, token + 4);
+	  break;
+	}
+      else if(strncmp(token, "size=", 5) == 0)
+	size = atol(token + 5);
+      else if(strncmp(token, "width=", 6) == 0)
+	request->width = atoi(token + 6);
+      else if(strncmp(token, "height=", 7) == 0)
+	request->height = atoi(token + 7);
+      else if(strncmp(token, "dither=", 7) == 0)
+	request->dithered = atoi(token + 7) != 0;
+      else if(strncmp(token, "yuv=", 4) == 0)
+	request->yuv = atoi(token + 4) != 0;
+      else if(strncmp(token, "x=", 2) == 0)
+	request->info.xpos = atoi(token + 2);
+      else if(strncmp(token, "z=", 2) == 0)
+	request->info.zpos = atoi(token + 2);
+      else if(strncmp(token, "scale=", 6) == 0)
+	request->info.scale = atoi(token + 6);
+      else if(strncmp(token, "dimension=", 10) == 0)
+	request->info.dimension = atoi(token + 10);
+      else if(strncmp(token, "first=", 6) == 0)
+	request->first = atoi(token + 6);
+      else
+	return "unknown option";
+    }
+
+  if(size < 0 || size > MAX_IMAGE_SIZE)
+    return "missing or too large size";
+  if(request->width < 1 || request->width > MAX_GRID || request->height < 1 || request->height > MAX_GRID)
+    return "bad width or height";
+  request->size = size;
+  return NULL;
+}
+
+static void answer(connection_t * connection, server_request_t * request)
+{
+  int i, count = request->width * request->height;
+
+  if(request->error != NULL)
+    {
+      fprintf(connection->out, "error %s\n", request->error);
+      return;
+    }
+
+  fprintf(connection->out, "ok %i\n", count);
+  for(i = 0; i < count; i++)
+    if(request->dir != NULL)
+      fprintf(connection->out, "%s\n", request->blobs[i]);
+    else
+      {
+	fprintf(connection->out, "%lu\n", (unsigned long)request->blob_sizes[i]);
+	fwrite(request->blobs[i], 1, request->blob_sizes[i], connection->out);
+      }
+}
+
+/* Answers the requests of a connection in order, while more are read. */
+static gpointer connection_write(gpointer data)
+{
+  connection_t * connection = (connection_t *)data;
+  server_request_t * request;
+
+  for(;;)
+    {
+      g_mutex_lock(&(connection->lock));
+      while(connection->head == NULL && !connection->closed)
+	g_cond_wait(&(connection->cond), &(connection->lock));
+      request = connection->head;
+      if(request == NULL)
+	{
+	  g_mutex_unlock(&(connection->lock));
+	  break;
+	}
+      while(!request->done)
+	g_cond_wait(&(connection->cond), &(connection->lock));
+      connection->head = request->next;
+      if(connection->head == NULL)
+	connection->tail = NULL;
+      connection->queued--;
+      g_cond_broadcast(&(connection->cond));
+      g_mutex_unlock(&(connection->lock));
+
+      answer(connection, request);
+      request_free(request);
+
+      /* flushed once nothing else is ready, so batches go out together */
+      g_mutex_lock(&(connection->lock));
+      request = connection->head;
+      if(request == NULL || !request->done)
+	request = NULL;
+      g_mutex_unlock(&(connection->lock));
+      if(request == NULL)
+	fflush(connection->out);
+    }
+  fflush(connection->out);
+  return NULL;
+}
+
+static void queue_request(connection_t * connection, server_request_t * request)
+{
+  g_mutex_lock(&(connection->lock));
+  while(connection->queued >= MAX_QUEUED)
+    g_cond_wait(&(connection->cond), &(connection->lock));
+  if(connection->tail != NULL)
+    connection->tail->next = request;
+  else
+    connection->head = request;
+  connection->tail = request;
+  connection->queued++;
+  g_cond_broadcast(&(connection->cond));
+  g_mutex_unlock(&(connection->lock));
+}
+
+static gpointer connection_read(gpointer data)
+{
+  connection_t * connection = (connection_t *)data;
+  GThread * writer = g_thread_new("connection writer", connection_write, connection);
+  char * line = NULL;
+  size_t line_size = 0;
+  ssize_t length;
+
+  while((length = getline(&line, &line_size, connection->in)) > 0)
+    {
+      server_request_t * request = calloc(1, sizeof(server_request_t));
+
+      request->connection = connection;
+      if(line[length - 1] == '\n')
+	line[--length] = 0;
+      if(length == 0)
+	{
+	  free(request);
+	  continue;
+	}
+
+      request->error = parse_request(line, request);
+      if(request->error == NULL)
+	{
+	  /* the image, and the maps made from it until they are answered */
+	  request->reserved = (long)request->size + (long)request->width * request->height * 128 * 128 * 2;
+	  reserve(request->reserved);
+	  request->image = malloc(request->size ? request->size : 1);
+	  if(fread(request->image, 1, request->size, connection->in) != request->size)
+	    {
+	      request_free(request);
+	      break;
+	    }
+	  queue_request(connection, request);
+	  g_thread_pool_push(pool, request, NULL);
+	}
+      else
+	{
+	  /* the image can't be skipped without its size */
+	  request->done = 1;
+	  queue_request(connection, request);
+	  break;
+	}
+    }
+  free(line);
+
+  g_mutex_lock(&(connection->lock));
+  connection->closed = 1;
+  g_cond_broadcast(&(connection->cond));
+  g_mutex_unlock(&(connection->lock));
+  g_thread_join(writer);
+
+  fclose(connection->in);
+  fclose(connection->out);
+  g_mutex_clear(&(connection->lock));
+  g_cond_clear(&(connection->cond));
+  free(connection);
+
+  g_mutex_lock(&limit_lock);
+  connections--;
+  g_cond_broadcast(&limit_cond);
+  g_mutex_unlock(&limit_lock);
+  return NULL;
+}
+
+int convert_server_run(const char * path, int jobs, const char * palette)
+{
+  struct sockaddr_un address;
+  struct stat info;
+  int fd, client, i;
+
+  if(strlen(path) >= sizeof(address.sun_path))
+    return -1;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+  /* a socket left by an earlier run, but never any other file */
+  if(lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+    unlink(path);
+  if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 16) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+  /* a client going away mid answer is only an error on that connection */
+  signal(SIGPIPE, SIG_IGN);
+
+  /* setting the palette builds the tables before the first request
+     needs them */
+  for(i = 0; i < 4; i++)
+    {
+      contexts[i] = imagetomap_new(1);
+      imagetomap_set_options(contexts[i], i / 2, i % 2);
+      if(imagetomap_set_shipped_palette(contexts[i], palette) != 0)
+	{
+	  close(fd);
+	  return -1;
+	}
+    }
+  pool = g_thread_pool_new(request_run, NULL, jobs, FALSE, NULL);
+  g_mutex_init(&limit_lock);
+  g_cond_init(&limit_cond);
+
+  for(;;)
+    {
+      connection_t * connection;
+      int out;
+
+      g_mutex_lock(&limit_lock);
+      while(connections >= MAX_CONNECTIONS)
+	g_cond_wait(&limit_cond, &limit_lock);
+      connections++;
+      g_mutex_unlock(&limit_lock);
+
+      while((client = accept(fd, NULL, NULL)) < 0 && errno == EINTR);
+      if(client < 0 || (out = dup(client)) < 0)
+	{
+	  g_mutex_lock(&limit_lock);
+	  connections--;
+	  g_mutex_unlock(&limit_lock);
+	  if(client < 0)
+	    break;
+	  close(client);
+	  continue;
+	}
+      connection = calloc(1, sizeof(connection_t));
+      connection->in = fdopen(client, "rb");
+      connection->out = fdopen(out, "wb");
+      g_mutex_init(&(connection->lock));
+      g_cond_init(&(connection->cond));
+      g_thread_unref(g_thread_new("connection", connection_read, connection));
+    }
+
+  close(fd);
+  return -1;
+}
+
+#else
+
+int convert_server_run(const char * path, int jobs, const char * palette)
+{
+  fprintf(stderr, "The conversion server needs UNIX domain sockets\n");
+  return -1;
+}
+
+#endif
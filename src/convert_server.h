@@ -0,0 +1,36 @@
+#ifndef CONVERT_SERVER_H
+#define CONVERT_SERVER_H
+
+/* A long running converter listening on a UNIX domain socket, so a front
+   end doesn't have to start a process and rebuild the palette tables for
+   every image.
+
+   A client sends any number of requests on one connection, each a line of
+   space separated options followed by the image file bytes:
+
+     convert size=<bytes> [width=1] [height=1] [dither=0] [yuv=0]
+	     [x=13371337] [z=-13371337] [scale=3] [dimension=0]
+	     [first=0] [dir=<directory>]\n
+     <size bytes of a png, jpeg, bmp, gif...>
+
+   The image is split into a width * height grid of maps, numbered column
+   by column from first. Requests are converted at the same time, up to
+   the server's job limit, and answered in the order they were sent:
+
+     ok <count>\n
+     followed by, for every map, <length>\n and the bytes of its
+     map_<n>.dat, or with dir=, which takes the rest of the line, one line
+     with the path it was saved to
+
+   or error <message>\n. */
+
+/* Serves at path until the process is killed, converting with the
+   shipped palette called palette. A socket left at path is replaced, any
+   other file is not. Up to 64 connections are served at once, and
+   requests wait for memory once their images and maps take 1 GB, so a
+   client sending many requests has to read the answers meanwhile.
+   Returns non-zero if the socket can't be set up or there is no such
+   palette. */
+int convert_server_run(const char * path, int jobs, const char * palette);
+
+#endif
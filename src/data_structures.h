@@ -1,9 +1,6 @@
 #ifndef COLOR_H
 #define COLOR_H
 
-#define NUM_COLORS 144
-#define OLD_NUM_COLORS 56
-
 typedef struct color
 {
   unsigned char r, g, b;
@@ -14,16 +11,7 @@ typedef struct map_data
   int xpos, zpos;
   int scale;
   int dimension;
+  int palette; /* in palette_tables.h */
 } map_data_t;
 
-typedef struct configvars
-{
-  GdkInterpType interp;
-  double zooms;
-  double stdzoom;	
-
-  int maxzoom;
-  int minzoom;
-} configvars_t;
-
 #endif
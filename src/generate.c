@@ -18,30 +18,34 @@
 #include <errno.h>
 
 #include "data_structures.h"
+#include "progress.h"
+#include "quantize.h"
+#include "palette_tables.h"
+#include "imagetomap.h"
+#include "convert.h"
+#include "stats.h"
 #include "generate.h"
 
-extern int old_colors;
-
-void generate_palette(unsigned char * data)
+void generate_palette(unsigned char * data, int count)
 {
   int i;
   for(i = 0; i < 128 * 128; i++)
     {
-      data[i] = (i % (((old_colors) ? OLD_NUM_COLORS : NUM_COLORS) - 4)) + 4;
+      data[i] = (i % (count - 4)) + 4;
     }
 }
 
-void generate_random_noise(unsigned char * data)
+void generate_random_noise(unsigned char * data, int count)
 {
   srand(time(NULL));
   int i;
   for(i = 0; i < 128 * 128; i++)
     {
-      data[i] = (rand() % (((old_colors) ? OLD_NUM_COLORS : NUM_COLORS) - 4)) + 4;
+      data[i] = (rand() % (count - 4)) + 4;
     }
 }
 
-void generate_mandelbrot(unsigned char * data)
+void generate_mandelbrot(unsigned char * data, int count)
 {
   int i;
   for(i = 0; i < 128 * 128; i++)
@@ -86,13 +90,13 @@ void generate_mandelbrot(unsigned char * data)
 	    }
 	  else
 	    {
-	      data[x + y * 128] = (unsigned char)((n % (((old_colors) ? OLD_NUM_COLORS : NUM_COLORS) - 4)) + 4);
+	      data[x + y * 128] = (unsigned char)((n % (count - 4)) + 4);
 	    }
 	}
     }
 }
 
-void generate_julia(unsigned char * data, double c_im, double c_re)
+void generate_julia(unsigned char * data, int count, double c_im, double c_re)
 {
   for (int i = 0; i < 128 * 128; i++)
     data[i] = 0;
@@ -133,34 +137,20 @@ void generate_julia(unsigned char * data, double c_im, double c_re)
 	    }
 	  else
 	    {
-	      data[x + y * 128] = (unsigned char)((n % (((old_colors) ? OLD_NUM_COLORS : NUM_COLORS) - 4)) + 4);
+	      data[x + y * 128] = (unsigned char)((n % (count - 4)) + 4);
 	    }
 	}
     }
 }
 
-color_t get_pixel_pixbuf(double x, double y, GdkPixbuf * pixbuf, unsigned char * pixels, int * alpha)
+/* The pixels of pixbuf, for the functions of convert.c */
+static void pixbuf_image(GdkPixbuf * pixbuf, imagetomap_image_t * image)
 {
-  color_t color;
-  guchar * p;
-  int n_channels;
-  p = pixels + ((int)y) * gdk_pixbuf_get_rowstride(pixbuf) + ((int)x) * gdk_pixbuf_get_n_channels(pixbuf);
-
-  color.r = p[0];
-  color.g = p[1];
-  color.b = p[2];
-
-  n_channels = gdk_pixbuf_get_n_channels(pixbuf);
-
-  if(alpha != NULL)
-    {
-      if(n_channels == 4)
-	*alpha = (p[3] == 0);
-      else
-	*alpha = 0;
-    }
-
-  return color;
+  image->pixels = gdk_pixbuf_get_pixels(pixbuf);
+  image->width = gdk_pixbuf_get_width(pixbuf);
+  image->height = gdk_pixbuf_get_height(pixbuf);
+  image->rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  image->channels = gdk_pixbuf_get_n_channels(pixbuf);
 }
 
 /* Transformation Matrix: */
@@ -189,14 +179,14 @@ double YUV_to_dist(float y1, float u1, float v1, float y2, float u2, float v2)
   return sqrt(yd * yd + ud * ud + vd * vd);
 }
 
-int closest_color_YUV(int r, int g, int b, color_t * colors)
+int closest_color_YUV(int r, int g, int b, const color_t * colors, int count)
 {
   int i, closest_id = 0;
   double closest_dist = 0xFFFFFFFF, ndist;
   float y, u, v;
   RGB_to_YUV(r, g, b, &y, &u, &v);
 
-  for(i = 4; i < ((old_colors) ? OLD_NUM_COLORS : NUM_COLORS); i++)
+  for(i = 4; i < count; i++)
     {
       double testr = colors[i].r, testg = colors[i].g, testb = colors[i].b;
       float testy, testu, testv;
@@ -214,11 +204,11 @@ int closest_color_YUV(int r, int g, int b, color_t * colors)
   return closest_id;
 }
 
-int closest_color_RGB(int r, int g, int b, color_t * colors)
+int closest_color_RGB(int r, int g, int b, const color_t * colors, int count)
 {
   int i, closest_id = 0;
   double closest_dist = 0xFFFFFFFF, ndist;
-  for(i = 4; i < ((old_colors) ? OLD_NUM_COLORS : NUM_COLORS); i++)
+  for(i = 4; i < count; i++)
     {
       double testr = colors[i].r, testg = colors[i].g, testb = colors[i].b;
       ndist = sqrt(pow(testr - r, 2)
@@ -235,141 +225,84 @@ int closest_color_RGB(int r, int g, int b, color_t * colors)
   return closest_id;
 }
 
-int closest_color(int r, int g, int b, color_t * colors, int yuv)
+int closest_color(int r, int g, int b, const color_t * colors, int count, int yuv)
 {
   if(yuv == 0)
-    return closest_color_RGB(r, g, b, colors);
+    return closest_color_RGB(r, g, b, colors, count);
   else
-    return closest_color_YUV(r, g, b, colors);
+    return closest_color_YUV(r, g, b, colors, count);
 }
 
-color_t * scale_image(GdkPixbuf * image, int bw, int bh)
+void generate_image_pixbuf_area(unsigned char * data, int bw, int bh, int ax, int ay, int aw, int ah,
+				 int yuv, GdkPixbuf * image, int palette, progress_t * progress)
 {
-  double x, y;
-  int i;
-  double h = gdk_pixbuf_get_height(image), w = gdk_pixbuf_get_width(image);
-  double xi = w / (double)bw, yi = h / (double)bh;
-  color_t * scaled_image = malloc(bw * bh * sizeof(color_t));
-  unsigned char * image_pixels = gdk_pixbuf_get_pixels(image);
-
-  for(i = 0; i < bw * bh; i++)
-    {
-      x = (double)(i % bw) * xi;
-      y = (double)(i / bw) * yi;
+  imagetomap_image_t pixels;
 
-      color_t c = get_pixel_pixbuf(x, y, image, image_pixels, NULL);
+  pixbuf_image(image, &pixels);
+  convert_area(data, bw, bh, ax, ay, aw, ah, &pixels, palette_lut(palette, yuv), progress);
+}
 
-      scaled_image[i] = c;
-    }
+void generate_source_area(unsigned char * rgba, int bw, int bh, int ax, int ay, int aw, int ah, GdkPixbuf * image)
+{
+  imagetomap_image_t pixels;
 
-  return scaled_image;
+  pixbuf_image(image, &pixels);
+  convert_source_area(rgba, bw, bh, ax, ay, aw, ah, &pixels);
 }
 
-void generate_image_pixbuf(unsigned char * data, int bw, int bh, int yuv, GdkPixbuf * image, color_t * colors)
+void generate_image_pixbuf(unsigned char * data, int bw, int bh, int yuv, GdkPixbuf * image, int palette, progress_t * progress)
 {
-  double h = gdk_pixbuf_get_height(image), w = gdk_pixbuf_get_width(image);
-  double xi = w / (double)bw, yi = h / (double)bh;
+  generate_image_pixbuf_area(data, bw, bh, 0, 0, bw, bh, yuv, image, palette, progress);
+}
 
-  unsigned char * image_pixels = gdk_pixbuf_get_pixels(image);
-  double x, y;
+GdkPixbuf * generate_load_pixbuf(const char * filename, GError ** error)
+{
+  gint64 start = stats_start();
+  GdkPixbuf * image = gdk_pixbuf_new_from_file(filename, error);
 
-  int i = 0, alpha;
-  for(i = 0; i < bw * bh; i++)
-    {
-      x = (double)(i % bw) * xi;
-      y = (double)(i / bw) * yi;
-
-      color_t c = get_pixel_pixbuf(x, y, image, image_pixels, &alpha);
-      
-      if(alpha)
-	data[i] = 0;
-      else
-	data[i] = closest_color(c.r, c.g, c.b, colors, yuv);
-    }
+  if(image != NULL)
+    stats_add(STATS_DECODE, start, (gint64)gdk_pixbuf_get_rowstride(image) * gdk_pixbuf_get_height(image), 1);
+  return image;
 }
 
-void generate_image(unsigned char * data, int w, int h, int yuv, const char * filename, color_t * colors, GError ** error)
+void generate_image(unsigned char * data, int w, int h, int yuv, const char * filename, int palette, GError ** error, progress_t * progress)
 {
-  GdkPixbuf * image = gdk_pixbuf_new_from_file(filename, error);
+  GdkPixbuf * image = generate_load_pixbuf(filename, error);
 
   if(*error != NULL)
     return;
 
-  generate_image_pixbuf(data, w, h, yuv, image, colors);
+  generate_image_pixbuf(data, w, h, yuv, image, palette, progress);
 
   g_object_unref(image);
 }
 
-void add_without_overflow(unsigned char * i, int j)
+void generate_image_dithered_pixbuf(unsigned char * data, int w, int h, int yuv, GdkPixbuf * image, int palette, progress_t * progress)
 {
-  if(*i + j < 256 && *i + j >= 0)
-    *i += j;
-  else if(*i + j >= 256)
-    *i = 0xFF;
-  else if(*i + j < 0)
-    *i = 0;
+  imagetomap_image_t pixels;
+
+  pixbuf_image(image, &pixels);
+  convert_dithered(data, w, h, &pixels, palette_lut(palette, yuv), palettes[palette].colors, progress);
 }
 
-void generate_image_dithered_pixbuf(unsigned char * data, int w, int h, int yuv, GdkPixbuf * image, color_t * colors)
+void generate_from_source(unsigned char * data, const unsigned char * rgba, int dithered, int yuv, int palette)
 {
-  color_t * image_scaled = scale_image(image, w, h);
-
-  int x, y, i;
-
-  printf("dither!\n");
-  for(x = 0; x < w; x++)
-    for(y = 0; y < h; y++)
-      {
-	i = x + y * w;
-	double re, ge, be;
-
-	color_t c = image_scaled[i];
-	data[i] = closest_color(c.r, c.g, c.b, colors, yuv);
-	color_t qc = colors[data[i]];
-	re = (c.r - qc.r) / 16.;
-	ge = (c.g - qc.g) / 16.;
-	be = (c.b - qc.b) / 16.;
-	
-	if(x != w - 1)
-	  {
-	    add_without_overflow(&(image_scaled[i + 1].r), (int)(re * 7));
-	    add_without_overflow(&(image_scaled[i + 1].g), (int)(ge * 7));
-	    add_without_overflow(&(image_scaled[i + 1].b), (int)(be * 7));
-	  }
-
-	if(y != h - 1)
-	  {
-	    if(x != 0)
-	      {
-		add_without_overflow(&(image_scaled[i + w - 1].r), (int)(re * 3));
-		add_without_overflow(&(image_scaled[i + w - 1].g), (int)(ge * 3));
-		add_without_overflow(&(image_scaled[i + w - 1].b), (int)(be * 3));
-	      }
-
-	    add_without_overflow(&(image_scaled[i + w].r), (int)(re * 5));
-	    add_without_overflow(&(image_scaled[i + w].g), (int)(ge * 5));
-	    add_without_overflow(&(image_scaled[i + w].b), (int)(be * 5));
-
-	    if(x != w - 1)
-	      {
-		add_without_overflow(&(image_scaled[i + w].r), (int)(re * 1));
-		add_without_overflow(&(image_scaled[i + w].g), (int)(ge * 1));
-		add_without_overflow(&(image_scaled[i + w].b), (int)(be * 1));
-	      }
-	  }
-      }
-
-  free(image_scaled);
+  convert_from_source(data, rgba, dithered, palette_lut(palette, yuv), palettes[palette].colors);
 }
 
-void generate_image_dithered(unsigned char * data, int w, int h, int yuv, const char * filename, color_t * colors, GError ** error)
+void generate_from_source_ordered(unsigned char * data, const unsigned char * rgba, int yuv, int palette)
 {
-  GdkPixbuf * image = gdk_pixbuf_new_from_file(filename, error);
+  convert_from_source_ordered(data, rgba, palette_lut(palette, yuv));
+}
+
+void generate_image_dithered(unsigned char * data, int w, int h, int yuv, const char * filename, int palette, GError ** error, progress_t * progress)
+{
+  GdkPixbuf * image = generate_load_pixbuf(filename, error);
 
   if(*error != NULL)
     return;
 
-  generate_image_dithered_pixbuf(data, w, h, yuv, image, colors);
+  generate_image_dithered_pixbuf(data, w, h, yuv, image, palette, progress);
   g_object_unref(image);
 }
 
@@ -1,14 +1,40 @@
 #ifndef GENERATE_H
 #define GENERATE_H
 
-void generate_palette(unsigned char * data);
-void generate_random_noise(unsigned char * data);
-void generate_mandelbrot(unsigned char * data);
-void generate_julia(unsigned char * data, double x, double y);
-void generate_image(unsigned char * data, int w, int h, int yuv, const char * filename, color_t * colors, GError ** error);
-void generate_image_dithered(unsigned char * data, int w, int h, int yuv, const char * filename, color_t * colors, GError ** error);
-void generate_image_pixbuf(unsigned char * data, int w, int h, int yuv, GdkPixbuf * image, color_t * colors);
-void generate_image_dithered_pixbuf(unsigned char * data, int w, int h, int yuv, GdkPixbuf * image, color_t * colors);
+/* The patterns use the count colors of a palette. */
+void generate_palette(unsigned char * data, int count);
+void generate_random_noise(unsigned char * data, int count);
+void generate_mandelbrot(unsigned char * data, int count);
+void generate_julia(unsigned char * data, int count, double x, double y);
+/* The nearest of the first count colors by brute force. */
+int closest_color_RGB(int r, int g, int b, const color_t * colors, int count);
+int closest_color_YUV(int r, int g, int b, const color_t * colors, int count);
+int closest_color(int r, int g, int b, const color_t * colors, int count, int yuv);
+
+/* gdk_pixbuf_new_from_file, recorded as the decode stage. */
+GdkPixbuf * generate_load_pixbuf(const char * filename, GError ** error);
+
+/* The conversions take a palette of palette_tables.h and use its lookup
+   table. */
+void generate_image(unsigned char * data, int w, int h, int yuv, const char * filename, int palette, GError ** error, progress_t * progress);
+void generate_image_dithered(unsigned char * data, int w, int h, int yuv, const char * filename, int palette, GError ** error, progress_t * progress);
+void generate_image_pixbuf(unsigned char * data, int w, int h, int yuv, GdkPixbuf * image, int palette, progress_t * progress);
+/* Converts only the aw * ah part at ax, ay of the w * h image that
+   generate_image_pixbuf would produce, into an aw * ah data. */
+void generate_image_pixbuf_area(unsigned char * data, int w, int h, int ax, int ay, int aw, int ah,
+				 int yuv, GdkPixbuf * image, int palette, progress_t * progress);
+void generate_image_dithered_pixbuf(unsigned char * data, int w, int h, int yuv, GdkPixbuf * image, int palette, progress_t * progress);
+
+/* The pixels generate_image_pixbuf_area would convert, as RGBA with an
+   alpha of 0 where they are transparent. */
+void generate_source_area(unsigned char * rgba, int w, int h, int ax, int ay, int aw, int ah, GdkPixbuf * image);
+/* Converts a 128 * 128 source from generate_source_area again. A dithered
+   conversion ignores alpha, like generate_image_dithered_pixbuf. */
+void generate_from_source(unsigned char * data, const unsigned char * rgba, int dithered, int yuv, int palette);
+/* Dithers a source with a fixed 8 * 8 pattern instead of spreading the
+   error, so every pixel only depends on its own color and position and
+   the parts of animation frames that don't change come out the same. */
+void generate_from_source_ordered(unsigned char * data, const unsigned char * rgba, int yuv, int palette);
 
 void merge_buffers(unsigned char * data1, unsigned char * data2);
 
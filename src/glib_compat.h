@@ -0,0 +1,152 @@
+#ifndef GLIB_COMPAT_H
+#define GLIB_COMPAT_H
+
+/* The threading API of glib 2.32 and later on top of the older one, for
+   the GTK2 runtime the Windows build ships (glib 2.28). Include it after
+   glib.h or gtk/gtk.h; with a newer glib it does nothing but
+   glib_compat_init. */
+
+#if !GLIB_CHECK_VERSION(2, 30, 0)
+/* g_atomic_int_add returned nothing before 2.30 */
+#undef g_atomic_int_add
+#define g_atomic_int_add(atomic, val) g_atomic_int_exchange_and_add((atomic), (val))
+#endif
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+
+#ifdef G_OS_WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* GMutex and GCond were only pointers to allocated ones, so they couldn't
+   be static or part of a struct without an init call. */
+typedef struct glib_compat_mutex
+{
+  GStaticMutex mutex;
+} glib_compat_mutex_t;
+
+typedef struct glib_compat_cond
+{
+  struct _GCond * cond;
+} glib_compat_cond_t;
+
+typedef struct glib_compat_private
+{
+  GStaticPrivate key;
+  GDestroyNotify notify;
+} glib_compat_private_t;
+
+static inline void glib_compat_init(void)
+{
+  if(!g_thread_supported())
+    g_thread_init(NULL);
+}
+
+static inline void glib_compat_mutex_init(glib_compat_mutex_t * mutex)
+{
+  g_static_mutex_init(&(mutex->mutex));
+}
+
+static inline void glib_compat_mutex_clear(glib_compat_mutex_t * mutex)
+{
+  g_static_mutex_free(&(mutex->mutex));
+}
+
+static inline void glib_compat_mutex_lock(glib_compat_mutex_t * mutex)
+{
+  g_static_mutex_lock(&(mutex->mutex));
+}
+
+static inline void glib_compat_mutex_unlock(glib_compat_mutex_t * mutex)
+{
+  g_static_mutex_unlock(&(mutex->mutex));
+}
+
+static inline void glib_compat_cond_init(glib_compat_cond_t * cond)
+{
+  cond->cond = g_cond_new();
+}
+
+static inline void glib_compat_cond_clear(glib_compat_cond_t * cond)
+{
+  g_cond_free(cond->cond);
+}
+
+static inline void glib_compat_cond_wait(glib_compat_cond_t * cond, glib_compat_mutex_t * mutex)
+{
+  g_cond_wait(cond->cond, g_static_mutex_get_mutex(&(mutex->mutex)));
+}
+
+static inline void glib_compat_cond_signal(glib_compat_cond_t * cond)
+{
+  g_cond_signal(cond->cond);
+}
+
+static inline void glib_compat_cond_broadcast(glib_compat_cond_t * cond)
+{
+  g_cond_broadcast(cond->cond);
+}
+
+static inline gpointer glib_compat_private_get(glib_compat_private_t * key)
+{
+  return g_static_private_get(&(key->key));
+}
+
+static inline void glib_compat_private_set(glib_compat_private_t * key, gpointer value)
+{
+  g_static_private_set(&(key->key), value, key->notify);
+}
+
+/* Threads can't be detached, so every thread is joinable and the little
+   glib keeps of one that is never joined stays until the program exits. */
+static inline GThread * glib_compat_thread_new(const gchar * name, GThreadFunc func, gpointer data)
+{
+  return g_thread_create(func, data, TRUE, NULL);
+}
+
+static inline gint glib_compat_get_num_processors(void)
+{
+#ifdef G_OS_WIN32
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+  return MAX((gint)info.dwNumberOfProcessors, 1);
+#else
+  return MAX((gint)sysconf(_SC_NPROCESSORS_ONLN), 1);
+#endif
+}
+
+#define GMutex glib_compat_mutex_t
+#define GCond glib_compat_cond_t
+#define GPrivate glib_compat_private_t
+#define G_PRIVATE_INIT(notify) { G_STATIC_PRIVATE_INIT, (notify) }
+
+#undef g_mutex_lock
+#undef g_mutex_unlock
+#undef g_cond_wait
+#undef g_cond_signal
+#undef g_cond_broadcast
+#define g_mutex_init(mutex) glib_compat_mutex_init(mutex)
+#define g_mutex_clear(mutex) glib_compat_mutex_clear(mutex)
+#define g_mutex_lock(mutex) glib_compat_mutex_lock(mutex)
+#define g_mutex_unlock(mutex) glib_compat_mutex_unlock(mutex)
+#define g_cond_init(cond) glib_compat_cond_init(cond)
+#define g_cond_clear(cond) glib_compat_cond_clear(cond)
+#define g_cond_wait(cond, mutex) glib_compat_cond_wait((cond), (mutex))
+#define g_cond_signal(cond) glib_compat_cond_signal(cond)
+#define g_cond_broadcast(cond) glib_compat_cond_broadcast(cond)
+#define g_private_get(key) glib_compat_private_get(key)
+#define g_private_set(key, value) glib_compat_private_set((key), (value))
+#define g_thread_new(name, func, data) glib_compat_thread_new((name), (func), (data))
+#define g_thread_unref(thread) ((void)(thread))
+#define g_get_num_processors() glib_compat_get_num_processors()
+
+#else
+
+#define glib_compat_init() ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,497 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "buffer_store.h"
+#include "history.h"
+
+#define MAP_SIZE (128 * 128)
+
+enum
+  {
+    CHANGE_MODIFY,
+    CHANGE_ADD,
+    CHANGE_REMOVE
+  };
+
+typedef struct history_change
+{
+  buffer_handle_t handle;
+  int kind;
+  map_data_t before, after;
+  /* the old map XOR the new one, an added or removed map is XORed with
+     zeros. NULL if the map data didn't change. */
+  unsigned char * delta;
+  int delta_size;
+} history_change_t;
+
+typedef struct history_step
+{
+  history_change_t * changes;
+  int change_count, change_size;
+  /* the order of the handles before and after the step */
+  buffer_handle_t * before, * after;
+  int before_count, after_count;
+  size_t size;
+} history_step_t;
+
+/* What a handle looked like at the last commit. The map is kept deflated,
+   it's only read back when the buffer changes. */
+typedef struct shadow
+{
+  unsigned char * packed; /* NULL while the handle isn't in use */
+  unsigned long packed_size;
+  map_data_t info;
+  unsigned int version;
+} shadow_t;
+
+struct history
+{
+  buffer_store_t * store;
+  shadow_t * shadows; /* indexed by handle */
+  int shadow_count;
+  buffer_handle_t * order;
+  int order_count;
+
+  /* steps[0, position) can be undone, steps[position, step_count) redone */
+  history_step_t ** steps;
+  int step_count, step_size, position;
+  /* the steps are kept within budget, the packed shadows can't be
+     dropped and are only counted */
+  size_t size, shadow_size, budget;
+};
+
+/* Runs of zeros are skipped, everything else is stored as it is:
+   [zeros:16][literals:16][literals] repeated, little endian. A single
+   zero stays inside a literal run, it costs less than a new header. */
+static unsigned char * delta_encode(const unsigned char * xor, int * size)
+{
+  unsigned char * out = malloc(MAP_SIZE * 3 + 4);
+  int i = 0, n = 0;
+
+  while(i < MAP_SIZE)
+    {
+      int zeros = 0, literals = 0;
+
+      while(i + zeros < MAP_SIZE && xor[i + zeros] == 0)
+	zeros++;
+      i += zeros;
+      if(i == MAP_SIZE)
+	break;
+
+      while(i + literals < MAP_SIZE
+	    && (xor[i + literals] != 0 || (i + literals + 1 < MAP_SIZE && xor[i + literals + 1] != 0)))
+	literals++;
+
+      out[n++] = zeros & 0xFF;
+      out[n++] = zeros >> 8;
+      out[n++] = literals & 0xFF;
+      out[n++] = literals >> 8;
+      memcpy(&(out[n]), &(xor[i]), literals);
+      n += literals;
+      i += literals;
+    }
+
+  *size = n;
+  if(n == 0)
+    {
+      free(out);
+      return NULL;
+    }
+  return realloc(out, n);
+}
+
+static void delta_apply(unsigned char * map, const unsigned char * delta, int size)
+{
+  int i = 0, n = 0, k;
+
+  while(n < size)
+    {
+      int zeros = delta[n] | (delta[n + 1] << 8);
+      int literals = delta[n + 2] | (delta[n + 3] << 8);
+
+      n += 4;
+      i += zeros;
+      for(k = 0; k < literals; k++)
+	map[i + k] ^= delta[n + k];
+      i += literals;
+      n += literals;
+    }
+}
+
+static void step_free(history_step_t * step)
+{
+  int k;
+
+  for(k = 0; k < step->change_count; k++)
+    free(step->changes[k].delta);
+  free(step->changes);
+  free(step->before);
+  free(step->after);
+  free(step);
+}
+
+static history_change_t * step_add_change(history_step_t * step, buffer_handle_t handle, int kind)
+{
+  history_change_t * change;
+
+  if(step->change_count == step->change_size)
+    {
+      step->change_size = step->change_size ? step->change_size * 2 : 8;
+      step->changes = realloc(step->changes, step->change_size * sizeof(history_change_t));
+    }
+  change = &(step->changes[step->change_count++]);
+  memset(change, 0, sizeof(history_change_t));
+  change->handle = handle;
+  change->kind = kind;
+  return change;
+}
+
+static shadow_t * get_shadow(history_t * history, buffer_handle_t handle)
+{
+  if(handle >= history->shadow_count)
+    {
+      int size = history->shadow_count ? history->shadow_count : 64;
+      while(size <= handle)
+	size *= 2;
+      history->shadows = realloc(history->shadows, size * sizeof(shadow_t));
+      memset(&(history->shadows[history->shadow_count]), 0, (size - history->shadow_count) * sizeof(shadow_t));
+      history->shadow_count = size;
+    }
+  return &(history->shadows[handle]);
+}
+
+static void shadow_read(shadow_t * shadow, unsigned char * map)
+{
+  uLongf size = MAP_SIZE;
+
+  if(uncompress(map, &size, shadow->packed, shadow->packed_size) != Z_OK)
+    fprintf(stderr, "Could not unpack an undo copy\n");
+}
+
+static void shadow_drop(history_t * history, shadow_t * shadow)
+{
+  if(shadow->packed == NULL)
+    return;
+  history->shadow_size -= shadow->packed_size;
+  free(shadow->packed);
+  shadow->packed = NULL;
+}
+
+static void shadow_write(history_t * history, shadow_t * shadow, const unsigned char * map)
+{
+  uLongf size = compressBound(MAP_SIZE);
+
+  shadow_drop(history, shadow);
+  shadow->packed = malloc(size);
+  compress2(shadow->packed, &size, map, MAP_SIZE, 1);
+  shadow->packed = realloc(shadow->packed, size);
+  shadow->packed_size = size;
+  history->shadow_size += size;
+}
+
+static int find_position(buffer_store_t * store, buffer_handle_t handle)
+{
+  int i;
+  for(i = 0; i < buffer_store_count(store); i++)
+    if(buffer_store_handle(store, i) == handle)
+      return i;
+  return -1;
+}
+
+static buffer_handle_t * copy_order(buffer_store_t * store, int * count)
+{
+  buffer_handle_t * order;
+  int i;
+
+  *count = buffer_store_count(store);
+  order = malloc((*count ? *count : 1) * sizeof(buffer_handle_t));
+  for(i = 0; i < *count; i++)
+    order[i] = buffer_store_handle(store, i);
+  return order;
+}
+
+history_t * history_new(buffer_store_t * store, size_t budget)
+{
+  history_t * history = calloc(1, sizeof(history_t));
+
+  history->store = store;
+  history->budget = budget;
+  history->order = copy_order(store, &(history->order_count));
+  /* the first commit only fills the shadows, it isn't a step */
+  history_commit(history);
+  history_clear(history);
+  return history;
+}
+
+void history_clear(history_t * history)
+{
+  int i;
+
+  for(i = 0; i < history->step_count; i++)
+    step_free(history->steps[i]);
+  history->step_count = 0;
+  history->position = 0;
+  history->size = 0;
+}
+
+void history_free(history_t * history)
+{
+  int i;
+
+  if(history == NULL)
+    return;
+  history_clear(history);
+  for(i = 0; i < history->shadow_count; i++)
+    free(history->shadows[i].packed);
+  free(history->shadows);
+  free(history->steps);
+  free(history->order);
+  free(history);
+}
+
+static void drop_oldest(history_t * history)
+{
+  history->size -= history->steps[0]->size;
+  step_free(history->steps[0]);
+  memmove(&(history->steps[0]), &(history->steps[1]), (history->step_count - 1) * sizeof(history_step_t *));
+  history->step_count--;
+  history->position--;
+}
+
+static void push_step(history_t * history, history_step_t * step)
+{
+  while(history->step_count > history->position)
+    {
+      history_step_t * redo = history->steps[--history->step_count];
+      history->size -= redo->size;
+      step_free(redo);
+    }
+
+  if(history->step_count == history->step_size)
+    {
+      history->step_size = history->step_size ? history->step_size * 2 : 64;
+      history->steps = realloc(history->steps, history->step_size * sizeof(history_step_t *));
+    }
+  history->steps[history->step_count++] = step;
+  history->position++;
+  history->size += step->size;
+
+  while(history->size > history->budget && history->position > 0)
+    drop_oldest(history);
+}
+
+int history_commit(history_t * history)
+{
+  buffer_store_t * store = history->store;
+  int count = buffer_store_count(store);
+  history_step_t * step = calloc(1, sizeof(history_step_t));
+  unsigned char * seen, xor[MAP_SIZE], data[MAP_SIZE];
+  int i, k;
+
+  for(i = 0; i < count; i++)
+    get_shadow(history, buffer_store_handle(store, i));
+  seen = calloc(history->shadow_count, 1);
+
+  for(i = 0; i < count; i++)
+    {
+      buffer_handle_t handle = buffer_store_handle(store, i);
+      shadow_t * shadow = get_shadow(history, handle);
+      map_data_t * info = buffer_store_info(store, i);
+      unsigned int version = buffer_store_version(store, i);
+      int added = (shadow->packed == NULL);
+      unsigned char * delta = NULL;
+      int delta_size = 0;
+      history_change_t * change;
+
+      seen[handle] = 1;
+      if(!added && shadow->version == version && memcmp(&(shadow->info), info, sizeof(map_data_t)) == 0)
+	continue;
+
+      if(added || shadow->version != version)
+	{
+	  if(added)
+	    memset(xor, 0, MAP_SIZE);
+	  else
+	    shadow_read(shadow, xor);
+	  buffer_store_peek(store, i, data);
+	  for(k = 0; k < MAP_SIZE; k++)
+	    xor[k] ^= data[k];
+	  delta = delta_encode(xor, &delta_size);
+	  if(added || delta != NULL)
+	    shadow_write(history, shadow, data);
+	}
+      shadow->version = version;
+
+      /* touched, but the same as before */
+      if(!added && delta == NULL && memcmp(&(shadow->info), info, sizeof(map_data_t)) == 0)
+	continue;
+
+      change = step_add_change(step, handle, added ? CHANGE_ADD : CHANGE_MODIFY);
+      change->before = shadow->info;
+      change->after = *info;
+      change->delta = delta;
+      change->delta_size = delta_size;
+      shadow->info = *info;
+    }
+
+  for(k = 0; k < history->shadow_count; k++)
+    {
+      shadow_t * shadow = &(history->shadows[k]);
+      history_change_t * change;
+
+      if(shadow->packed == NULL || seen[k])
+	continue;
+
+      change = step_add_change(step, k, CHANGE_REMOVE);
+      change->before = shadow->info;
+      shadow_read(shadow, xor);
+      change->delta = delta_encode(xor, &(change->delta_size));
+      shadow_drop(history, shadow);
+    }
+  free(seen);
+
+  step->after = copy_order(store, &(step->after_count));
+  if(step->change_count == 0 && step->after_count == history->order_count
+     && memcmp(step->after, history->order, step->after_count * sizeof(buffer_handle_t)) == 0)
+    {
+      step_free(step);
+      return 0;
+    }
+
+  step->before = history->order;
+  step->before_count = history->order_count;
+  history->order = malloc((step->after_count ? step->after_count : 1) * sizeof(buffer_handle_t));
+  memcpy(history->order, step->after, step->after_count * sizeof(buffer_handle_t));
+  history->order_count = step->after_count;
+
+  step->size = sizeof(history_step_t) + step->change_count * sizeof(history_change_t)
+    + (step->before_count + step->after_count) * sizeof(buffer_handle_t);
+  for(k = 0; k < step->change_count; k++)
+    step->size += step->changes[k].delta_size;
+
+  push_step(history, step);
+  return 1;
+}
+
+/* Applies change forwards, or backwards when undo is set, to the store and
+   the shadows alike. */
+static void apply_change(history_t * history, history_change_t * change, int undo)
+{
+  buffer_store_t * store = history->store;
+  shadow_t * shadow = get_shadow(history, change->handle);
+  map_data_t * info = undo ? &(change->before) : &(change->after);
+  int position;
+
+  if((change->kind == CHANGE_ADD && undo) || (change->kind == CHANGE_REMOVE && !undo))
+    {
+      buffer_store_remove(store, find_position(store, change->handle));
+      shadow_drop(history, shadow);
+      return;
+    }
+
+  if(change->kind == CHANGE_MODIFY)
+    position = find_position(store, change->handle);
+  else
+    {
+      position = buffer_store_restore(store, change->handle, buffer_store_count(store));
+      if(position < 0)
+	return;
+      memset(buffer_store_data(store, position), 0, MAP_SIZE);
+    }
+  if(position < 0)
+    return;
+
+  if(change->delta != NULL)
+    delta_apply(buffer_store_data(store, position), change->delta, change->delta_size);
+  /* the shadow matched the buffer before, so it matches it after */
+  if(change->delta != NULL || shadow->packed == NULL)
+    shadow_write(history, shadow, buffer_store_data(store, position));
+  *buffer_store_info(store, position) = *info;
+  shadow->info = *info;
+  buffer_store_touch(store, position);
+  shadow->version = buffer_store_version(store, position);
+}
+
+static void set_order(history_t * history, buffer_handle_t * order, int count)
+{
+  buffer_store_t * store = history->store;
+  int i, j;
+
+  for(i = 0; i < count && i < buffer_store_count(store); i++)
+    {
+      for(j = i; j < buffer_store_count(store); j++)
+	if(buffer_store_handle(store, j) == order[i])
+	  break;
+      if(j != i && j < buffer_store_count(store))
+	buffer_store_swap(store, i, j);
+    }
+
+  free(history->order);
+  history->order = copy_order(store, &(history->order_count));
+}
+
+int history_undo(history_t * history)
+{
+  history_step_t * step;
+  int k;
+
+  /* anything not committed yet is undone first */
+  history_commit(history);
+  if(history->position == 0)
+    return -1;
+
+  step = history->steps[--history->position];
+  for(k = step->change_count - 1; k >= 0; k--)
+    apply_change(history, &(step->changes[k]), 1);
+  set_order(history, step->before, step->before_count);
+  return 0;
+}
+
+int history_redo(history_t * history)
+{
+  history_step_t * step;
+  int k;
+
+  history_commit(history);
+  if(history->position == history->step_count)
+    return -1;
+
+  step = history->steps[history->position++];
+  for(k = 0; k < step->change_count; k++)
+    apply_change(history, &(step->changes[k]), 0);
+  set_order(history, step->after, step->after_count);
+  return 0;
+}
+
+int history_can_undo(history_t * history)
+{
+  return history->position > 0;
+}
+
+int history_can_redo(history_t * history)
+{
+  return history->position < history->step_count;
+}
+
+size_t history_get_size(history_t * history)
+{
+  return history->size + history->shadow_size;
+}
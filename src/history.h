@@ -0,0 +1,42 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/* Undo and redo over a buffer store. The history keeps a deflated copy of
+   every buffer as it was at the last commit. A commit only reads the data
+   of buffers whose version moved since, and reads it with
+   buffer_store_peek, so packed buffers stay packed and nothing counts as a
+   use. Each step only holds the buffers that changed, as the XOR of their
+   old and new maps, run length encoded, so a step touching one map of
+   hundreds costs a few kilobytes.
+
+   Only the map data and info are recorded, not the image a buffer was
+   converted from. A removed buffer that comes back with undo has no
+   source any more, so it's remapped rather than converted again when the
+   palette or the conversion settings change. */
+typedef struct history history_t;
+
+/* The current contents of store become the oldest state. Steps are
+   dropped, oldest first, while they take more than budget bytes; a single
+   step larger than that can't be undone at all. The copies of the current
+   maps are not part of the budget. */
+history_t * history_new(buffer_store_t * store, size_t budget);
+void history_free(history_t * history);
+/* Forgets every step, the current contents become the oldest state. */
+void history_clear(history_t * history);
+
+/* Records everything that changed since the last commit, undo or redo as
+   one step and clears the redo steps. Returns 0 if nothing changed, the
+   redo steps are then kept. */
+int history_commit(history_t * history);
+
+/* These return -1 if there is nothing to undo or redo. Buffers that come
+   back get their old handles. */
+int history_undo(history_t * history);
+int history_redo(history_t * history);
+
+int history_can_undo(history_t * history);
+int history_can_redo(history_t * history);
+/* Bytes used by the steps and the copies of the current maps. */
+size_t history_get_size(history_t * history);
+
+#endif
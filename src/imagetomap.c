@@ -0,0 +1,230 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <glib.h>
+
+#include "glib_compat.h"
+#include "data_structures.h"
+#include "progress.h"
+#include "quantize.h"
+#include "palette_tables.h"
+#include "parallel.h"
+#include "nbtsave.h"
+#include "map_render.h"
+#include "imagetomap.h"
+#include "convert.h"
+
+struct imagetomap
+{
+  color_t palette[256];
+  int count;
+  int dithered, yuv;
+  quantize_lut_t * lut; /* for palette and yuv, NULL without a palette */
+  parallel_pool_t * pool;
+};
+
+void imagetomap_set_cache_dir(const char * dir)
+{
+  quantize_set_cache_dir(dir);
+}
+
+imagetomap_t * imagetomap_new(int threads)
+{
+  imagetomap_t * context = calloc(1, sizeof(imagetomap_t));
+
+  context->pool = parallel_pool_new(threads);
+  return context;
+}
+
+void imagetomap_free(imagetomap_t * context)
+{
+  if(context == NULL)
+    return;
+  parallel_pool_free(context->pool);
+  free(context);
+}
+
+int imagetomap_set_palette(imagetomap_t * context, const unsigned char * rgb, int count)
+{
+  int i;
+
+  if(count < 5 || count > 256)
+    return -1;
+
+  for(i = 0; i < count; i++)
+    {
+      context->palette[i].r = rgb[i * 3];
+      context->palette[i].g = rgb[i * 3 + 1];
+      context->palette[i].b = rgb[i * 3 + 2];
+    }
+  context->count = count;
+  /* the tables are shared by every palette with the same colors */
+  context->lut = quantize_get_lut(context->palette, count, context->yuv);
+  return 0;
+}
+
+int imagetomap_set_shipped_palette(imagetomap_t * context, const char * name)
+{
+  int palette = palette_find(name == NULL ? palettes[PALETTE_DEFAULT].name : name);
+
+  if(palette < 0)
+    return -1;
+  context->count = palettes[palette].count;
+  memcpy(context->palette, palettes[palette].colors, context->count * sizeof(color_t));
+  context->lut = palette_lut(palette, context->yuv);
+  return 0;
+}
+
+int imagetomap_get_palette_size(imagetomap_t * context)
+{
+  return context->count;
+}
+
+void imagetomap_set_options(imagetomap_t * context, int dithered, int yuv)
+{
+  context->dithered = dithered ? 1 : 0;
+  if((yuv ? 1 : 0) != context->yuv)
+    {
+      context->yuv = yuv ? 1 : 0;
+      if(context->count > 0)
+	context->lut = quantize_get_lut(context->palette, context->count, context->yuv);
+    }
+}
+
+typedef struct convert_pass
+{
+  imagetomap_t * context;
+  const imagetomap_image_t * image;
+  unsigned char * data;
+  int width, height, rows;
+  progress_t * progress;
+  volatile gint done;
+} convert_pass_t;
+
+/* Rows [start, end) of the whole image. */
+static void convert_rows(int start, int end, void * user_data)
+{
+  convert_pass_t * pass = (convert_pass_t *)user_data;
+
+  if(progress_cancelled(pass->progress))
+    return;
+  convert_area(&(pass->data[(size_t)start * pass->width]), pass->width, pass->height, 0, start,
+	       pass->width, end - start, pass->image, pass->context->lut, NULL);
+  progress_set(pass->progress, g_atomic_int_add(&pass->done, end - start) + end - start, pass->height);
+}
+
+/* Maps [start, end), numbered column by column. */
+static void convert_maps(int start, int end, void * user_data)
+{
+  convert_pass_t * pass = (convert_pass_t *)user_data;
+  int k;
+
+  for(k = start; k < end && !progress_cancelled(pass->progress); k++)
+    {
+      convert_area(&(pass->data[(size_t)k * 128 * 128]), pass->width, pass->height, (k / pass->rows) * 128,
+		   (k % pass->rows) * 128, 128, 128, pass->image, pass->context->lut, NULL);
+      progress_set(pass->progress, g_atomic_int_add(&pass->done, 1) + 1, (pass->width / 128) * pass->rows);
+    }
+}
+
+int imagetomap_convert(imagetomap_t * context, const imagetomap_image_t * image, int width, int height,
+		       unsigned char * data, progress_t * progress)
+{
+  convert_pass_t pass;
+
+  if(context->lut == NULL || width < 1 || height < 1)
+    return -1;
+
+  if(context->dithered)
+    convert_dithered(data, width, height, image, context->lut, context->palette, progress);
+  else
+    {
+      pass.context = context;
+      pass.image = image;
+      pass.data = data;
+      pass.width = width;
+      pass.height = height;
+      pass.rows = 0;
+      pass.progress = progress;
+      pass.done = 0;
+      parallel_pool_for(context->pool, height, 16, convert_rows, &pass);
+    }
+  return progress_cancelled(progress) ? -1 : 0;
+}
+
+int imagetomap_convert_maps(imagetomap_t * context, const imagetomap_image_t * image, int columns, int rows,
+			    unsigned char * maps, progress_t * progress)
+{
+  convert_pass_t pass;
+  int w = columns * 128, h = rows * 128;
+  int k, pi, pj;
+
+  if(context->lut == NULL || columns < 1 || rows < 1)
+    return -1;
+
+  if(context->dithered)
+    {
+      /* the error diffusion crosses map borders */
+      unsigned char * tmp = malloc((size_t)w * h);
+
+      convert_dithered(tmp, w, h, image, context->lut, context->palette, progress);
+      for(k = 0; k < columns * rows; k++)
+	for(pj = 0; pj < 128; pj++)
+	  for(pi = 0; pi < 128; pi++)
+	    maps[(size_t)k * 128 * 128 + pi + pj * 128] = tmp[(k / rows) * 128 + pi + (size_t)w * ((k % rows) * 128 + pj)];
+      free(tmp);
+    }
+  else
+    {
+      pass.context = context;
+      pass.image = image;
+      pass.data = maps;
+      pass.width = w;
+      pass.height = h;
+      pass.rows = rows;
+      pass.progress = progress;
+      pass.done = 0;
+      parallel_pool_for(context->pool, columns * rows, 1, convert_maps, &pass);
+    }
+  return progress_cancelled(progress) ? -1 : 0;
+}
+
+int imagetomap_render_map(imagetomap_t * context, const char * regionpath, int x, int z, int scale,
+			  unsigned char * data, progress_t * progress)
+{
+  int rs = 128 << scale;
+  block_info_t * blocks = calloc((size_t)rs * rs, sizeof(block_info_t));
+
+  if(blocks == NULL)
+    return -1;
+
+  /* reading the chunks is nearly all of the work */
+  progress_range(progress, 0.0, 0.9);
+  read_region_area(regionpath, blocks, x - (rs / 2), z - (rs / 2), rs, rs, progress);
+  progress_range(progress, 0.9, 1.0);
+  if(!progress_cancelled(progress))
+    render_map(context->pool, blocks, data, scale, progress);
+  free(blocks);
+
+  return progress_cancelled(progress) ? -1 : 0;
+}
+
+int imagetomap_write_map(FILE * dest, const unsigned char * data, int x, int z, int scale, int dimension)
+{
+  return nbt_write_map(dest, dimension, scale, 128, 128, x, z, (unsigned char *)data) == Z_OK ? 0 : -1;
+}
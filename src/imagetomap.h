@@ -0,0 +1,66 @@
+#ifndef IMAGETOMAP_H
+#define IMAGETOMAP_H
+
+/* libimagetomap, the image conversion, map file and world rendering code
+   of ImageToMapX without GTK, built by make lib. Needs glib.h, progress.h
+   and stdio.h; every function taking a progress_t accepts NULL.
+
+   A context holds the palette, the lookup tables, the conversion options
+   and the worker threads, nothing is kept in globals. Any number of
+   contexts can be used at the same time from any threads, and one context
+   from several threads as long as its settings aren't being changed.
+
+   The GUI doesn't go through contexts yet: it converts with the generate.h
+   wrappers, which use the shared lookup tables of palette_lut and the
+   shared pool of parallel_for. */
+
+typedef struct imagetomap imagetomap_t;
+
+/* Pixels as plain bytes, RGBA with 4 channels or RGB with 3, rowstride
+   bytes from the start of one row to the next. */
+typedef struct imagetomap_image
+{
+  const unsigned char * pixels;
+  int width, height, rowstride, channels;
+} imagetomap_image_t;
+
+/* Lookup tables are saved in dir and mapped from there by later runs,
+   for every context of the process. NULL, the default, keeps them in
+   memory only. */
+void imagetomap_set_cache_dir(const char * dir);
+
+/* threads counts the calling thread, 0 is one per processor. */
+imagetomap_t * imagetomap_new(int threads);
+void imagetomap_free(imagetomap_t * context);
+
+/* count colors of 3 bytes each, the first 4 are transparent and never
+   picked. Returns -1 if count isn't between 5 and 256. */
+int imagetomap_set_palette(imagetomap_t * context, const unsigned char * rgb, int count);
+/* Sets one of the shipped palettes by name: "legacy" (56 colors), "1.8"
+   (144), "1.12" (208), "1.16" (236) or "1.17" (248). NULL is 1.8.
+   Returns -1 for any other name. */
+int imagetomap_set_shipped_palette(imagetomap_t * context, const char * name);
+int imagetomap_get_palette_size(imagetomap_t * context);
+/* Floyd-Steinberg dithering and matching colors by YUV distance, both off
+   by default. */
+void imagetomap_set_options(imagetomap_t * context, int dithered, int yuv);
+
+/* Scales image to width * height and converts it, row by row, into data.
+   Pixels with an alpha of 0 become index 0 unless dithering. Returns -1
+   without a palette or once progress is cancelled. */
+int imagetomap_convert(imagetomap_t * context, const imagetomap_image_t * image, int width, int height,
+		       unsigned char * data, progress_t * progress);
+/* Splits image over columns * rows maps of 128 * 128 into maps, numbered
+   column by column. */
+int imagetomap_convert_maps(imagetomap_t * context, const imagetomap_image_t * image, int columns, int rows,
+			    unsigned char * maps, progress_t * progress);
+
+/* Renders the map of scale centered on x, z from the region files in
+   regionpath. Returns -1 once progress is cancelled. */
+int imagetomap_render_map(imagetomap_t * context, const char * regionpath, int x, int z, int scale,
+			  unsigned char * data, progress_t * progress);
+
+/* Writes a map_N.dat of data to dest, returns -1 on failure. */
+int imagetomap_write_map(FILE * dest, const unsigned char * data, int x, int z, int scale, int dimension);
+
+#endif
@@ -0,0 +1,130 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "glib_compat.h"
+#include "progress.h"
+#include "job.h"
+#include "trace.h"
+
+struct job
+{
+  char * name;
+  job_func_t run, done;
+  gpointer data;
+  progress_t progress;
+};
+
+/* only touched from the main loop */
+static job_t ** jobs = NULL;
+static int job_count = 0, job_size = 0;
+
+static gboolean job_finish(gpointer user_data)
+{
+  job_t * job = (job_t *)user_data;
+  int i;
+
+  for(i = 0; i < job_count; i++)
+    if(jobs[i] == job)
+      {
+	memmove(&(jobs[i]), &(jobs[i + 1]), (job_count - i - 1) * sizeof(job_t *));
+	job_count--;
+	break;
+      }
+
+  if(job->done != NULL)
+    job->done(job, job->data);
+
+  g_free(job->name);
+  free(job);
+  return FALSE;
+}
+
+static gpointer job_thread(gpointer user_data)
+{
+  job_t * job = (job_t *)user_data;
+  gint64 start = trace_now();
+
+  trace_name_thread(job->name);
+  job->run(job, job->data);
+  trace_span("job", "job", start, g_get_monotonic_time(), 1);
+  g_idle_add(job_finish, job);
+  return NULL;
+}
+
+job_t * job_start(const char * name, job_func_t run, job_func_t done, gpointer data)
+{
+  job_t * job = malloc(sizeof(job_t));
+
+  job->name = g_strdup(name);
+  job->run = run;
+  job->done = done;
+  job->data = data;
+  progress_init(&(job->progress));
+
+  if(job_count == job_size)
+    {
+      job_size = job_size ? job_size * 2 : 8;
+      jobs = realloc(jobs, job_size * sizeof(job_t *));
+    }
+  jobs[job_count++] = job;
+
+  g_thread_unref(g_thread_new(name, job_thread, job));
+  return job;
+}
+
+void job_post(job_t * job, GSourceFunc func, gpointer data)
+{
+  g_idle_add(func, data);
+}
+
+progress_t * job_progress(job_t * job)
+{
+  return &(job->progress);
+}
+
+void job_cancel(job_t * job)
+{
+  progress_cancel(&(job->progress));
+}
+
+int job_cancelled(job_t * job)
+{
+  return progress_cancelled(&(job->progress));
+}
+
+const char * job_get_name(job_t * job)
+{
+  return job->name;
+}
+
+int job_get_count(void)
+{
+  return job_count;
+}
+
+job_t * job_get(int i)
+{
+  return (i >= 0 && i < job_count) ? jobs[i] : NULL;
+}
+
+void job_cancel_all(void)
+{
+  int i;
+  for(i = 0; i < job_count; i++)
+    job_cancel(jobs[i]);
+}
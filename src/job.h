@@ -0,0 +1,29 @@
+#ifndef JOB_H
+#define JOB_H
+
+/* Runs long operations on their own thread so the GUI stays responsive.
+   Jobs are started and finished on the thread running the GLib main
+   loop; everything a job hands back to the GUI goes through job_post. */
+typedef struct job job_t;
+
+/* run is called on the job's thread, done afterwards on the main loop,
+   also when the job was cancelled. */
+typedef void (*job_func_t)(job_t * job, gpointer data);
+
+job_t * job_start(const char * name, job_func_t run, job_func_t done, gpointer data);
+
+/* Queues func(data) on the main loop, for partial results. Posts run in
+   order and before the job's done callback. */
+void job_post(job_t * job, GSourceFunc func, gpointer data);
+
+progress_t * job_progress(job_t * job);
+void job_cancel(job_t * job);
+int job_cancelled(job_t * job);
+const char * job_get_name(job_t * job);
+
+/* The jobs that haven't finished, oldest first. */
+int job_get_count(void);
+job_t * job_get(int i);
+void job_cancel_all(void);
+
+#endif
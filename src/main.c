@@ -33,10 +33,27 @@
 int __cdecl __MINGW_NOTHROW strcasecmp (const char *, const char *);
 #endif
 
+#include "glib_compat.h"
 #include "data_structures.h"
+#include "progress.h"
+#include "job.h"
 #include "generate.h"
 #include "nbtsave.h"
+#include "parallel.h"
 #include "map_render.h"
+#include "pyramid.h"
+#include "world_export.h"
+#include "world_overview.h"
+#include "map_export.h"
+#include "animation.h"
+#include "quantize.h"
+#include "palette.h"
+#include "palette_tables.h"
+#include "buffer_store.h"
+#include "history.h"
+#include "cli.h"
+#include "stats.h"
+#include "trace.h"
 
 #ifdef OS_LINUX
 #define MINECRAFT_PATH "/home/<user>/.minecraft/saves/<world name>/region"
@@ -46,37 +63,68 @@ int __cdecl __MINGW_NOTHROW strcasecmp (const char *, const char *);
 #define MINECRAFT_PATH "<path to .minecraft>/.minecraft/saves/<world name>/region"
 #endif
 
-#define BUFFER_COUNT 256
+/* how many bytes of undo steps are kept, not counting the copies of the
+   current maps they are made against */
+#define HISTORY_BUDGET (32 * 1024 * 1024)
+
 
 enum
   {
     ITEM_SIGNAL_OPEN,
     ITEM_SIGNAL_OPEN_GRID_IMAGE,
+    ITEM_SIGNAL_OPEN_ANIMATION,
     ITEM_SIGNAL_SAVE,
     ITEM_SIGNAL_SAVE_INCREMENT,
     ITEM_SIGNAL_SAVE_ALL,
     ITEM_SIGNAL_SAVE_RM,
     ITEM_SIGNAL_EXPORT_IMAGE,
+    ITEM_SIGNAL_EXPORT_ATLAS,
+    ITEM_SIGNAL_EXPORT_ALL_IMAGES,
     ITEM_SIGNAL_WORLD_RENDER_ITEM,
+    ITEM_SIGNAL_EXPORT_WORLD_IMAGE,
+    ITEM_SIGNAL_WORLD_OVERVIEW,
     ITEM_SIGNAL_CLEAN,
 
+    ITEM_SIGNAL_UNDO,
+    ITEM_SIGNAL_REDO,
+
     ITEM_SIGNAL_GENERATE_MANDELBROT,
     ITEM_SIGNAL_GENERATE_JULIA,
     ITEM_SIGNAL_GENERATE_PALETTE,
     ITEM_SIGNAL_GENERATE_RANDOM_NOISE,
     ITEM_SIGNAL_GENERATE_FROM_CLIPBOARD,
 
+    ITEM_SIGNAL_MEMORY_BUDGET,
+    ITEM_SIGNAL_STATISTICS,
+
     ITEM_SIGNAL_QUIT
   };
 
 void set_image();
+static void update_image();
 void remove_buffer(int id);
 void update_sidepanel();
+void sidepanel_mark_dirty(int id);
+void sidepanel_mark_all_dirty();
+void sidepanel_swap(int a, int b);
+void sidepanel_remove(int id);
 int get_buffer_count();
 void add_buffer();
-void image_load_map(char * path);
 int srecmpend(char * end, char * str);
 
+typedef struct configvars
+{
+  GdkInterpType interp;
+  double zooms;
+  double stdzoom;	
+
+  int maxzoom;
+  int minzoom;
+
+  /* megabytes of map data kept unpacked, 0 for no limit */
+  int buffer_budget;
+} configvars_t;
+
 configvars_t * config = NULL;
 
 static GtkWidget * window;
@@ -94,24 +142,25 @@ const static GtkTargetEntry targets[] =
   };
 
 int current_buffer = -1;
-static GdkPixbuf * dimage;
+static GdkPixbuf * start_image;
 static GtkWidget * image;
-static GtkWidget * list_vbox;
+/* the main view shows view_mul / view_div screen pixels per map pixel,
+   one of them is always 1 */
+static int view_mul = 4, view_div = 1;
+static gboolean view_ready = FALSE;
+static cairo_surface_t * view_surface = NULL;
+static GtkWidget * buffer_view;
+static GtkListStore * thumbnail_store;
 
 static GtkWidget * FSD_checkbox;
 static GtkWidget * YUV_checkbox;
-static GtkWidget * old_colors_checkbox;
-int old_colors = 0;
+static GtkWidget * trace_checkbox;
+/* the palette new buffers are converted to, see palette_tables.h */
+static int current_palette = PALETTE_DEFAULT;
 
-color_t * colors = NULL;
-color_t * oldcolors = NULL;
-color_t * newcolors = NULL;
-unsigned char * mdata[BUFFER_COUNT];
-map_data_t mdata_info[BUFFER_COUNT];
+buffer_store_t * buffers = NULL;
+static history_t * history = NULL;
 
-GtkWidget * selected_buffer_frame = NULL;
-GtkWidget * icons[BUFFER_COUNT];
-GtkWidget * icon_event_boxes[BUFFER_COUNT];
 
 char last_file[512];
 
@@ -124,6 +173,7 @@ configvars_t * config_new()
 	
   config->maxzoom = 128 * 8;
   config->minzoom = 128 / 4;
+  config->buffer_budget = 256;
   return config;
 }
 
@@ -158,112 +208,712 @@ void information(const char * message)
   printf("%s\n", message);
 }
 
-GdkPixbuf * image_from_data(unsigned char * data, int scale)
+/* Makes everything changed since the last commit one undo step, and tells
+   the user when that step was too large to be kept. */
+static void commit_history(void)
 {
-  GdkPixbuf * pixbuf = gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB,
-						FALSE, 8, 128, 128,
-						128 * 3, NULL, NULL);
-	
-  if(scale)
+  if(history_commit(history) && !history_can_undo(history))
+    information("This change was too large to be undone.");
+}
+
+GdkPixbuf * get_pixbuf_from_data(unsigned char * data, int palette, int scale)
+{
+  int zoom = 1;
+  GdkPixbuf * pixbuf;
+
+  if(scale && config->stdzoom >= 1 && config->stdzoom == (int)config->stdzoom)
+    zoom = (int)config->stdzoom;
+
+  pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, 128 * zoom, 128 * zoom);
+  palette_expand(data, palette_rgba(palette), zoom, 3, 0, gdk_pixbuf_get_pixels(pixbuf), gdk_pixbuf_get_rowstride(pixbuf));
+
+  /* fractional zooms are scaled from the 1:1 image */
+  if(scale && zoom == 1 && config->stdzoom != 1)
     {
       GdkPixbuf * rpixbuf = gdk_pixbuf_scale_simple(pixbuf, 128 * config->stdzoom, 128 * config->stdzoom, GDK_INTERP_NEAREST);
       g_object_unref(pixbuf);
       return rpixbuf;
     }
+  return pixbuf;
+}
+
+/* The status bar showing running jobs, polled while there are any. */
+static GtkWidget * job_box;
+static GtkWidget * job_bar;
+static guint job_timer = 0;
+
+static gboolean job_status_update(gpointer data)
+{
+  job_t * job = job_get(0);
+  char text[256];
+
+  if(job == NULL)
+    {
+      gtk_widget_hide(job_box);
+      job_timer = 0;
+      return FALSE;
+    }
+
+  if(job_get_count() > 1)
+    snprintf(text, sizeof(text), "%s (%i more)", job_get_name(job), job_get_count() - 1);
   else
+    snprintf(text, sizeof(text), "%s", job_get_name(job));
+  gtk_progress_bar_set_text(GTK_PROGRESS_BAR(job_bar), text);
+  gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(job_bar), progress_get(job_progress(job)));
+  return TRUE;
+}
+
+static void job_status_cancel(GtkWidget * widget, gpointer data)
+{
+  job_cancel_all();
+}
+
+static job_t * start_job(const char * name, job_func_t run, job_func_t done, gpointer data)
+{
+  job_t * job = job_start(name, run, done, data);
+
+  if(job_timer == 0)
     {
-      GdkPixbuf * rpixbuf = gdk_pixbuf_scale_simple(pixbuf, 128, 128, GDK_INTERP_NEAREST); // Don't ask me why this is needed
-      g_object_unref(pixbuf);
-      return rpixbuf;
+      gtk_widget_show_all(job_box);
+      job_timer = g_timeout_add(100, job_status_update, NULL);
     }
+  job_status_update(NULL);
+  return job;
 }
 
-GdkPixbuf * get_pixbuf_from_data(unsigned char * data, int scale)
+/* How much memory the buffers take, next to the zoom buttons. */
+static GtkWidget * memory_label;
+
+/* Packs buffers that haven't been used for a while if the store is over
+   its budget and shows the new totals. */
+static void update_memory_usage()
 {
-  unsigned char * tmpdata = malloc(128 * 128 * 3);
-  int i;
-  for(i = 0; i < 128 * 128; i++)
+  buffer_store_usage_t usage;
+  char text[256];
+
+  buffer_store_trim(buffers, current_buffer);
+  buffer_store_get_usage(buffers, &usage);
+  snprintf(text, sizeof(text), "Maps: %.1f MB, %.1f MB packed, %.1f MB on disk (peak %.1f MB)",
+	   usage.resident / 1048576.0, usage.packed / 1048576.0, usage.spilled / 1048576.0,
+	   usage.peak / 1048576.0);
+  gtk_label_set_text(GTK_LABEL(memory_label), text);
+}
+
+/* Converting an image file into a width * height grid of maps. */
+typedef struct convert_request
+{
+  char * file;
+  int width, height;
+  int dithered, yuv, palette;
+  unsigned char * data; /* the maps one after another, column by column */
+  unsigned char * sources; /* the RGBA each map was converted from, in the same order */
+  GError * error;
+} convert_request_t;
+
+typedef struct convert_tile
+{
+  convert_request_t * request;
+  int index;
+} convert_tile_t;
+
+static gboolean convert_tile_done(gpointer data)
+{
+  convert_tile_t * tile = (convert_tile_t *)data;
+  unsigned char * source = malloc(128 * 128 * 4);
+
+  add_buffer();
+  buffer_store_info(buffers, current_buffer)->palette = tile->request->palette;
+  memcpy(buffer_store_data(buffers, current_buffer), &(tile->request->data[tile->index * 128 * 128]), 128 * 128);
+  memcpy(source, &(tile->request->sources[tile->index * 128 * 128 * 4]), 128 * 128 * 4);
+  buffer_store_set_source(buffers, current_buffer, source);
+  set_image();
+  free(tile);
+  return FALSE;
+}
+
+static void convert_post_tile(job_t * job, convert_request_t * request, int index, GdkPixbuf * pixbuf)
+{
+  convert_tile_t * tile = malloc(sizeof(convert_tile_t));
+
+  generate_source_area(&(request->sources[index * 128 * 128 * 4]), request->width * 128, request->height * 128,
+		       (index / request->height) * 128, (index % request->height) * 128, 128, 128, pixbuf);
+  tile->request = request;
+  tile->index = index;
+  job_post(job, convert_tile_done, tile);
+}
+
+static void convert_run(job_t * job, gpointer data)
+{
+  convert_request_t * request = (convert_request_t *)data;
+  int count = request->width * request->height;
+  int w = request->width * 128, h = request->height * 128;
+  GdkPixbuf * pixbuf = generate_load_pixbuf(request->file, &(request->error));
+  int i, j, k, pi, pj;
+
+  if(pixbuf == NULL)
+    return;
+
+  if(request->dithered)
     {
-      if(data[i] > 3)
+      /* the error diffusion crosses map borders, so the whole image is
+	 converted before any map is shown */
+      unsigned char * tmp = malloc(w * h);
+
+      generate_image_dithered_pixbuf(tmp, w, h, request->yuv, pixbuf, request->palette, job_progress(job));
+      for(k = 0; k < count && !job_cancelled(job); k++)
 	{
-	  tmpdata[i * 3] = colors[data[i]].r;
-	  tmpdata[i * 3 + 1] = colors[data[i]].g;
-	  tmpdata[i * 3 + 2] = colors[data[i]].b;
+	  i = k / request->height;
+	  j = k % request->height;
+	  for(pi = 0; pi < 128; pi++)
+	    for(pj = 0; pj < 128; pj++)
+	      request->data[k * 128 * 128 + pi + pj * 128] = tmp[i * 128 + pi + w * (j * 128 + pj)];
+	  convert_post_tile(job, request, k, pixbuf);
 	}
+      free(tmp);
+    }
+  else
+    for(k = 0; k < count; k++)
+      {
+	progress_range(job_progress(job), (double)k / count, (double)(k + 1) / count);
+	generate_image_pixbuf_area(&(request->data[k * 128 * 128]), w, h, (k / request->height) * 128,
+				   (k % request->height) * 128, 128, 128, request->yuv, pixbuf,
+				   request->palette, job_progress(job));
+	if(job_cancelled(job))
+	  break;
+	convert_post_tile(job, request, k, pixbuf);
+      }
+
+  g_object_unref(pixbuf);
+}
+
+static void convert_done(job_t * job, gpointer data)
+{
+  convert_request_t * request = (convert_request_t *)data;
+
+  if(request->error != NULL)
+    {
+      information("Error while loading image file!");
+      printf("%s\n", request->error->message);
+      g_error_free(request->error);
+    }
+
+  g_free(request->file);
+  free(request->data);
+  free(request->sources);
+  free(request);
+}
+
+/* Converts file in the background, every map is added as a new buffer
+   as soon as it is done. */
+static void convert_image_file(const char * file, int width, int height)
+{
+  convert_request_t * request = malloc(sizeof(convert_request_t));
+  char name[256];
+
+  request->file = g_strdup(file);
+  request->width = width;
+  request->height = height;
+  request->dithered = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox));
+  request->yuv = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox));
+  request->palette = current_palette;
+  request->data = malloc(width * height * 128 * 128);
+  request->sources = malloc(width * height * 128 * 128 * 4);
+  request->error = NULL;
+
+  snprintf(name, sizeof(name), "Converting %s", file);
+  start_job(name, convert_run, convert_done, request);
+}
+
+/* Importing any number of maps, raw maps and images, one buffer each. The
+   files are read and converted in parallel, and every buffer is added as
+   soon as the files before it are, so they keep the order they were given
+   in. */
+enum
+  {
+    IMPORT_MAP,
+    IMPORT_RAW_MAP,
+    IMPORT_IMAGE,
+    IMPORT_UNSUPPORTED
+  };
+
+typedef struct import_file
+{
+  char * file;
+  int type;
+  unsigned char data[128 * 128];
+  unsigned char * source; /* for images */
+  int palette;
+  GError * error;
+  int ready;
+} import_file_t;
+
+typedef struct import_request
+{
+  import_file_t * files;
+  int count;
+  int missing; /* files that couldn't be found */
+  int dithered, yuv, palette;
+  job_t * job;
+
+  /* guards ready and next_post, so the files are posted in order */
+  GMutex lock;
+  int next_post;
+  volatile gint finished;
+} import_request_t;
+
+static int import_file_type(char * file)
+{
+  if(srecmpend(".dat", file) == 0)
+    return IMPORT_MAP;
+  if(srecmpend(".imtm", file) == 0)
+    return IMPORT_RAW_MAP;
+  if(srecmpend(".bmp", file) == 0 || srecmpend(".png", file) == 0 || srecmpend(".jpg", file) == 0 || srecmpend(".jpeg", file) == 0 || srecmpend(".gif", file) == 0)
+    return IMPORT_IMAGE;
+  return IMPORT_UNSUPPORTED;
+}
+
+static gboolean import_file_done(gpointer data)
+{
+  import_file_t * file = (import_file_t *)data;
+
+  if(file->type == IMPORT_UNSUPPORTED || file->error != NULL)
+    return FALSE;
+
+  add_buffer();
+  buffer_store_info(buffers, current_buffer)->palette = file->palette;
+  memcpy(buffer_store_data(buffers, current_buffer), file->data, 128 * 128);
+  buffer_store_set_source(buffers, current_buffer, file->source);
+  file->source = NULL;
+  set_image();
+  return FALSE;
+}
+
+static void import_read(import_request_t * request, import_file_t * file)
+{
+  GdkPixbuf * pixbuf;
+  int data_version, i;
+
+  file->palette = request->palette;
+  if(file->type == IMPORT_MAP && nbt_load_map(file->file, file->data, &data_version) != 0)
+    g_set_error(&(file->error), G_FILE_ERROR, G_FILE_ERROR_FAILED, "not a readable map file");
+  else if(file->type == IMPORT_RAW_MAP && load_raw_map(file->file, file->data) != 0)
+    g_set_error(&(file->error), G_FILE_ERROR, G_FILE_ERROR_FAILED, "not a readable map file");
+  else if(file->type == IMPORT_IMAGE && (pixbuf = generate_load_pixbuf(file->file, &(file->error))) != NULL)
+    {
+      if(request->dithered)
+	generate_image_dithered_pixbuf(file->data, 128, 128, request->yuv, pixbuf, request->palette, NULL);
       else
+	generate_image_pixbuf_area(file->data, 128, 128, 0, 0, 128, 128, request->yuv, pixbuf, request->palette, NULL);
+      file->source = malloc(128 * 128 * 4);
+      generate_source_area(file->source, 128, 128, 0, 0, 128, 128, pixbuf);
+      g_object_unref(pixbuf);
+    }
+
+  if(file->error != NULL || (file->type != IMPORT_MAP && file->type != IMPORT_RAW_MAP))
+    return;
+  /* a map file names its version, a raw map is taken to be of the
+     current palette; colors the palette doesn't have become 0, none */
+  if(file->type == IMPORT_MAP)
+    {
+      file->palette = palette_for_data_version(data_version);
+      /* the maps saved here have no DataVersion either, so one using
+	 colors past 1.8 gets the oldest palette that has them */
+      if(data_version < 0)
 	{
-	  int x = i % 128, y = i / 128;
-	  x /= 4;
-	  y /= 4;
-	  tmpdata[i * 3] = ((x + (y % 2)) % 2) ? 0xFF : 0xAA;
-	  tmpdata[i * 3 + 1] = ((x + (y % 2)) % 2) ? 0xFF : 0xAA;
-	  tmpdata[i * 3 + 2] = ((x + (y % 2)) % 2) ? 0xFF : 0xAA;
+	  int highest = 0;
+
+	  for(i = 0; i < 128 * 128; i++)
+	    highest = MAX(highest, file->data[i]);
+	  while(file->palette + 1 < PALETTES && highest >= palettes[file->palette].count)
+	    file->palette++;
 	}
     }
-	
-  GdkPixbuf * fdata = image_from_data(tmpdata, scale);
-  free(tmpdata);
+  for(i = 0; i < 128 * 128; i++)
+    if(file->data[i] >= palettes[file->palette].count)
+      file->data[i] = 0;
+}
+
+static void import_range(int start, int end, void * user_data)
+{
+  import_request_t * request = (import_request_t *)user_data;
+  int i;
 
-  return fdata;
+  for(i = start; i < end && !job_cancelled(request->job); i++)
+    {
+      import_read(request, &(request->files[i]));
+
+      g_mutex_lock(&(request->lock));
+      request->files[i].ready = 1;
+      while(request->next_post < request->count && request->files[request->next_post].ready)
+	job_post(request->job, import_file_done, &(request->files[request->next_post++]));
+      g_mutex_unlock(&(request->lock));
+
+      progress_set(job_progress(request->job), g_atomic_int_add(&(request->finished), 1) + 1, request->count);
+    }
 }
 
-void drag_received(GtkWidget * widget, GdkDragContext * context, gint x, gint y, GtkSelectionData * select_data, guint type_type, guint time, gpointer data)
+static void import_run(job_t * job, gpointer data)
+{
+  import_request_t * request = (import_request_t *)data;
+
+  request->job = job;
+  parallel_for(request->count, 1, import_range, request);
+}
+
+static void import_done(job_t * job, gpointer data)
 {
+  import_request_t * request = (import_request_t *)data;
+  int i, failed = request->missing, unsupported = 0;
+  char text[128];
+
+  for(i = 0; i < request->count; i++)
+    {
+      import_file_t * file = &(request->files[i]);
+
+      if(file->type == IMPORT_UNSUPPORTED)
+	unsupported++;
+      if(file->error != NULL)
+	{
+	  printf("%s: %s\n", file->file, file->error->message);
+	  g_error_free(file->error);
+	  failed++;
+	}
+      g_free(file->file);
+      free(file->source);
+    }
+
+  if(failed)
+    {
+      snprintf(text, sizeof(text), "Could not load %i of %i files!", failed, request->count + request->missing);
+      information(text);
+    }
+  else if(unsupported)
+    information("File format not supported!");
+
+  g_mutex_clear(&(request->lock));
+  free(request->files);
+  free(request);
+}
+
+static void import_files(char ** files, int count)
+{
+  import_request_t * request;
   struct stat info;
-  gchar * file = (char *) gtk_selection_data_get_data(select_data);
-  int len;
-  
-  if (strncmp(file, "file:///", 8) != 0)
+  char name[256];
+  int i;
+
+  if(count == 0)
     return;
 
-  gtk_drag_finish(context, TRUE, FALSE, time);
-  
-  file += 7 * sizeof(char);
-#ifndef OS_LINUX
-  file += 1 * sizeof(char);
+  request = malloc(sizeof(import_request_t));
+  request->files = calloc(count, sizeof(import_file_t));
+  request->count = 0;
+  request->missing = 0;
+  for(i = 0; i < count; i++)
+    if(stat(files[i], &info) == 0)
+      {
+	import_file_t * file = &(request->files[request->count++]);
+	file->file = g_strdup(files[i]);
+	file->type = import_file_type(file->file);
+      }
+    else
+      {
+	printf("%s: %s\n", files[i], strerror(errno));
+	request->missing++;
+      }
+
+  if(request->count == 0)
+    {
+      information(count == 1 ? "File not found!" : "None of the files were found!");
+      free(request->files);
+      free(request);
+      return;
+    }
+  request->dithered = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox));
+  request->yuv = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox));
+  request->palette = current_palette;
+  g_mutex_init(&(request->lock));
+  request->next_post = 0;
+  request->finished = 0;
+
+  if(request->count == 1)
+    snprintf(name, sizeof(name), "Converting %s", request->files[0].file);
+  else
+    snprintf(name, sizeof(name), "Importing %i files", request->count);
+  start_job(name, import_run, import_done, request);
+}
+
+/* Saving copies of count maps as map_<first>.dat onwards in dirname. */
+typedef struct save_request
+{
+  char * dirname;
+  int first, count;
+  unsigned char * data;
+  map_data_t * info;
+} save_request_t;
+
+static void save_all_run(job_t * job, gpointer data)
+{
+  save_request_t * request = (save_request_t *)data;
+  char path[1024];
+  int k;
+
+  for(k = 0; k < request->count; k++)
+    {
+      map_data_t * info = &(request->info[k]);
+
+      if(progress_set(job_progress(job), k, request->count))
+	break;
+#ifdef OS_LINUX
+      snprintf(path, sizeof(path), "%s/map_%i.dat", request->dirname, request->first + k);
+#else
+      snprintf(path, sizeof(path), "%s\\map_%i.dat", request->dirname, request->first + k);
 #endif
+      nbt_save_map(path, info->dimension, info->scale, 128, 128, info->xpos, info->zpos, &(request->data[k * 128 * 128]));
+    }
+}
 
-  len = strlen(file) - 1;
+static void save_all_done(job_t * job, gpointer data)
+{
+  save_request_t * request = (save_request_t *)data;
 
-  while ((file[len] == ' ') || (file[len] == '\n') || (file[len] == '\r'))
+  free(request->dirname);
+  free(request->data);
+  free(request->info);
+  free(request);
+}
+
+/* Rendering one map of the world, the buffer is only added once it is
+   complete. */
+typedef struct render_request
+{
+  char * path;
+  pyramid_t * pyramid;
+  int x, z, scale;
+  unsigned char data[128 * 128];
+} render_request_t;
+
+static void render_world_run(job_t * job, gpointer data)
+{
+  render_request_t * request = (render_request_t *)data;
+  progress_t * progress = job_progress(job);
+
+  if(request->pyramid != NULL)
+    pyramid_render_map(request->pyramid, request->data, request->x, request->z, request->scale, progress);
+  else
     {
-      file[len] = '\0';
-      len--;
+      int rs = 128 << request->scale;
+      block_info_t * blocks = calloc(rs * rs, sizeof(block_info_t));
+
+      /* reading the chunks is nearly all of the work */
+      progress_range(progress, 0.0, 0.9);
+      read_region_area(request->path, blocks, request->x - (rs / 2), request->z - (rs / 2), rs, rs, progress);
+      progress_range(progress, 0.9, 1.0);
+      if(!progress_cancelled(progress))
+	render_map(NULL, blocks, request->data, request->scale, progress);
+      free(blocks);
     }
+}
 
-  if (stat(file, &info) < 0)
-    return;
+static void render_world_done(job_t * job, gpointer data)
+{
+  render_request_t * request = (render_request_t *)data;
 
-  if(srecmpend(".dat", file) == 0)
+  if(!job_cancelled(job))
     {
       add_buffer();
-      image_load_map(file);
+      memcpy(buffer_store_data(buffers, current_buffer), request->data, 128 * 128);
+      buffer_store_info(buffers, current_buffer)->scale = request->scale;
+      buffer_store_info(buffers, current_buffer)->xpos = request->x;
+      buffer_store_info(buffers, current_buffer)->zpos = request->z;
+      buffer_store_info(buffers, current_buffer)->dimension = 0;
+      set_image();
+    }
+
+  if(request->pyramid != NULL)
+    pyramid_close(request->pyramid);
+  g_free(request->path);
+  free(request);
+}
+
+/* Fills table with the nearest color of palette to for every color of
+   palette from, see quantize_remap_table. */
+static void remap_table(int from, int to, unsigned char * table)
+{
+  quantize_remap_table(palettes[from].colors, palettes[from].count, palettes[to].colors, palettes[to].count,
+		       gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), table);
+}
+
+static void remap_map(unsigned char * data, int from, int to)
+{
+  unsigned char table[256];
+  int k;
+
+  remap_table(from, to, table);
+  for(k = 0; k < 128 * 128; k++)
+    data[k] = table[data[k]];
+}
+
+/* Exporting copies of count buffers as an atlas of columns maps wide, or
+   with columns 0 as one PNG each into the directory file. */
+typedef struct map_export_request
+{
+  char * file;
+  unsigned char * data;
+  int count, columns, level;
+  uint32_t table[256];
+  int ret;
+} map_export_request_t;
+
+static void map_export_run(job_t * job, gpointer data)
+{
+  map_export_request_t * request = (map_export_request_t *)data;
+
+  if(request->columns > 0)
+    request->ret = map_export_atlas(request->file, request->data, request->count, request->columns,
+				    request->table, request->level, job_progress(job));
+  else
+    request->ret = map_export_pngs(request->file, 0, request->data, request->count,
+				   request->table, request->level, job_progress(job));
+}
+
+static void map_export_done(job_t * job, gpointer data)
+{
+  map_export_request_t * request = (map_export_request_t *)data;
+
+  if(request->ret != 0 && !job_cancelled(job))
+    information("Error while exporting images!");
+  g_free(request->file);
+  free(request->data);
+  free(request);
+}
+
+static void start_map_export(char * file, int first, int count, int columns, int level)
+{
+  map_export_request_t * request = malloc(sizeof(map_export_request_t));
+  int k;
+
+  request->file = file;
+  request->count = count;
+  request->columns = columns;
+  request->level = CLAMP(level, 0, 9);
+  request->data = malloc((size_t)count * 128 * 128);
+  for(k = 0; k < count; k++)
+    {
+      unsigned char * data = &(request->data[(size_t)k * 128 * 128]);
+      int palette = buffer_store_info(buffers, first + k)->palette;
+
+      memcpy(data, buffer_store_data(buffers, first + k), 128 * 128);
+      /* there is one table for all of them */
+      if(palette != current_palette)
+	remap_map(data, palette, current_palette);
+      buffer_store_trim(buffers, current_buffer);
     }
-  else if(srecmpend(".bmp", file) == 0 || srecmpend(".png", file) == 0 || srecmpend(".jpg", file) == 0 || srecmpend(".jpeg", file) == 0 || srecmpend(".gif", file) == 0)
+  memcpy(request->table, palette_rgba(current_palette), sizeof(request->table));
+  request->ret = 0;
+
+  start_job(columns > 0 ? "Exporting atlas" : "Exporting images", map_export_run, map_export_done, request);
+}
+
+/* Converting every frame of an animation, each map it keeps becomes a
+   buffer in order. */
+typedef struct animation_request
+{
+  char * file;
+  int width, height, dithered, yuv, palette;
+  animation_t * animation;
+  GError * error;
+} animation_request_t;
+
+static void animation_run(job_t * job, gpointer data)
+{
+  animation_request_t * request = (animation_request_t *)data;
+
+  request->animation = animation_convert(request->file, request->width, request->height, request->dithered,
+					 request->yuv, request->palette, &(request->error), job_progress(job));
+}
+
+static void animation_done(job_t * job, gpointer data)
+{
+  animation_request_t * request = (animation_request_t *)data;
+  int i;
+
+  if(request->animation != NULL)
     {
-      GError * err = NULL;
-      add_buffer();
-      if(gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox)))
-	generate_image_dithered(mdata[current_buffer], 128, 128, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), file, colors, &err);
-      else
-	generate_image(mdata[current_buffer], 128, 128, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), file, colors, &err);
-      if(err != NULL)
+      for(i = 0; i < request->animation->map_count; i++)
 	{
-	  information("Error while loading image file!");
-	  printf("%s\n", err->message);
-	  g_error_free(err);
+	  add_buffer();
+	  buffer_store_info(buffers, current_buffer)->palette = request->palette;
+	  memcpy(buffer_store_data(buffers, current_buffer), &(request->animation->maps[(size_t)i * 128 * 128]), 128 * 128);
+	  buffer_store_trim(buffers, current_buffer);
 	}
       set_image();
+      animation_free(request->animation);
     }
-  else if(srecmpend(".imtm", file) == 0)
+  else if(!job_cancelled(job))
     {
-      add_buffer();
-      load_raw_map(file, mdata[current_buffer]);
-      set_image();
+      if(request->error != NULL)
+	printf("%s: %s\n", request->file, request->error->message);
+      information("Error while loading image file!");
     }
-  else
-    information("File format not supported!");
-  gtk_drag_finish(context, TRUE, TRUE, time);
+
+  if(request->error != NULL)
+    g_error_free(request->error);
+  g_free(request->file);
+  free(request);
+}
+
+typedef struct export_request
+{
+  char * path, * file;
+  int x, z, width, height, scale;
+  const color_t * colors;
+  int ret;
+} export_request_t;
+
+static void export_world_run(job_t * job, gpointer data)
+{
+  export_request_t * request = (export_request_t *)data;
+
+  request->ret = world_export_png(request->path, request->file, request->x, request->z, request->width, request->height,
+				  request->scale, request->colors, 6, job_progress(job));
+}
+
+static void export_world_done(job_t * job, gpointer data)
+{
+  export_request_t * request = (export_request_t *)data;
+
+  if(request->ret != 0 && !job_cancelled(job))
+    information("Error while exporting world image!");
+  g_free(request->path);
+  g_free(request->file);
+  free(request);
+}
+
+void drag_received(GtkWidget * widget, GdkDragContext * context, gint x, gint y, GtkSelectionData * select_data, guint type_type, guint time, gpointer data)
+{
+  gchar ** uris = gtk_selection_data_get_uris(select_data);
+  char ** files;
+  int i, count = 0;
+
+  if(uris == NULL)
+    {
+      gtk_drag_finish(context, FALSE, FALSE, time);
+      return;
+    }
+
+  for(i = 0; uris[i] != NULL; i++);
+  files = malloc(i * sizeof(char *));
+  for(i = 0; uris[i] != NULL; i++)
+    if((files[count] = g_filename_from_uri(uris[i], NULL, NULL)) != NULL)
+      count++;
+  g_strfreev(uris);
+
+  import_files(files, count);
+  for(i = 0; i < count; i++)
+    g_free(files[i]);
+  free(files);
+  gtk_drag_finish(context, TRUE, FALSE, time);
 }
 
 gboolean drag_motion(GtkWidget * widget, GdkDragContext * context, gint x, gint y, guint time, gpointer user_data)
@@ -296,7 +946,18 @@ static void drop_down_menu_callback(gpointer data)
     {
       if(drop_down_menu_id < get_buffer_count() - 1)
 	{
-	  merge_buffers(mdata[drop_down_menu_id], mdata[drop_down_menu_id + 1]);
+	  map_data_t * info1 = buffer_store_info(buffers, drop_down_menu_id);
+	  map_data_t * info2 = buffer_store_info(buffers, drop_down_menu_id + 1);
+	  unsigned char copy[128 * 128];
+
+	  /* the lower map shows through in the colors of the upper one */
+	  memcpy(copy, buffer_store_data(buffers, drop_down_menu_id + 1), sizeof(copy));
+	  if(info2->palette != info1->palette)
+	    remap_map(copy, info2->palette, info1->palette);
+	  merge_buffers(buffer_store_data(buffers, drop_down_menu_id), copy);
+	  /* the merged map no longer comes from one image */
+	  buffer_store_set_source(buffers, drop_down_menu_id, NULL);
+	  sidepanel_mark_dirty(drop_down_menu_id);
 	  remove_buffer(drop_down_menu_id + 1);
 	  set_image();
 	}
@@ -305,9 +966,8 @@ static void drop_down_menu_callback(gpointer data)
     {
       if(drop_down_menu_id > 0)
 	{
-	  unsigned char * tmpdata = mdata[drop_down_menu_id];
-	  mdata[drop_down_menu_id] = mdata[drop_down_menu_id - 1];
-	  mdata[drop_down_menu_id - 1] = tmpdata;
+	  buffer_store_swap(buffers, drop_down_menu_id, drop_down_menu_id - 1);
+	  sidepanel_swap(drop_down_menu_id, drop_down_menu_id - 1);
 
 	  set_image();
 	}
@@ -316,9 +976,8 @@ static void drop_down_menu_callback(gpointer data)
     {
       if(drop_down_menu_id < get_buffer_count() - 1)
 	{
-	  unsigned char * tmpdata = mdata[drop_down_menu_id];
-	  mdata[drop_down_menu_id] = mdata[drop_down_menu_id + 1];
-	  mdata[drop_down_menu_id + 1] = tmpdata;
+	  buffer_store_swap(buffers, drop_down_menu_id, drop_down_menu_id + 1);
+	  sidepanel_swap(drop_down_menu_id, drop_down_menu_id + 1);
 
 	  set_image();
 	}
@@ -337,22 +996,22 @@ static void drop_down_menu_callback(gpointer data)
 
       GtkWidget * content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
       
-      sprintf(buffer, "%i", mdata_info[drop_down_menu_id].scale);
+      sprintf(buffer, "%i", buffer_store_info(buffers, drop_down_menu_id)->scale);
       GtkWidget * scale_entry = gtk_entry_new();
       gtk_entry_set_text(GTK_ENTRY(scale_entry), buffer);
       gtk_container_add(GTK_CONTAINER(content_area), scale_entry);
 
-      sprintf(buffer, "%i", mdata_info[drop_down_menu_id].xpos);
+      sprintf(buffer, "%i", buffer_store_info(buffers, drop_down_menu_id)->xpos);
       GtkWidget * xpos_entry = gtk_entry_new();
       gtk_entry_set_text(GTK_ENTRY(xpos_entry), buffer);
       gtk_container_add(GTK_CONTAINER(content_area), xpos_entry);
 
-      sprintf(buffer, "%i", mdata_info[drop_down_menu_id].zpos);
+      sprintf(buffer, "%i", buffer_store_info(buffers, drop_down_menu_id)->zpos);
       GtkWidget * zpos_entry = gtk_entry_new();
       gtk_entry_set_text(GTK_ENTRY(zpos_entry), buffer);
       gtk_container_add(GTK_CONTAINER(content_area), zpos_entry);
 
-      sprintf(buffer, "%i", mdata_info[drop_down_menu_id].dimension);
+      sprintf(buffer, "%i", buffer_store_info(buffers, drop_down_menu_id)->dimension);
       GtkWidget * dimension_entry = gtk_entry_new();
       gtk_entry_set_text(GTK_ENTRY(dimension_entry), buffer);
       gtk_container_add(GTK_CONTAINER(content_area), dimension_entry);
@@ -361,10 +1020,11 @@ static void drop_down_menu_callback(gpointer data)
 
       if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
 	{
-	  mdata_info[drop_down_menu_id].scale = atoi((char *)gtk_entry_get_text(GTK_ENTRY(scale_entry)));
-	  mdata_info[drop_down_menu_id].xpos = atoi((char *)gtk_entry_get_text(GTK_ENTRY(xpos_entry)));
-	  mdata_info[drop_down_menu_id].zpos = atoi((char *)gtk_entry_get_text(GTK_ENTRY(zpos_entry)));
-	  mdata_info[drop_down_menu_id].dimension = atoi((char *)gtk_entry_get_text(GTK_ENTRY(dimension_entry)));
+	  buffer_store_info(buffers, drop_down_menu_id)->scale = atoi((char *)gtk_entry_get_text(GTK_ENTRY(scale_entry)));
+	  buffer_store_info(buffers, drop_down_menu_id)->xpos = atoi((char *)gtk_entry_get_text(GTK_ENTRY(xpos_entry)));
+	  buffer_store_info(buffers, drop_down_menu_id)->zpos = atoi((char *)gtk_entry_get_text(GTK_ENTRY(zpos_entry)));
+	  buffer_store_info(buffers, drop_down_menu_id)->dimension = atoi((char *)gtk_entry_get_text(GTK_ENTRY(dimension_entry)));
+	  commit_history();
 	}
       gtk_widget_destroy(dialog);
     }
@@ -409,12 +1069,22 @@ void init_drop_down_menu()
   gtk_widget_show(item);
 }
 
-static gboolean buffer_callback(GtkWidget * event_box, GdkEventButton * event, gpointer data)
+static gboolean buffer_callback(GtkWidget * view, GdkEventButton * event, gpointer data)
 {
+  GtkTreePath * path;
+  int id;
+
+  if(!gtk_tree_view_get_path_at_pos(GTK_TREE_VIEW(view), event->x, event->y, &path, NULL, NULL, NULL))
+    return FALSE;
+  id = gtk_tree_path_get_indices(path)[0];
+  gtk_tree_path_free(path);
+
   if(event->button == 1)
     {
-      current_buffer = (size_t)data;
-      set_image();
+      /* only the selection changed, every thumbnail is still valid */
+      current_buffer = id;
+      update_image();
+      update_sidepanel();
     }
   else if(event->button == 3)
     {
@@ -423,91 +1093,191 @@ static gboolean buffer_callback(GtkWidget * event_box, GdkEventButton * event, g
       gtk_menu_popup(GTK_MENU(drop_down_menu), NULL, NULL, NULL, NULL,
 		     bevent->button, bevent->time);
 
-      drop_down_menu_id = (size_t)data;
+      drop_down_menu_id = id;
     }
   else
     return FALSE;
   return TRUE;
 }
 
+void sidepanel_mark_dirty(int id)
+{
+  buffer_store_touch(buffers, id);
+}
+
+void sidepanel_mark_all_dirty()
+{
+  int i;
+  for(i = 0; i < get_buffer_count(); i++)
+    buffer_store_touch(buffers, i);
+}
+
+/* Buffers a and b were swapped, their rows follow without being redrawn. */
+void sidepanel_swap(int a, int b)
+{
+  GtkTreeIter itera, iterb;
+
+  if(gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(thumbnail_store), &itera, NULL, a)
+     && gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(thumbnail_store), &iterb, NULL, b))
+    gtk_list_store_swap(thumbnail_store, &itera, &iterb);
+}
+
+/* Buffer id was removed, the rows below it move up. */
+void sidepanel_remove(int id)
+{
+  GtkTreeIter iter;
+
+  if(gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(thumbnail_store), &iter, NULL, id))
+    gtk_list_store_remove(thumbnail_store, &iter);
+}
+
+/* Brings the rows in line with the buffers. Every row remembers the handle
+   and version of the buffer its thumbnail was made from, so only changed
+   buffers are redrawn. The tree view only draws the rows that are
+   visible. */
 void update_sidepanel()
 {
+  int count = get_buffer_count();
+  int rows = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(thumbnail_store), NULL);
+  GtkTreeIter iter;
+  GtkTreePath * path;
   int i;
-  for(i = 0; i < BUFFER_COUNT; i++)
+
+  for(; rows > count; rows--)
     {
-      if(icons[i] != NULL)
+      gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(thumbnail_store), &iter, NULL, rows - 1);
+      gtk_list_store_remove(thumbnail_store, &iter);
+    }
+  for(; rows < count; rows++)
+    gtk_list_store_insert_with_values(thumbnail_store, &iter, -1, 1, -1, -1);
+
+  gtk_tree_model_get_iter_first(GTK_TREE_MODEL(thumbnail_store), &iter);
+  for(i = 0; i < count; i++, gtk_tree_model_iter_next(GTK_TREE_MODEL(thumbnail_store), &iter))
+    {
+      int handle;
+      guint version;
+
+      gtk_tree_model_get(GTK_TREE_MODEL(thumbnail_store), &iter, 1, &handle, 2, &version, -1);
+      if(handle == buffer_store_handle(buffers, i) && version == buffer_store_version(buffers, i))
+	continue;
+
+      GdkPixbuf * thumbnail = get_pixbuf_from_data(buffer_store_data(buffers, i), buffer_store_info(buffers, i)->palette, 0);
+      gtk_list_store_set(thumbnail_store, &iter, 0, thumbnail, 1, buffer_store_handle(buffers, i),
+			 2, buffer_store_version(buffers, i), -1);
+      g_object_unref(thumbnail);
+    }
+
+  if(current_buffer >= 0 && current_buffer < count)
+    {
+      path = gtk_tree_path_new_from_indices(current_buffer, -1);
+      gtk_tree_selection_select_path(gtk_tree_view_get_selection(GTK_TREE_VIEW(buffer_view)), path);
+      gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(buffer_view), path, NULL, FALSE, 0, 0);
+      gtk_tree_path_free(path);
+    }
+
+  update_memory_usage();
+}
+
+/* Paints the part of the main view inside the clip of cr straight from the
+   current buffer. The image is centered when the view is larger. */
+static void view_paint(GtkWidget * widget, cairo_t * cr)
+{
+  GtkAllocation allocation;
+  double x1, y1, x2, y2;
+  int size = 128 * view_mul / view_div;
+  int ox, oy, x, y, width, height;
+
+  gtk_widget_get_allocation(widget, &allocation);
+  ox = (allocation.width > size) ? (allocation.width - size) / 2 : 0;
+  oy = (allocation.height > size) ? (allocation.height - size) / 2 : 0;
+
+  if(!view_ready || buffer_store_data(buffers, current_buffer) == NULL)
+    {
+      if(start_image != NULL)
 	{
-	  gtk_widget_hide(icons[i]);
-	  gtk_widget_destroy(icons[i]);
-	  gtk_widget_hide(icon_event_boxes[i]);
-	  gtk_widget_destroy(icon_event_boxes[i]);
-	  icons[i] = NULL;
-	  icon_event_boxes[i] = NULL;
+	  gdk_cairo_set_source_pixbuf(cr, start_image,
+				      (allocation.width - gdk_pixbuf_get_width(start_image)) / 2,
+				      (allocation.height - gdk_pixbuf_get_height(start_image)) / 2);
+	  cairo_paint(cr);
 	}
+      return;
     }
 
-  for(i = 0; i < BUFFER_COUNT; i++)
+  cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+  x = MAX((int)floor(x1) - ox, 0);
+  y = MAX((int)floor(y1) - oy, 0);
+  width = MIN((int)ceil(x2) - ox, size) - x;
+  height = MIN((int)ceil(y2) - oy, size) - y;
+  if(width <= 0 || height <= 0)
+    return;
+
+  /* the surface only grows, once it covers the visible area scrolling and
+     zooming don't allocate */
+  if(view_surface == NULL || cairo_image_surface_get_width(view_surface) < width
+     || cairo_image_surface_get_height(view_surface) < height)
     {
-      if(mdata[i] != NULL)
+      int sw = width, sh = height;
+      if(view_surface != NULL)
 	{
-	  if(i == current_buffer)
-	    {
-	      if(selected_buffer_frame != NULL)
-		gtk_widget_destroy(selected_buffer_frame);
-	      selected_buffer_frame = gtk_frame_new(NULL);
-#ifdef GTK2
-	      GdkColor color;
+	  sw = MAX(sw, cairo_image_surface_get_width(view_surface));
+	  sh = MAX(sh, cairo_image_surface_get_height(view_surface));
+	  cairo_surface_destroy(view_surface);
+	}
+      view_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, sw, sh);
+    }
+
+  cairo_surface_flush(view_surface);
+  palette_expand_view(buffer_store_data(buffers, current_buffer), palette_argb(buffer_store_info(buffers, current_buffer)->palette),
+		      view_mul, view_div, x, y, width, height,
+		      (uint32_t *)cairo_image_surface_get_data(view_surface),
+		      cairo_image_surface_get_stride(view_surface) / 4);
+  cairo_surface_mark_dirty(view_surface);
+
+  cairo_set_source_surface(cr, view_surface, ox + x, oy + y);
+  cairo_rectangle(cr, ox + x, oy + y, width, height);
+  cairo_fill(cr);
+}
 
-	      gdk_color_parse("red", &color);
-	      gtk_widget_modify_bg(selected_buffer_frame, GTK_STATE_NORMAL, &color);
+#ifdef GTK2
+static gboolean view_expose(GtkWidget * widget, GdkEventExpose * event, gpointer data)
+{
+  cairo_t * cr = gdk_cairo_create(gtk_widget_get_window(widget));
+  cairo_rectangle(cr, event->area.x, event->area.y, event->area.width, event->area.height);
+  cairo_clip(cr);
+  view_paint(widget, cr);
+  cairo_destroy(cr);
+  return TRUE;
+}
 #else
-	      GdkRGBA color;
-	      
-	      gdk_rgba_parse(&color, "red");
-	      gtk_widget_override_background_color(selected_buffer_frame, GTK_STATE_NORMAL, &color);
+static gboolean view_draw(GtkWidget * widget, cairo_t * cr, gpointer data)
+{
+  view_paint(widget, cr);
+  return TRUE;
+}
 #endif
-	      gtk_box_pack_start(GTK_BOX(list_vbox), selected_buffer_frame, FALSE, TRUE, 1);
-	      
-	      icons[i] = gtk_image_new();
-	      icon_event_boxes[i] = gtk_event_box_new();
-	      
-	      gtk_image_set_from_pixbuf(GTK_IMAGE(icons[i]), get_pixbuf_from_data(mdata[i], 0));
-
-	      gtk_container_add(GTK_CONTAINER(selected_buffer_frame), icon_event_boxes[i]);
-	      gtk_container_add(GTK_CONTAINER(icon_event_boxes[i]), icons[i]);
-	      
-	      gtk_widget_show(icons[i]);
-	      gtk_widget_show(icon_event_boxes[i]);
-	      gtk_widget_show(selected_buffer_frame);
-	      
-	      g_signal_connect(G_OBJECT(icon_event_boxes[i]), "button_press_event", G_CALLBACK(buffer_callback), (gpointer *)(size_t)i);
-	    }
-	  else
-	    {
-	      icons[i] = gtk_image_new();
-	      icon_event_boxes[i] = gtk_event_box_new();
-	      
-	      gtk_image_set_from_pixbuf(GTK_IMAGE(icons[i]), get_pixbuf_from_data(mdata[i], 0));
-	      
-	      gtk_box_pack_start(GTK_BOX(list_vbox), icon_event_boxes[i], FALSE, TRUE, 2);
-	      gtk_container_add(GTK_CONTAINER(icon_event_boxes[i]), icons[i]);
-	      
-	      gtk_widget_show(icons[i]);
-	      gtk_widget_show(icon_event_boxes[i]);
-	      
-	      g_signal_connect(G_OBJECT(icon_event_boxes[i]), "button_press_event", G_CALLBACK(buffer_callback), (gpointer *)(size_t)i);
-	    }
-	}
-    }
+
+static void view_set_zoom(int mul, int div)
+{
+  view_mul = mul;
+  view_div = div;
+  gtk_widget_set_size_request(image, 128 * mul / div, 128 * mul / div);
+  gtk_widget_queue_draw(image);
 }
 
+static void update_image()
+{
+  view_ready = TRUE;
+  gtk_widget_queue_draw(image);
+}
+
+/* Shows the current buffer after it has been changed, and makes the
+   change one undo step. */
 void set_image()
 {	
-  GdkPixbuf * fdata = get_pixbuf_from_data(mdata[current_buffer], 1);
-  g_object_unref(dimage);
-  dimage = fdata;
-  gtk_image_set_from_pixbuf(GTK_IMAGE(image), fdata);
-  
+  sidepanel_mark_dirty(current_buffer);
+  if(history != NULL)
+    commit_history();
+  update_image();
   update_sidepanel();
 }
 
@@ -516,24 +1286,21 @@ void clipboard_callback(GtkClipboard * clipboard, GdkPixbuf * pixbuf, gpointer d
   if(pixbuf == NULL)
     return;
   
-  add_buffer();
-  if(gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox)))
-    generate_image_dithered_pixbuf(mdata[current_buffer], 128, 128, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), pixbuf, colors);
-  else
-    generate_image_pixbuf(mdata[current_buffer], 128, 128, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), pixbuf, colors);
-  set_image();
-}
+  unsigned char * source = malloc(128 * 128 * 4);
 
-void image_load_map(char * path)
-{
-  nbt_load_map(path, mdata[current_buffer]);
+  add_buffer();
+  generate_source_area(source, 128, 128, 0, 0, 128, 128, pixbuf);
+  generate_from_source(buffer_store_data(buffers, current_buffer), source,
+		       gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox)),
+		       gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), current_palette);
+  buffer_store_set_source(buffers, current_buffer, source);
   set_image();
 }
 
 void save_map(char * path)
 {
-  nbt_save_map(path, mdata_info[current_buffer].dimension, mdata_info[current_buffer].scale,
-	       128, 128, mdata_info[current_buffer].xpos, mdata_info[current_buffer].zpos, mdata[current_buffer]);
+  nbt_save_map(path, buffer_store_info(buffers, current_buffer)->dimension, buffer_store_info(buffers, current_buffer)->scale,
+	       128, 128, buffer_store_info(buffers, current_buffer)->xpos, buffer_store_info(buffers, current_buffer)->zpos, buffer_store_data(buffers, current_buffer));
 }
 
 static gboolean kill_window(GtkWidget * widget, GdkEvent * event, gpointer data)
@@ -557,68 +1324,255 @@ int srecmpend(char * end, char * str)
 
 int get_buffer_count()
 {
-  int i;
-  for(i = 0; i < BUFFER_COUNT; i++)
-    {
-      if(mdata[i] == NULL)
-	{
-	  return i;
-	}
-    }
-  return BUFFER_COUNT;
+  return buffer_store_count(buffers);
 }
 
 void add_buffer()
 {
-  current_buffer = get_buffer_count();
-  mdata[current_buffer] = (unsigned char *)malloc(128 * 128);
-  mdata_info[current_buffer].xpos = 13371337;
-  mdata_info[current_buffer].zpos = -13371337;
-  mdata_info[current_buffer].scale = 3;
-  mdata_info[current_buffer].dimension = 0;
+  current_buffer = buffer_store_add(buffers);
+  buffer_store_info(buffers, current_buffer)->xpos = 13371337;
+  buffer_store_info(buffers, current_buffer)->zpos = -13371337;
+  buffer_store_info(buffers, current_buffer)->scale = 3;
+  buffer_store_info(buffers, current_buffer)->dimension = 0;
+  buffer_store_info(buffers, current_buffer)->palette = current_palette;
 }
 
 void remove_buffer(int id)
 {
   if(get_buffer_count() == 1)
     return;
-  free(mdata[id]);
-  memmove(&(mdata[id]), &(mdata[id + 1]), (BUFFER_COUNT - id - 2) * sizeof(unsigned char *));
-  mdata[BUFFER_COUNT - 1] = NULL;
-  if(mdata[current_buffer] == NULL)
+  buffer_store_remove(buffers, id);
+  if(current_buffer >= get_buffer_count())
     current_buffer--;
   
-  memmove(&(mdata_info[id]), &(mdata_info[id + 1]), (BUFFER_COUNT - id - 2) * sizeof(map_data_t));
-  memset(&(mdata_info[BUFFER_COUNT - 1]), 0, sizeof(map_data_t));
+  sidepanel_remove(id);
   set_image();
 }
 
-char * custom_basename(char * path)
+char * custom_basename(char * path)
+{
+  char * tmp = path;
+  
+  while(*tmp != 0) tmp++;
+
+  while(tmp != path)
+    {
+      tmp--;
+      if(*tmp == '\\' || *tmp == '/')
+	{
+	  *tmp = 0;
+	  return tmp + 1;
+	}
+    }
+  return NULL;
+}
+
+typedef struct overview_view
+{
+  world_overview_t * overview;
+  GtkWidget * label;
+} overview_view_t;
+
+/* Shows the block coordinates under the pointer, to pick map centres with. */
+static gboolean overview_motion(GtkWidget * widget, GdkEventMotion * event, gpointer data)
+{
+  overview_view_t * view = (overview_view_t *)data;
+  int cx = view->overview->x + (int)event->x, cz = view->overview->z + (int)event->y;
+  char text[128];
+
+  sprintf(text, "chunk %i, %i  block %i, %i", cx, cz, cx * 16 + 8, cz * 16 + 8);
+  gtk_label_set_text(GTK_LABEL(view->label), text);
+  return TRUE;
+}
+
+typedef struct requantize_pass
+{
+  int dithered, yuv, palette;
+  unsigned char (* remap)[256]; /* by palette, for buffers without a source, or NULL */
+  int first; /* the position of the first buffer of this batch */
+  unsigned char * changed; /* one flag per buffer of the batch */
+} requantize_pass_t;
+
+/* buffers converted between two trims of the store */
+#define REQUANTIZE_BATCH 256
+
+static void requantize_range(int start, int end, void * user_data)
+{
+  requantize_pass_t * pass = (requantize_pass_t *)user_data;
+  int i, k;
+
+  for(i = start; i < end; i++)
+    {
+      unsigned char * data = buffer_store_data(buffers, pass->first + i);
+      unsigned char * source = buffer_store_source(buffers, pass->first + i);
+      map_data_t * info = buffer_store_info(buffers, pass->first + i);
+
+      pass->changed[i] = source != NULL || (pass->remap != NULL && info->palette != pass->palette);
+      if(source != NULL)
+	generate_from_source(data, source, pass->dithered, pass->yuv, pass->palette);
+      else if(pass->changed[i])
+	for(k = 0; k < 128 * 128; k++)
+	  data[k] = pass->remap[info->palette][data[k]];
+      if(pass->changed[i])
+	info->palette = pass->palette;
+    }
+}
+
+/* Converts every buffer that still has its source again with the current
+   settings, in parallel. The sources are already resampled and the
+   palette lookups cached, so this is quick enough to compare settings by
+   toggling them. With remap, the buffers without a source in another
+   palette have their indices mapped through the table of their palette.
+   Packed buffers are done a batch at a time so they don't all have to be
+   unpacked at once. */
+static void requantize_buffers(unsigned char (* remap)[256])
+{
+  unsigned char changed[REQUANTIZE_BATCH];
+  requantize_pass_t pass;
+  int i;
+
+  pass.dithered = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox));
+  pass.yuv = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox));
+  pass.palette = current_palette;
+  pass.remap = remap;
+  pass.changed = changed;
+
+  for(pass.first = 0; pass.first < get_buffer_count(); pass.first += REQUANTIZE_BATCH)
+    {
+      int count = MIN(get_buffer_count() - pass.first, REQUANTIZE_BATCH);
+
+      parallel_for(count, 1, requantize_range, &pass);
+      for(i = 0; i < count; i++)
+	if(changed[i])
+	  buffer_store_touch(buffers, pass.first + i);
+      buffer_store_trim(buffers, current_buffer);
+    }
+}
+
+static void conversion_setting_toggle(gpointer data)
+{
+  requantize_buffers(NULL);
+  set_image();
+}
+
+/* Switches the palette of the Palette menu, every buffer is converted to
+   the new one in a single pass. */
+static void palette_item_toggle(GtkWidget * item, gpointer data)
+{
+  unsigned char remap[PALETTES][256];
+  int i;
+
+  if(!gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(item)) || (int)(size_t)data == current_palette)
+    return;
+  current_palette = (int)(size_t)data;
+
+  for(i = 0; i < PALETTES; i++)
+    remap_table(i, current_palette, remap[i]);
+  requantize_buffers(remap);
+  sidepanel_mark_all_dirty();
+  set_image();
+}
+
+/* Starts recording a timeline, or stops and asks where to save it. */
+static void trace_checkbox_toggle(gpointer data)
+{
+  GtkWidget * dialog;
+
+  if(gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(trace_checkbox)))
+    {
+      trace_enable();
+      trace_name_thread("main");
+      return;
+    }
+
+  trace_disable();
+  dialog = gtk_file_chooser_dialog_new("Save Trace",
+				       GTK_WINDOW(window),
+				       GTK_FILE_CHOOSER_ACTION_SAVE,
+				       _("_Cancel"), GTK_RESPONSE_CANCEL,
+				       _("_Save"), GTK_RESPONSE_ACCEPT,
+				       NULL);
+  gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+  gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "trace.json");
+
+  if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+    {
+      char * file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+      if(trace_write_json(file) != 0)
+	information("Could not write the trace!");
+      g_free(file);
+    }
+  gtk_widget_destroy(dialog);
+}
+
+/* Asks for count numbers in one dialog, values holds the defaults and
+   gets the answers. Returns FALSE if the dialog was closed. */
+static gboolean ask_numbers(const char * title, const char ** labels, int * values, int count)
 {
-  char * tmp = path;
-  
-  while(*tmp != 0) tmp++;
+  GtkWidget * dialog = gtk_dialog_new_with_buttons(title,
+						   GTK_WINDOW(window),
+						   GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+						   _("_OK"),
+						   GTK_RESPONSE_ACCEPT, NULL);
+  GtkWidget * content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+  GtkWidget ** entries = malloc(count * sizeof(GtkWidget *));
+  gboolean accepted;
+  char text[32];
+  int i;
 
-  while(tmp != path)
+  for(i = 0; i < count; i++)
     {
-      tmp--;
-      if(*tmp == '\\' || *tmp == '/')
-	{
-	  *tmp = 0;
-	  return tmp + 1;
-	}
+      GtkWidget * hbox;
+#ifdef GTK2
+      hbox = gtk_hbox_new(FALSE, 0);
+#else
+      hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+#endif
+      entries[i] = gtk_entry_new();
+      sprintf(text, "%i", values[i]);
+      gtk_entry_set_text(GTK_ENTRY(entries[i]), text);
+      gtk_container_add(GTK_CONTAINER(hbox), entries[i]);
+      gtk_container_add(GTK_CONTAINER(hbox), gtk_label_new(labels[i]));
+      gtk_container_add(GTK_CONTAINER(content_area), hbox);
     }
-  return NULL;
+
+  gtk_widget_show_all(dialog);
+
+  accepted = gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT;
+  if(accepted)
+    for(i = 0; i < count; i++)
+      values[i] = atoi((char *)gtk_entry_get_text(GTK_ENTRY(entries[i])));
+  free(entries);
+  gtk_widget_destroy(dialog);
+  return accepted;
 }
 
-static void old_colors_checkbox_toggle(gpointer data)
+#define STATISTICS_RESET 1
+
+/* One row per stage that ran, for the Statistics dialog. */
+static void fill_statistics(GtkListStore * store)
 {
-  old_colors = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(old_colors_checkbox));
-  if(old_colors)
-    colors = oldcolors;
-  else
-    colors = newcolors;
-  set_image();
+  stats_entry_t entries[STATS_STAGES];
+  GtkTreeIter iter;
+  char calls[32], total[32], wall[32], size[32], items[32], each[32];
+  int i;
+
+  stats_get(entries);
+  gtk_list_store_clear(store);
+  for(i = 0; i < STATS_STAGES; i++)
+    {
+      if(entries[i].calls == 0)
+	continue;
+      sprintf(calls, "%" G_GINT64_FORMAT, entries[i].calls);
+      sprintf(total, "%.1f", entries[i].time / 1000.0);
+      sprintf(wall, "%.1f", (entries[i].last - entries[i].first) / 1000.0);
+      sprintf(size, "%.2f", entries[i].bytes / (1024.0 * 1024.0));
+      sprintf(items, "%" G_GINT64_FORMAT, entries[i].items);
+      sprintf(each, "%.3f", entries[i].items ? (double)entries[i].time / entries[i].items : 0.0);
+      gtk_list_store_append(store, &iter);
+      gtk_list_store_set(store, &iter, 0, stats_stage_name(i), 1, calls, 2, total, 3, wall,
+			 4, size, 5, items, 6, each, -1);
+    }
 }
 
 static void button_click(gpointer data)
@@ -633,39 +1587,19 @@ static void button_click(gpointer data)
 					   _("_Open"), GTK_RESPONSE_ACCEPT,
 					   NULL);
       
+      gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
+
       if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
 	{
-	  char * file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-	  
-	  if(srecmpend(".dat", file) == 0)
-	    {
-	      add_buffer();
-	      image_load_map(file);
-	    }
-	  else if(srecmpend(".bmp", file) == 0 || srecmpend(".png", file) == 0 || srecmpend(".jpg", file) == 0 || srecmpend(".jpeg", file) == 0 || srecmpend(".gif", file) == 0)
-	    {
-	      GError * err = NULL;
-	      add_buffer();
-	      if(gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox)))
-		generate_image_dithered(mdata[current_buffer], 128, 128,gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)),  file, colors, &err);
-	      else
-		generate_image(mdata[current_buffer], 128, 128, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), file, colors, &err);
-	      if(err != NULL)
-		{
-		  information("Error while loading image file!");
-		  printf("%s\n", err->message);
-		  g_error_free(err);
-		}
-	      set_image();
-	    }
-	  else if(srecmpend(".imtm", file) == 0)
-	    {
-	      add_buffer();
-	      load_raw_map(file, mdata[current_buffer]);
-	      set_image();
-	    }
-	  else
-	    information("File format not supported!");
+	  GSList * list = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(dialog)), * item;
+	  char ** files = malloc(g_slist_length(list) * sizeof(char *));
+	  int count = 0;
+
+	  for(item = list; item != NULL; item = item->next)
+	    files[count++] = (char *)item->data;
+	  import_files(files, count);
+	  free(files);
+	  g_slist_free_full(list, g_free);
 	}
       gtk_widget_destroy(dialog);
     }
@@ -685,10 +1619,7 @@ static void button_click(gpointer data)
 	  
 	  if(srecmpend(".bmp", file) == 0 || srecmpend(".png", file) == 0 || srecmpend(".jpg", file) == 0 || srecmpend(".jpeg", file) == 0 || srecmpend(".gif", file) == 0)
 	    {
-	      GError * err = NULL;
 	      int width = 1, height = 1;
-	      int i, j;
-	      int pi, pj;
 
 	      {
 		GtkWidget * dialog = gtk_dialog_new_with_buttons("Split Image",
@@ -734,47 +1665,54 @@ static void button_click(gpointer data)
 		  }
 		gtk_widget_destroy(dialog);
 	      }
-	      unsigned char tmp_buffer[width * height * 128 * 128];
-
-	      if(gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox)))
-		generate_image_dithered(tmp_buffer, width * 128, height * 128, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), file, colors, &err);
-	      else
-		generate_image(tmp_buffer, width * 128, height * 128, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox)), file, colors, &err);
-	      if(err != NULL)
-		{
-		  information("Error while loading image file!");
-		  printf("%s\n", err->message);
-		  g_error_free(err);
-		}
-
-	      for(i = 0; i < width; i++)
-		for(j = 0; j < height; j++)
-		  {
-		    add_buffer();
-
-		    for(pi = 0; pi < 128; pi++)
-		      for(pj = 0; pj < 128; pj++)
-			{
-			  int buffer_i, buffer_j;
-
-			  buffer_i = i * 128 + pi;
-			  buffer_j = j * 128 + pj;
+	      if(width > 0 && height > 0)
+		convert_image_file(file, width, height);
+	    }
+	  else
+	    information("File format not supported!");
+	}
+      gtk_widget_destroy(dialog);
+    }
+  else if((size_t)data == ITEM_SIGNAL_OPEN_ANIMATION)
+    {
+      GtkWidget * dialog;
+      dialog = gtk_file_chooser_dialog_new("Open Animation",
+					   GTK_WINDOW(window),
+					   GTK_FILE_CHOOSER_ACTION_OPEN,
+					   _("_Cancel"), GTK_RESPONSE_CANCEL,
+					   _("_Open"), GTK_RESPONSE_ACCEPT,
+					   NULL);
 
-			  mdata[current_buffer][pi + pj * 128] =
-			    tmp_buffer[buffer_i + (width * 128) * buffer_j];
-			}
-		  }
+      if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+	{
+	  const char * labels[] = {"width", "height"};
+	  int values[2] = {1, 1};
+	  char * file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 
-	      set_image();
+	  if(ask_numbers("Split Animation", labels, values, 2) && values[0] > 0 && values[1] > 0)
+	    {
+	      animation_request_t * request = malloc(sizeof(animation_request_t));
+	      char name[256];
+
+	      request->file = file;
+	      request->width = values[0];
+	      request->height = values[1];
+	      request->dithered = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(FSD_checkbox));
+	      request->yuv = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(YUV_checkbox));
+	      request->palette = current_palette;
+	      request->animation = NULL;
+	      request->error = NULL;
+	      snprintf(name, sizeof(name), "Converting %s", file);
+	      start_job(name, animation_run, animation_done, request);
 	    }
 	  else
-	    information("File format not supported!");
+	    g_free(file);
 	}
       gtk_widget_destroy(dialog);
     }
   else if((size_t)data == ITEM_SIGNAL_SAVE)
     {
-      if(mdata[current_buffer] == NULL)
+      if(buffer_store_data(buffers, current_buffer) == NULL)
 	return;
       
       GtkWidget * dialog;
@@ -807,7 +1745,7 @@ static void button_click(gpointer data)
       int i = 0;
       char * tmp = last_file;
       char * basename_s, * dirname_s;
-      if(mdata[current_buffer] == NULL)
+      if(buffer_store_data(buffers, current_buffer) == NULL)
 	return;
 
       basename_s = custom_basename(tmp);
@@ -838,7 +1776,6 @@ static void button_click(gpointer data)
     }
   else if((size_t)data == ITEM_SIGNAL_SAVE_ALL)
     {
-      int old_current_buffer = current_buffer;
       GtkWidget * dialog;
 
       int i = 0;
@@ -890,25 +1827,32 @@ static void button_click(gpointer data)
       tmp += 4;
       i = strtol(tmp, &tmp, 10);
 
-      /* Saves all the buffers */
-      for (current_buffer = 0; current_buffer < BUFFER_COUNT; current_buffer++) {
-	if(mdata[current_buffer] == NULL)
-	  break;
+      /* Saves copies of all the buffers in the background */
+      save_request_t * request = malloc(sizeof(save_request_t));
+      int k;
+
+      request->dirname = dirname_s;
+      request->first = i;
+      request->count = get_buffer_count();
+      request->data = malloc(request->count * 128 * 128);
+      request->info = malloc(request->count * sizeof(map_data_t));
+      for(k = 0; k < request->count; k++)
+	{
+	  memcpy(&(request->data[k * 128 * 128]), buffer_store_data(buffers, k), 128 * 128);
+	  request->info[k] = *buffer_store_info(buffers, k);
+	  buffer_store_trim(buffers, current_buffer);
+	}
+
 #ifdef OS_LINUX
-	sprintf(last_file, "%s/map_%i.dat", dirname_s, i);
+      sprintf(last_file, "%s/map_%i.dat", dirname_s, i + request->count - 1);
 #else
-	sprintf(last_file, "%s\\map_%i.dat", dirname_s, i);
+      sprintf(last_file, "%s\\map_%i.dat", dirname_s, i + request->count - 1);
 #endif
-	save_map(last_file);
-	i++;
-      }
-      /* Restores the selection to the right buffer and frees the allocated memory */
-      current_buffer = old_current_buffer;
-      free(dirname_s);
+      start_job("Saving all maps", save_all_run, save_all_done, request);
     }
   else if((size_t)data == ITEM_SIGNAL_EXPORT_IMAGE)
     {
-      if(mdata[current_buffer] == NULL)
+      if(buffer_store_data(buffers, current_buffer) == NULL)
 	return;
       
       GtkWidget * dialog;
@@ -928,29 +1872,8 @@ static void button_click(gpointer data)
 	  char * file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 	  printf("%s\n", file);
 	  
-	  unsigned char * data = malloc(128 * 128 * 3);
-	  int i;
-	  for(i = 0; i < 128 * 128; i++)
-	    {
-	      if(mdata[current_buffer][i] > 3)
-		{
-		  data[i * 3] = colors[mdata[current_buffer][i]].r;
-		  data[i * 3 + 1] = colors[mdata[current_buffer][i]].g;
-		  data[i * 3 + 2] = colors[mdata[current_buffer][i]].b;
-		}
-	      else
-		{
-		  int x = i % 128, y = i / 128;
-		  x /= 4;
-		  y /= 4;
-		  data[i * 3] = ((x + (y % 2)) % 2) ? 0xFF : 0xAA;
-		  data[i * 3 + 1] = ((x + (y % 2)) % 2) ? 0xFF : 0xAA;
-		  data[i * 3 + 2] = ((x + (y % 2)) % 2) ? 0xFF : 0xAA;
-		}
-	    }
-	  
-	  GdkPixbuf * spixbuf = image_from_data(data, 0);
-	  free(data);
+	  GdkPixbuf * spixbuf = get_pixbuf_from_data(buffer_store_data(buffers, current_buffer),
+						     buffer_store_info(buffers, current_buffer)->palette, 0);
 	  
 	  GError * err = NULL;
 	  
@@ -966,9 +1889,59 @@ static void button_click(gpointer data)
 	}
       gtk_widget_destroy(dialog);
     }
+  else if((size_t)data == ITEM_SIGNAL_EXPORT_ATLAS)
+    {
+      const char * labels[] = {"columns", "rows", "first buffer", "compression (0-9)"};
+      int values[4];
+      GtkWidget * dialog;
+
+      values[0] = (int)ceil(sqrt(get_buffer_count()));
+      values[1] = (get_buffer_count() + values[0] - 1) / values[0];
+      values[2] = 0;
+      values[3] = 6;
+      if(!ask_numbers("Export Atlas", labels, values, 4))
+	return;
+      if(values[0] < 1 || values[1] < 1 || values[2] < 0 || values[2] >= get_buffer_count())
+	return;
+
+      dialog = gtk_file_chooser_dialog_new("Export Atlas",
+					   GTK_WINDOW(window),
+					   GTK_FILE_CHOOSER_ACTION_SAVE,
+					   _("_Cancel"), GTK_RESPONSE_CANCEL,
+					   _("_Save"), GTK_RESPONSE_ACCEPT,
+					   NULL);
+      gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+      gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "atlas.png");
+
+      if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+	start_map_export(gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog)), values[2],
+			 MIN(values[0] * values[1], get_buffer_count() - values[2]), values[0], values[3]);
+      gtk_widget_destroy(dialog);
+    }
+  else if((size_t)data == ITEM_SIGNAL_EXPORT_ALL_IMAGES)
+    {
+      const char * labels[] = {"compression (0-9)"};
+      int level = 6;
+      GtkWidget * dialog;
+
+      if(!ask_numbers("Export All Images", labels, &level, 1))
+	return;
+
+      dialog = gtk_file_chooser_dialog_new("Export All Images",
+					   GTK_WINDOW(window),
+					   GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+					   _("_Cancel"), GTK_RESPONSE_CANCEL,
+					   _("_Open"), GTK_RESPONSE_ACCEPT,
+					   NULL);
+
+      if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+	start_map_export(gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog)), 0,
+			 get_buffer_count(), 0, level);
+      gtk_widget_destroy(dialog);
+    }
   else if((size_t)data == ITEM_SIGNAL_SAVE_RM)
     {
-      if(mdata == NULL)
+      if(buffer_store_data(buffers, current_buffer) == NULL)
 	return;
       
       GtkWidget * dialog;
@@ -987,32 +1960,32 @@ static void button_click(gpointer data)
 	{
 	  char * file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 	  printf("%s\n", file);
-	  save_raw_map(file, mdata[current_buffer]);
+	  save_raw_map(file, buffer_store_data(buffers, current_buffer));
 	}
       gtk_widget_destroy(dialog);
     }
   else if((size_t)data == ITEM_SIGNAL_GENERATE_PALETTE)
     {
       add_buffer();
-      generate_palette(mdata[current_buffer]);
+      generate_palette(buffer_store_data(buffers, current_buffer), palettes[current_palette].count);
       set_image();
     }
   else if((size_t)data == ITEM_SIGNAL_GENERATE_RANDOM_NOISE)
     {
       add_buffer();
-      generate_random_noise(mdata[current_buffer]);
+      generate_random_noise(buffer_store_data(buffers, current_buffer), palettes[current_palette].count);
       set_image();
     }
   else if((size_t)data == ITEM_SIGNAL_GENERATE_MANDELBROT)
     {
       add_buffer();
-      generate_mandelbrot(mdata[current_buffer]);
+      generate_mandelbrot(buffer_store_data(buffers, current_buffer), palettes[current_palette].count);
       set_image();
     }
   else if((size_t)data == ITEM_SIGNAL_GENERATE_JULIA)
     {
       add_buffer();
-      generate_julia(mdata[current_buffer], 0.5, 0.5);
+      generate_julia(buffer_store_data(buffers, current_buffer), palettes[current_palette].count, 0.5, 0.5);
       set_image();
     }
   else if((size_t)data == ITEM_SIGNAL_GENERATE_FROM_CLIPBOARD)
@@ -1049,6 +2022,12 @@ static void button_click(gpointer data)
       gtk_entry_set_text(GTK_ENTRY(directory_entry), MINECRAFT_PATH);
       gtk_container_add(GTK_CONTAINER(content_area), directory_entry);
 
+      /* off by default, the cached levels can differ from a direct render in
+	 mixed areas */
+      GtkWidget * cache_check = gtk_check_button_new_with_label("Use scale pyramid cache (faster, may differ slightly)");
+      gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(cache_check), FALSE);
+      gtk_container_add(GTK_CONTAINER(content_area), cache_check);
+
       gtk_widget_show_all(dialog);
 
       if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
@@ -1057,28 +2036,288 @@ static void button_click(gpointer data)
 	  char * path = (char *)gtk_entry_get_text(GTK_ENTRY(directory_entry));
 	  int x = atoi((char *)gtk_entry_get_text(GTK_ENTRY(xpos_entry)));
 	  int z = atoi((char *)gtk_entry_get_text(GTK_ENTRY(zpos_entry)));
-	  int rs = pow(2, scale) * 128;
-	  block_info_t * blocks = read_region_files(path, x - (rs / 2), z - (rs / 2),
-						    rs, rs);
-	  add_buffer();
-	  render_map(blocks, mdata[current_buffer], scale);
-	  free(blocks);
+	  render_request_t * request;
+	  pyramid_t * pyramid = NULL;
 
-	  mdata_info[current_buffer].scale = scale;
-	  mdata_info[current_buffer].xpos = x;
-	  mdata_info[current_buffer].zpos = z;
-	  mdata_info[current_buffer].dimension = 0;
-	  set_image();
+	  if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(cache_check)))
+	    {
+	      /* one cache per world, keyed by the region directory */
+	      gchar * hash = g_compute_checksum_for_string(G_CHECKSUM_MD5, path, -1);
+	      gchar * cachedir = g_build_filename(g_get_user_cache_dir(), "imagetomap", "pyramid", hash, NULL);
+	      pyramid = pyramid_open(path, cachedir);
+	      g_free(cachedir);
+	      g_free(hash);
+	    }
+
+	  request = malloc(sizeof(render_request_t));
+	  request->path = g_strdup(path);
+	  request->pyramid = pyramid;
+	  request->x = x;
+	  request->z = z;
+	  request->scale = scale;
+	  start_job("Rendering world", render_world_run, render_world_done, request);
 	}
       gtk_widget_destroy(dialog);
     }
+  else if((size_t)data == ITEM_SIGNAL_EXPORT_WORLD_IMAGE)
+    {
+      const char * labels[] = {"scale", "x", "z", "width", "height"};
+      const char * defaults[] = {"0", "-1024", "-1024", "2048", "2048"};
+      GtkWidget * entries[5];
+      int i;
+
+      GtkWidget * dialog = gtk_dialog_new_with_buttons("Export World Image",
+						       GTK_WINDOW(window),
+						       GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+						       _("_OK"),
+						       GTK_RESPONSE_ACCEPT,
+						       _("_Cancel"),
+						       GTK_RESPONSE_REJECT, NULL);
+
+      GtkWidget * content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+
+      for(i = 0; i < 5; i++)
+	{
+	  GtkWidget * hbox;
+#ifdef GTK2
+	  hbox = gtk_hbox_new(FALSE, 0);
+#else
+	  hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+#endif
+	  entries[i] = gtk_entry_new();
+	  gtk_entry_set_text(GTK_ENTRY(entries[i]), defaults[i]);
+	  gtk_container_add(GTK_CONTAINER(hbox), entries[i]);
+	  gtk_container_add(GTK_CONTAINER(hbox), gtk_label_new(labels[i]));
+	  gtk_container_add(GTK_CONTAINER(content_area), hbox);
+	}
+
+      GtkWidget * directory_entry = gtk_entry_new();
+      gtk_entry_set_text(GTK_ENTRY(directory_entry), MINECRAFT_PATH);
+      gtk_container_add(GTK_CONTAINER(content_area), directory_entry);
+
+      gtk_widget_show_all(dialog);
+
+      if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+	{
+	  int values[5];
+	  char * path = g_strdup(gtk_entry_get_text(GTK_ENTRY(directory_entry)));
+	  GtkWidget * file_dialog;
+
+	  for(i = 0; i < 5; i++)
+	    values[i] = atoi((char *)gtk_entry_get_text(GTK_ENTRY(entries[i])));
+	  gtk_widget_destroy(dialog);
+	  dialog = NULL;
+
+	  file_dialog = gtk_file_chooser_dialog_new("Export World Image",
+						    GTK_WINDOW(window),
+						    GTK_FILE_CHOOSER_ACTION_SAVE,
+						    _("_Cancel"), GTK_RESPONSE_CANCEL,
+						    _("_Save"), GTK_RESPONSE_ACCEPT,
+						    NULL);
+	  gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(file_dialog), TRUE);
+	  gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(file_dialog), "world.png");
+
+	  if(gtk_dialog_run(GTK_DIALOG(file_dialog)) == GTK_RESPONSE_ACCEPT)
+	    {
+	      export_request_t * request = malloc(sizeof(export_request_t));
+
+	      request->path = path;
+	      request->file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_dialog));
+	      request->scale = values[0];
+	      request->x = values[1];
+	      request->z = values[2];
+	      request->width = values[3];
+	      request->height = values[4];
+	      request->colors = palettes[current_palette].colors;
+	      request->ret = 0;
+	      path = NULL;
+	      start_job("Exporting world image", export_world_run, export_world_done, request);
+	    }
+	  gtk_widget_destroy(file_dialog);
+	  g_free(path);
+	}
+      if(dialog != NULL)
+	gtk_widget_destroy(dialog);
+    }
+  else if((size_t)data == ITEM_SIGNAL_WORLD_OVERVIEW)
+    {
+      GtkWidget * dialog = gtk_dialog_new_with_buttons("World Overview",
+						       GTK_WINDOW(window),
+						       GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+						       _("_OK"),
+						       GTK_RESPONSE_ACCEPT,
+						       _("_Cancel"),
+						       GTK_RESPONSE_REJECT, NULL);
+
+      GtkWidget * content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+      GtkWidget * directory_entry = gtk_entry_new();
+      gtk_entry_set_text(GTK_ENTRY(directory_entry), MINECRAFT_PATH);
+      gtk_container_add(GTK_CONTAINER(content_area), directory_entry);
+
+      GtkWidget * shade_check = gtk_check_button_new_with_label("Shade from HeightMap (reads every chunk)");
+      gtk_container_add(GTK_CONTAINER(content_area), shade_check);
+
+      gtk_widget_show_all(dialog);
+
+      if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+	{
+	  char * path = g_strdup(gtk_entry_get_text(GTK_ENTRY(directory_entry)));
+	  int shaded = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(shade_check));
+	  overview_view_t view;
+
+	  gtk_widget_destroy(dialog);
+	  dialog = NULL;
+
+	  view.overview = world_overview_scan(path);
+	  if(view.overview == NULL)
+	    information("No region files found, or they span too large an area!");
+	  else
+	    {
+	      GdkPixbuf * pixbuf;
+	      GtkWidget * sc, * event_box, * overview_image;
+	      char text[128];
+	      int j;
+
+	      if(shaded && world_overview_read_heights(view.overview, path) != 0)
+		{
+		  information("Not enough memory for the heights, showing chunk ages instead.");
+		  shaded = 0;
+		}
+
+	      pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, view.overview->width, view.overview->height);
+	      for(j = 0; j < view.overview->height; j++)
+		world_overview_render_row(view.overview, j, shaded,
+					  gdk_pixbuf_get_pixels(pixbuf) + j * gdk_pixbuf_get_rowstride(pixbuf));
+
+	      dialog = gtk_dialog_new_with_buttons("World Overview",
+						   GTK_WINDOW(window),
+						   GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+						   _("_Close"),
+						   GTK_RESPONSE_ACCEPT, NULL);
+	      content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+
+	      sprintf(text, "%i chunks in %i regions", view.overview->chunk_count, view.overview->region_count);
+	      view.label = gtk_label_new(text);
+	      gtk_container_add(GTK_CONTAINER(content_area), view.label);
+
+	      sc = gtk_scrolled_window_new(NULL, NULL);
+	      gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(sc), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	      gtk_widget_set_size_request(sc, 512, 512);
+	      event_box = gtk_event_box_new();
+	      overview_image = gtk_image_new_from_pixbuf(pixbuf);
+	      gtk_container_add(GTK_CONTAINER(event_box), overview_image);
+#ifdef GTK2
+	      gtk_scrolled_window_add_with_viewport(GTK_SCROLLED_WINDOW(sc), event_box);
+#else
+	      gtk_container_add(GTK_CONTAINER(sc), event_box);
+#endif
+	      gtk_container_add(GTK_CONTAINER(content_area), sc);
+
+	      gtk_widget_add_events(event_box, GDK_POINTER_MOTION_MASK);
+	      g_signal_connect(G_OBJECT(event_box), "motion_notify_event", G_CALLBACK(overview_motion), &view);
+
+	      gtk_widget_show_all(dialog);
+	      gtk_dialog_run(GTK_DIALOG(dialog));
+
+	      g_object_unref(pixbuf);
+	      world_overview_free(view.overview);
+	    }
+	  g_free(path);
+	}
+      if(dialog != NULL)
+	gtk_widget_destroy(dialog);
+    }
   else if((size_t)data == ITEM_SIGNAL_CLEAN)
     {
-      while(mdata[1] != NULL)
+      /* one undo step for the whole list, not one per buffer */
+      while(get_buffer_count() > 1)
+	{
+	  buffer_store_remove(buffers, 0);
+	  sidepanel_remove(0);
+	}
+      current_buffer = 0;
+      set_image();
+    }
+  else if((size_t)data == ITEM_SIGNAL_UNDO || (size_t)data == ITEM_SIGNAL_REDO)
+    {
+      if(((size_t)data == ITEM_SIGNAL_UNDO ? history_undo(history) : history_redo(history)) != 0)
+	return;
+      if(current_buffer >= get_buffer_count())
+	current_buffer = get_buffer_count() - 1;
+      update_image();
+      update_sidepanel();
+    }
+  else if((size_t)data == ITEM_SIGNAL_MEMORY_BUDGET)
+    {
+      GtkWidget * dialog = gtk_dialog_new_with_buttons("Memory Budget",
+						       GTK_WINDOW(window),
+						       GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+						       _("_OK"),
+						       GTK_RESPONSE_ACCEPT, NULL);
+      GtkWidget * content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+      GtkWidget * hbox, * label, * budget_entry;
+      char text[32];
+
+#ifdef GTK2
+      hbox = gtk_hbox_new(FALSE, 0);
+#else
+      hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+#endif
+      label = gtk_label_new("MB of unpacked maps, 0 for no limit");
+      budget_entry = gtk_entry_new();
+      sprintf(text, "%i", config->buffer_budget);
+      gtk_entry_set_text(GTK_ENTRY(budget_entry), text);
+      gtk_container_add(GTK_CONTAINER(hbox), budget_entry);
+      gtk_container_add(GTK_CONTAINER(hbox), label);
+      gtk_container_add(GTK_CONTAINER(content_area), hbox);
+
+      gtk_widget_show_all(dialog);
+
+      if(gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+	{
+	  int budget = atoi((char *)gtk_entry_get_text(GTK_ENTRY(budget_entry)));
+	  if(budget >= 0)
+	    {
+	      config->buffer_budget = budget;
+	      buffer_store_set_budget(buffers, (size_t)budget * 1024 * 1024);
+	      update_memory_usage();
+	    }
+	}
+      gtk_widget_destroy(dialog);
+    }
+  else if((size_t)data == ITEM_SIGNAL_STATISTICS)
+    {
+      const char * titles[] = {"Stage", "Calls", "Time (ms)", "Wall (ms)", "MB", "Items", "µs per item"};
+      GtkWidget * dialog = gtk_dialog_new_with_buttons("Statistics",
+						       GTK_WINDOW(window),
+						       GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+						       _("_Reset"),
+						       STATISTICS_RESET,
+						       _("_Close"),
+						       GTK_RESPONSE_ACCEPT, NULL);
+      GtkWidget * content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+      GtkListStore * store = gtk_list_store_new(7, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+						G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+      GtkWidget * view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
+      int i;
+
+      for(i = 0; i < 7; i++)
+	gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, titles[i],
+						    gtk_cell_renderer_text_new(), "text", i, NULL);
+      gtk_container_add(GTK_CONTAINER(content_area),
+			gtk_label_new("Time is summed over all threads, wall is from the first start to the last end"));
+      gtk_container_add(GTK_CONTAINER(content_area), view);
+      gtk_widget_show_all(dialog);
+
+      fill_statistics(store);
+      while(gtk_dialog_run(GTK_DIALOG(dialog)) == STATISTICS_RESET)
 	{
-	  remove_buffer(0);
+	  stats_reset();
+	  fill_statistics(store);
 	}
-      /* set_image(); */
+
+      g_object_unref(store);
+      gtk_widget_destroy(dialog);
     }
   else if((size_t)data == ITEM_SIGNAL_QUIT)
     {
@@ -1088,35 +2327,27 @@ static void button_click(gpointer data)
     printf("Unhandeled button press: %i\n", (int)(size_t)data);
 }
 
+/* Zooms step through whole multiples and fractions of the map size, so
+   every screen pixel maps to exactly one map pixel. */
 static void button_click2(GtkWidget * widget, gpointer data)
 {
   if(strcmp("button.zoomp", (char *)data) == 0)
     {
-      GdkPixbuf * pixbuf = gtk_image_get_pixbuf(GTK_IMAGE(image));
-      double h = gdk_pixbuf_get_height(pixbuf), w = gdk_pixbuf_get_width(pixbuf);
-      if(h < config->maxzoom || w < config->maxzoom)
-	{
-	  GdkPixbuf * rpixbuf = gdk_pixbuf_scale_simple(dimage, h * config->zooms, w * config->zooms, config->interp);
-	  gtk_image_set_from_pixbuf(GTK_IMAGE(image), rpixbuf);
-	  g_object_unref(rpixbuf);
-	}
+      if(view_div > 1)
+	view_set_zoom(1, view_div - 1);
+      else if(128 * (view_mul + 1) <= config->maxzoom)
+	view_set_zoom(MIN(MAX(view_mul + 1, (int)(view_mul * config->zooms)), config->maxzoom / 128), 1);
     }
   else if(strcmp("button.zoomm", (char *)data) == 0)
     {
-      GdkPixbuf * pixbuf = gtk_image_get_pixbuf(GTK_IMAGE(image));
-      double h = gdk_pixbuf_get_height(pixbuf), w = gdk_pixbuf_get_width(pixbuf);
-      if(h > config->minzoom || w > config->minzoom)
-	{
-	  GdkPixbuf * rpixbuf = gdk_pixbuf_scale_simple(dimage, h / config->zooms, w / config->zooms, config->interp);
-	  gtk_image_set_from_pixbuf(GTK_IMAGE(image), rpixbuf);
-	  g_object_unref(rpixbuf);
-	}
+      if(view_mul > 1)
+	view_set_zoom(MAX(MIN(view_mul - 1, (int)(view_mul / config->zooms)), 1), 1);
+      else if(128 / (view_div + 1) >= config->minzoom)
+	view_set_zoom(1, view_div + 1);
     }
   else if(strcmp("button.zoome", (char *)data) == 0)
     {
-      GdkPixbuf * rpixbuf = gdk_pixbuf_scale_simple(dimage, 128 * config->stdzoom, 128 * config->stdzoom, config->interp);
-      gtk_image_set_from_pixbuf(GTK_IMAGE(image), rpixbuf);
-      g_object_unref(rpixbuf);
+      view_set_zoom(MAX((int)(config->stdzoom + 0.5), 1), 1);
     }
 }
 
@@ -1133,7 +2364,7 @@ GdkPixbuf * create_pixbuf(const gchar * filename)
    return pixbuf;
 }
 
-static void construct_tool_bar_add(GtkWidget * menu, const char * text, size_t signal)
+static GtkWidget * construct_tool_bar_add(GtkWidget * menu, const char * text, size_t signal)
 {
   GtkWidget * temp_item;
   temp_item = gtk_menu_item_new_with_label(text);
@@ -1142,6 +2373,7 @@ static void construct_tool_bar_add(GtkWidget * menu, const char * text, size_t s
   g_signal_connect_swapped(temp_item, "activate",
 			   G_CALLBACK(button_click),
 			   (gpointer)signal);
+  return temp_item;
 }
 
 void construct_tool_bar_add_deactivate(GtkWidget * menu, const char * text, size_t signal)
@@ -1157,22 +2389,16 @@ void construct_tool_bar_add_deactivate(GtkWidget * menu, const char * text, size
   gtk_widget_set_sensitive(temp_item, 0);
 }
 
-void load_colors_plain(color_t * colors, const char * path)
+/* Gets the tables of the shipped palettes ready while the window comes
+   up, so the first conversion doesn't wait for them. */
+static gpointer load_palette_tables(gpointer data)
 {
-  FILE * fcolors;
-  int i, r, g, b;
-  char * templine;
+  int palette, yuv;
 
-  templine = malloc(13);
-  fcolors = fopen(path, "r");
-  for(i = 0; fgets(templine, 13, fcolors) == templine; i++)
-    {
-      sscanf(templine, "%i,%i,%i", &r, &g, &b);
-      color_t color = {r, g, b};
-      colors[i] = color;
-    }
-  free(templine);
-  fclose(fcolors);
+  for(palette = 0; palette < PALETTES; palette++)
+    for(yuv = 0; yuv < 2; yuv++)
+      palette_lut(palette, yuv);
+  return NULL;
 }
 
 int main(int argc, char ** argv)
@@ -1182,30 +2408,39 @@ int main(int argc, char ** argv)
   GtkWidget * sc_win, * sc_buffer;
   GtkWidget * menu_bar;
   GtkWidget * file_menu, * file_item;
+  GtkWidget * edit_menu, * edit_item;
+  GtkAccelGroup * accel_group;
   GtkWidget * generate_menu, * generate_item;
   GtkWidget * settings_menu, * settings_item;
+  GtkWidget * palette_menu, * palette_item;
+  GSList * palette_group = NULL;
   
   GtkWidget * zoom_box, * zoom_button;
+  gchar * lutdir;
   int i;
 
   //init general
-  colors = (color_t *)malloc(NUM_COLORS * sizeof(color_t));
-  oldcolors = (color_t *)malloc(OLD_NUM_COLORS * sizeof(color_t));
-  memset(mdata, 0, BUFFER_COUNT * sizeof(unsigned char *));
-  memset(icons, 0, BUFFER_COUNT * sizeof(GtkWidget *));
-  memset(icon_event_boxes, 0, BUFFER_COUNT * sizeof(GtkWidget *));
-  mdata[current_buffer] = (unsigned char *)malloc(128 * 128);
-  
-  load_colors_plain(colors, "colors");
-  load_colors_plain(oldcolors, "oldcolors");
-  newcolors = colors;
+  glib_compat_init();
+  buffers = buffer_store_new();
+  history = history_new(buffers, HISTORY_BUDGET);
+
+  /* lookup tables are built once and mapped from here on later runs */
+  lutdir = g_build_filename(g_get_user_cache_dir(), "imagetomap", "lut", NULL);
+  quantize_set_cache_dir(lutdir);
+  g_free(lutdir);
+
+  i = cli_main(argc, argv);
+  if(i >= 0)
+    return i;
+
+  g_thread_unref(g_thread_new("palette tables", load_palette_tables, NULL));
   
-  //save_colors(colors, "colors.bin");
-  //load_colors(colors, "colors.bin");
+  //save_colors(palettes[current_palette].colors, palettes[current_palette].count, "colors.bin");
   
   srand(time(NULL));
   
   config = config_new();
+  buffer_store_set_budget(buffers, (size_t)config->buffer_budget * 1024 * 1024);
   
   //init gtk
   gtk_init(&argc, &argv);
@@ -1236,13 +2471,18 @@ int main(int argc, char ** argv)
   //////////file_menu items
   construct_tool_bar_add(file_menu, "Open", ITEM_SIGNAL_OPEN);
   construct_tool_bar_add(file_menu, "Open Grid Image", ITEM_SIGNAL_OPEN_GRID_IMAGE);
+  construct_tool_bar_add(file_menu, "Open Animation", ITEM_SIGNAL_OPEN_ANIMATION);
   construct_tool_bar_add(file_menu, "Save", ITEM_SIGNAL_SAVE);
   construct_tool_bar_add(file_menu, "Save Increment", ITEM_SIGNAL_SAVE_INCREMENT);
   construct_tool_bar_add(file_menu, "Save All", ITEM_SIGNAL_SAVE_ALL);
   construct_tool_bar_add(file_menu, "Save Raw Map", ITEM_SIGNAL_SAVE_RM);
   construct_tool_bar_add(file_menu, "Export Image", ITEM_SIGNAL_EXPORT_IMAGE);
+  construct_tool_bar_add(file_menu, "Export Atlas", ITEM_SIGNAL_EXPORT_ATLAS);
+  construct_tool_bar_add(file_menu, "Export All Images", ITEM_SIGNAL_EXPORT_ALL_IMAGES);
   /* construct_tool_bar_add_deactivate(file_menu, "Render World", ITEM_SIGNAL_WORLD_RENDER_ITEM); */
   construct_tool_bar_add(file_menu, "Render World", ITEM_SIGNAL_WORLD_RENDER_ITEM);
+  construct_tool_bar_add(file_menu, "Export World Image", ITEM_SIGNAL_EXPORT_WORLD_IMAGE);
+  construct_tool_bar_add(file_menu, "World Overview", ITEM_SIGNAL_WORLD_OVERVIEW);
   construct_tool_bar_add(file_menu, "Clean Buffer List", ITEM_SIGNAL_CLEAN);
   construct_tool_bar_add(file_menu, "Quit", ITEM_SIGNAL_QUIT);
 	
@@ -1252,6 +2492,23 @@ int main(int argc, char ** argv)
   gtk_menu_item_set_submenu(GTK_MENU_ITEM(file_item), file_menu);
   gtk_menu_shell_append((GtkMenuShell *)menu_bar, file_item);
   
+  ////////edit_menu
+  edit_menu = gtk_menu_new();
+  accel_group = gtk_accel_group_new();
+  gtk_window_add_accel_group(GTK_WINDOW(window), accel_group);
+
+  //////////edit_menu items
+  gtk_widget_add_accelerator(construct_tool_bar_add(edit_menu, "Undo", ITEM_SIGNAL_UNDO), "activate",
+			     accel_group, GDK_KEY_z, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+  gtk_widget_add_accelerator(construct_tool_bar_add(edit_menu, "Redo", ITEM_SIGNAL_REDO), "activate",
+			     accel_group, GDK_KEY_y, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
+
+  /////////edit_item
+  edit_item = gtk_menu_item_new_with_label("Edit");
+  gtk_widget_show(edit_item);
+  gtk_menu_item_set_submenu(GTK_MENU_ITEM(edit_item), edit_menu);
+  gtk_menu_shell_append((GtkMenuShell *)menu_bar, edit_item);
+
   ////////generate_menu
   generate_menu = gtk_menu_new();
 	
@@ -1281,18 +2538,44 @@ int main(int argc, char ** argv)
   FSD_checkbox = gtk_check_menu_item_new_with_label("Floyd–Steinberg dithering");
   gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), FSD_checkbox);
   gtk_widget_show(FSD_checkbox);
+  g_signal_connect_swapped(FSD_checkbox, "toggled",
+			   G_CALLBACK(conversion_setting_toggle), 0);
 
   //////////YUV_checkbox
   YUV_checkbox = gtk_check_menu_item_new_with_label("YUV color conversion");
   gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), YUV_checkbox);
   gtk_widget_show(YUV_checkbox);
+  g_signal_connect_swapped(YUV_checkbox, "toggled",
+			   G_CALLBACK(conversion_setting_toggle), 0);
+
+  //////////palette_menu
+  palette_menu = gtk_menu_new();
+  for(i = 0; i < PALETTES; i++)
+    {
+      GtkWidget * item = gtk_radio_menu_item_new_with_label(palette_group, palettes[i].label);
 
-  //////////old_colors_checkbox
-  old_colors_checkbox = gtk_check_menu_item_new_with_label("Old Colors");
-  gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), old_colors_checkbox);
-  gtk_widget_show(old_colors_checkbox);
-  g_signal_connect_swapped(old_colors_checkbox, "toggled",
-			   G_CALLBACK(old_colors_checkbox_toggle), 0);
+      palette_group = gtk_radio_menu_item_get_group(GTK_RADIO_MENU_ITEM(item));
+      gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), i == current_palette);
+      gtk_menu_shell_append(GTK_MENU_SHELL(palette_menu), item);
+      gtk_widget_show(item);
+      g_signal_connect(item, "toggled", G_CALLBACK(palette_item_toggle), (gpointer)(size_t)i);
+    }
+
+  //////////palette_item
+  palette_item = gtk_menu_item_new_with_label("Palette");
+  gtk_widget_show(palette_item);
+  gtk_menu_item_set_submenu(GTK_MENU_ITEM(palette_item), palette_menu);
+  gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), palette_item);
+
+  construct_tool_bar_add(settings_menu, "Memory Budget", ITEM_SIGNAL_MEMORY_BUDGET);
+  construct_tool_bar_add(settings_menu, "Statistics", ITEM_SIGNAL_STATISTICS);
+
+  //////////trace_checkbox
+  trace_checkbox = gtk_check_menu_item_new_with_label("Record Trace");
+  gtk_menu_shell_append(GTK_MENU_SHELL(settings_menu), trace_checkbox);
+  gtk_widget_show(trace_checkbox);
+  g_signal_connect_swapped(trace_checkbox, "toggled",
+			   G_CALLBACK(trace_checkbox_toggle), 0);
 
   //drop_down_menu
   init_drop_down_menu();
@@ -1319,20 +2602,22 @@ int main(int argc, char ** argv)
   gtk_paned_pack2(GTK_PANED(hpaned), sc_buffer, FALSE, FALSE);
   gtk_widget_show(sc_buffer);
 
-  //////list_vbox
-#ifdef GTK2
-  list_vbox = gtk_vbox_new(FALSE, 0);
-#else
-  list_vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
-#endif
-  
-#ifdef GTK2
-  gtk_scrolled_window_add_with_viewport(GTK_SCROLLED_WINDOW(sc_buffer), list_vbox);
-#else
-  gtk_container_add(GTK_CONTAINER(sc_buffer), list_vbox);
-#endif
-  
-  gtk_widget_show(list_vbox);
+  //////buffer_view
+  /* thumbnail, buffer handle and buffer version */
+  thumbnail_store = gtk_list_store_new(3, GDK_TYPE_PIXBUF, G_TYPE_INT, G_TYPE_UINT);
+  buffer_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(thumbnail_store));
+  gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(buffer_view), FALSE);
+  gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(buffer_view), -1, NULL,
+					      gtk_cell_renderer_pixbuf_new(), "pixbuf", 0, NULL);
+  /* every row is a 128 * 128 thumbnail, so rows can be laid out without
+     measuring them */
+  gtk_tree_view_column_set_sizing(gtk_tree_view_get_column(GTK_TREE_VIEW(buffer_view), 0), GTK_TREE_VIEW_COLUMN_FIXED);
+  gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(buffer_view), TRUE);
+  gtk_tree_selection_set_mode(gtk_tree_view_get_selection(GTK_TREE_VIEW(buffer_view)), GTK_SELECTION_BROWSE);
+  gtk_widget_set_can_focus(buffer_view, FALSE);
+  g_signal_connect(G_OBJECT(buffer_view), "button_press_event", G_CALLBACK(buffer_callback), NULL);
+  gtk_container_add(GTK_CONTAINER(sc_buffer), buffer_view);
+  gtk_widget_show(buffer_view);
 
   ////sc_win
   sc_win = gtk_scrolled_window_new(NULL, NULL);
@@ -1348,9 +2633,14 @@ int main(int argc, char ** argv)
   gtk_widget_show(sc_win);
 	
   //////image
-  dimage = gdk_pixbuf_new_from_file("start.png", NULL);
-  image = gtk_image_new();
-  gtk_image_set_from_pixbuf(GTK_IMAGE(image), dimage);
+  start_image = gdk_pixbuf_new_from_file("start.png", NULL);
+  image = gtk_drawing_area_new();
+#ifdef GTK2
+  g_signal_connect(G_OBJECT(image), "expose_event", G_CALLBACK(view_expose), NULL);
+#else
+  g_signal_connect(G_OBJECT(image), "draw", G_CALLBACK(view_draw), NULL);
+#endif
+  view_set_zoom(MAX((int)(config->stdzoom + 0.5), 1), 1);
 
 #ifdef GTK2
   gtk_scrolled_window_add_with_viewport(GTK_SCROLLED_WINDOW(sc_win), image);
@@ -1389,7 +2679,33 @@ int main(int argc, char ** argv)
   gtk_box_pack_start(GTK_BOX(zoom_box), zoom_button, TRUE, TRUE, 2);
   g_signal_connect(zoom_button, "clicked", G_CALLBACK(button_click2), "button.zoomm");
   gtk_widget_show(zoom_button);
+
+  //////memory_label
+  memory_label = gtk_label_new("");
+  gtk_box_pack_start(GTK_BOX(zoom_box), memory_label, FALSE, FALSE, 4);
+  gtk_widget_show(memory_label);
+  update_memory_usage();
 	
+  ////job_box, only shown while jobs are running
+#ifdef GTK2
+  job_box = gtk_hbox_new(FALSE, 0);
+#else
+  job_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+#endif
+  gtk_box_pack_start(GTK_BOX(vbox), job_box, FALSE, FALSE, 0);
+
+  job_bar = gtk_progress_bar_new();
+#ifndef GTK2
+  gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(job_bar), TRUE);
+#endif
+  gtk_box_pack_start(GTK_BOX(job_box), job_bar, TRUE, TRUE, 2);
+
+  {
+    GtkWidget * cancel_button = gtk_button_new_with_label("Cancel");
+    gtk_box_pack_start(GTK_BOX(job_box), cancel_button, FALSE, FALSE, 2);
+    g_signal_connect(cancel_button, "clicked", G_CALLBACK(job_status_cancel), NULL);
+  }
+
   //icon
   gtk_window_set_icon(GTK_WINDOW(window), create_pixbuf("imagetomap.ico"));
 
@@ -1406,9 +2722,9 @@ int main(int argc, char ** argv)
   gtk_main();
 	
   //clean up
-  free(colors);
-  for(i = 0; i < BUFFER_COUNT; i++)
-    free(mdata[i]);
+  job_cancel_all();
+  history_free(history);
+  buffer_store_free(buffers);
   config_free(config);
 	
   return 0;
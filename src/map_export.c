@@ -0,0 +1,164 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "glib_compat.h"
+#include "data_structures.h"
+#include "progress.h"
+#include "palette.h"
+#include "parallel.h"
+#include "png_stream.h"
+#include "map_export.h"
+
+#define MAP_SIZE (128 * 128)
+
+typedef struct export_pass
+{
+  const unsigned char * data;
+  int count, columns, first;
+  const uint32_t * table;
+  int level;
+  const char * dirname;
+  progress_t * progress;
+
+  /* the row of maps being expanded, for the atlas */
+  int row;
+  unsigned char * strip;
+
+  volatile gint done, failed;
+} export_pass_t;
+
+static void expand_cells(int start, int end, void * user_data)
+{
+  export_pass_t * pass = (export_pass_t *)user_data;
+  int stride = pass->columns * 128 * 4;
+  int c, j;
+
+  for(c = start; c < end; c++)
+    {
+      int index = pass->row * pass->columns + c;
+      unsigned char * dest = pass->strip + c * 128 * 4;
+
+      if(index < pass->count)
+	palette_expand(&(pass->data[(size_t)index * MAP_SIZE]), pass->table, 1, 4, 1, dest, stride);
+      else
+	for(j = 0; j < 128; j++)
+	  memset(dest + j * stride, 0, 128 * 4);
+    }
+}
+
+int map_export_atlas(const char * filename, const unsigned char * data, int count, int columns,
+		     const uint32_t * table, int level, progress_t * progress)
+{
+  int rows = (count + columns - 1) / columns;
+  export_pass_t pass;
+  png_stream_t * png;
+  int j, ret = 0;
+
+  if(count <= 0 || columns <= 0)
+    return -1;
+
+  png = png_stream_open(filename, columns * 128, rows * 128, 4, level);
+  if(png == NULL)
+    return -1;
+
+  memset(&pass, 0, sizeof(pass));
+  pass.data = data;
+  pass.count = count;
+  pass.columns = columns;
+  pass.table = table;
+  pass.strip = malloc((size_t)columns * 128 * 4 * 128);
+
+  for(pass.row = 0; pass.row < rows && ret == 0; pass.row++)
+    {
+      if(progress_set(progress, pass.row, rows))
+	{
+	  ret = -1;
+	  break;
+	}
+      parallel_for(columns, 1, expand_cells, &pass);
+      for(j = 0; j < 128 && ret == 0; j++)
+	ret = png_stream_write_row(png, pass.strip + (size_t)j * columns * 128 * 4);
+    }
+  free(pass.strip);
+
+  if(png_stream_close(png) != 0)
+    ret = -1;
+  if(progress_cancelled(progress))
+    remove(filename);
+  else
+    progress_set(progress, 1, 1);
+  return ret;
+}
+
+static int export_png(export_pass_t * pass, int k, unsigned char * pixels)
+{
+  char path[1024];
+  png_stream_t * png;
+  int j, ret = 0;
+
+#ifdef OS_WINDOWS
+  snprintf(path, sizeof(path), "%s\\map_%i.png", pass->dirname, pass->first + k);
+#else
+  snprintf(path, sizeof(path), "%s/map_%i.png", pass->dirname, pass->first + k);
+#endif
+  png = png_stream_open(path, 128, 128, 4, pass->level);
+  if(png == NULL)
+    return -1;
+
+  palette_expand(&(pass->data[(size_t)k * MAP_SIZE]), pass->table, 1, 4, 1, pixels, 128 * 4);
+  for(j = 0; j < 128 && ret == 0; j++)
+    ret = png_stream_write_row(png, pixels + j * 128 * 4);
+  if(png_stream_close(png) != 0)
+    ret = -1;
+  return ret;
+}
+
+static void export_pngs(int start, int end, void * user_data)
+{
+  export_pass_t * pass = (export_pass_t *)user_data;
+  unsigned char * pixels = malloc(128 * 128 * 4);
+  int k;
+
+  for(k = start; k < end && !progress_cancelled(pass->progress); k++)
+    {
+      if(export_png(pass, k, pixels) != 0)
+	g_atomic_int_add(&(pass->failed), 1);
+      progress_set(pass->progress, g_atomic_int_add(&(pass->done), 1) + 1, pass->count);
+    }
+  free(pixels);
+}
+
+int map_export_pngs(const char * dirname, int first, const unsigned char * data, int count,
+		    const uint32_t * table, int level, progress_t * progress)
+{
+  export_pass_t pass;
+
+  memset(&pass, 0, sizeof(pass));
+  pass.data = data;
+  pass.count = count;
+  pass.first = first;
+  pass.table = table;
+  pass.level = level;
+  pass.dirname = dirname;
+  pass.progress = progress;
+
+  /* a few maps per task, one is over too quickly to be worth a hand off */
+  parallel_for(count, 4, export_pngs, &pass);
+  return pass.failed;
+}
@@ -0,0 +1,21 @@
+#ifndef MAP_EXPORT_H
+#define MAP_EXPORT_H
+
+/* PNG exports of maps. data holds count maps one after another, table is
+   from palette_pack_rgba, transparent pixels stay transparent. level is
+   the zlib compression level, 0-9. */
+
+/* Lays the maps out left to right, top to bottom, columns maps wide, as
+   one image. Every row of maps is expanded in parallel and streamed out
+   before the next, so only one row of maps is held as pixels. Returns -1
+   if the file couldn't be written or progress was cancelled, a cancelled
+   export removes the partial file. */
+int map_export_atlas(const char * filename, const unsigned char * data, int count, int columns,
+		     const uint32_t * table, int level, progress_t * progress);
+
+/* Writes map k to <dirname>/map_<first + k>.png, several at a time.
+   Returns the number of files that couldn't be written. */
+int map_export_pngs(const char * dirname, int first, const unsigned char * data, int count,
+		    const uint32_t * table, int level, progress_t * progress);
+
+#endif
@@ -1,11 +1,18 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <gtk/gtk.h>
+#include <glib.h>
 #include <assert.h>
 #include <math.h>
 
+#include "glib_compat.h"
 #include "data_structures.h"
+#include "progress.h"
 #include "nbtsave.h"
+#include "parallel.h"
+#include "map_render.h"
+#include "stats.h"
 
 int get_block_baseid(int id)
 {
@@ -79,29 +86,28 @@ int get_block_baseid(int id)
   return baseid;
 }
 
-block_info_t get_block_info(block_info_t * blocks, int scale, int i, int j)
+block_info_t get_block_info(block_info_t * blocks, int stride, int i, int j)
 {
-  return blocks[i + j * (int)pow(2, scale) * 128];
+  return blocks[i + j * stride];
 }
 
-unsigned char get_block_id_info(block_info_t * blocks, int scale, int x, int z)
+unsigned char get_block_id_info(block_info_t * blocks, int stride, int scale, int x, int z)
 {
   int majority_array[256];
-  int i, j, k = 0;
+  int i, j, k = 0, w;
   int rx, rz;
 
   memset(majority_array, 0, 256 * sizeof(int));
 
-  if(z < 0 || z > pow(2, scale) * 128)
-    return -1;
+  w = 1 << scale;
 
-  rx = pow(2, scale) * x;
-  rz = pow(2, scale) * z;
+  rx = w * x;
+  rz = w * z;
 
-  for(i = 0; i < pow(2, scale); i++)
-      for(j = 0; j < pow(2, scale); j++)
+  for(i = 0; i < w; i++)
+      for(j = 0; j < w; j++)
 	{
-	  block_info_t info = get_block_info(blocks, scale, rx + i, rz + j);
+	  block_info_t info = get_block_info(blocks, stride, rx + i, rz + j);
 	  majority_array[info.blockid]++;
 	}
 
@@ -117,16 +123,13 @@ unsigned char get_block_id_info(block_info_t * blocks, int scale, int x, int z)
   return (unsigned char)k;
 }
 
-double get_block_h_info(block_info_t * blocks, int scale, int x, int z)
+double get_block_h_info(block_info_t * blocks, int stride, int scale, int x, int z)
 {
   int i, j, w;
   int rx, rz;
   double h = 0; 
 
   w = 1 << scale;
- 
-  if(z < 0 || z > w * 128)
-    return -1;
 
   rx = w * x;
   rz = w * z;
@@ -134,23 +137,20 @@ double get_block_h_info(block_info_t * blocks, int scale, int x, int z)
   for(i = 0; i < w; i++)
       for(j = 0; j < w; j++)
 	{
-	  block_info_t info = get_block_info(blocks, scale, rx + i, rz + j);
+	  block_info_t info = get_block_info(blocks, stride, rx + i, rz + j);
 	  h += (double)(info.h + 1) / (double)(w * w);
 	}
   
   return h;
 }
 
-int get_block_d_info(block_info_t * blocks, int scale, int x, int z)
+int get_block_d_info(block_info_t * blocks, int stride, int scale, int x, int z)
 {
   int i, j, w;
   int rx, rz;
   int d = 0;
 
   w = 1 << scale;
- 
-  if(z < 0 || z > w * 128)
-    return -1;
 
   rx = w * x;
   rz = w * z;
@@ -158,7 +158,7 @@ int get_block_d_info(block_info_t * blocks, int scale, int x, int z)
   for(i = 0; i < w; i++)
       for(j = 0; j < w; j++)
 	{
-	  block_info_t info = get_block_info(blocks, scale, rx + i, rz + j);
+	  block_info_t info = get_block_info(blocks, stride, rx + i, rz + j);
 	  d += info.d;
 	}
   d /= w * w;
@@ -166,49 +166,157 @@ int get_block_d_info(block_info_t * blocks, int scale, int x, int z)
   return d;
 }
 
-void render_map(block_info_t * blocks, unsigned char * data, int scale)
+void render_reduce_cell(block_info_t * blocks, int stride, int scale, int i, int j, map_cell_t * cell)
 {
-  int i, j, w;
-  w = 1 << scale;
+  cell->h = get_block_h_info(blocks, stride, scale, i, j);
+  cell->blockid = get_block_id_info(blocks, stride, scale, i, j);
+  cell->d = get_block_d_info(blocks, stride, scale, i, j);
+}
+
+static int render_height_shadow(double h, double lasth, int scale, int i, int j)
+{
+  int shadow = 1;
+  double d = (h - lasth) * 4.0 / (double)((1 << scale) + 4) + ((double)((i + j) & 1) - 0.5) * 0.4;
 
-  printf("rendering world!\n");
+  if(d > 0.6)
+    shadow = 2;
+  else if(d < -0.6)
+    shadow = 0;
 
-  for(i = 0; i < 128; i++)
+  return shadow;
+}
+
+unsigned char render_shade_cell(map_cell_t * cell, double lasth, int scale, int i, int j)
+{
+  int baseid = 0;
+  int shadow = render_height_shadow(cell->h, lasth, scale, i, j);
+
+  if(cell->blockid > 0)
     {
-      double lasth = 0.0;
-      for(j = 0; j < 128; j++)
+      baseid = get_block_baseid(cell->blockid);
+      if(baseid == 12 /* water color */)
 	{
-	  int baseid = 0, id;
-	  int shadow = 1;
-	  double d, h;
-	  h = get_block_h_info(blocks, scale, i, j);
-	  id = get_block_id_info(blocks, scale, i, j);
-	  d = (h - lasth) * 4.0 / (double)(w + 4) + ((double)((i + j) & 1) - 0.5) * 0.4;
-	  
-	  if(d > 0.6)
+	  double d = (double)cell->d * 0.1 + (double)((i + j) & 1) * 0.2;
+	  shadow = 1;
+ 
+	  if(d < 0.5)
 	    shadow = 2;
-	  else if(d < -0.6)
+	  else if(d > 0.9)
 	    shadow = 0;
-
-	  if(id > 0)
-	    {
-	      baseid = get_block_baseid(id);
-	      if(baseid == 12 /* water color */)
-		{
-		  int water_depth = get_block_d_info(blocks, scale, i, j);
-		  d = (double)water_depth * 0.1 + (double)((i + j) & 1) * 0.2;
-		  shadow = 1;
- 
-		  if(d < 0.5)
-		    shadow = 2;
-		  else if(d > 0.9)
-		    shadow = 0;
-		}
-	    }
-	
-	  lasth = h;
-
-	  data[i + j * 128] = (baseid * 4) + shadow;
 	}
     }
+
+  return (baseid * 4) + shadow;
+}
+
+unsigned char render_reshade_pixel(unsigned char color, double h, double lasth, int scale, int i, int j)
+{
+  int baseid = color / 4;
+
+  /* water is shaded by depth, which doesn't depend on the neighbour */
+  if(baseid == 12)
+    return color;
+
+  return (baseid * 4) + render_height_shadow(h, lasth, scale, i, j);
+}
+
+typedef struct render_area
+{
+  block_info_t * blocks;
+  map_cell_t * cells;
+  unsigned char * data;
+  double * heights;
+  double * lasth; /* heights of the row above the area, or NULL */
+  int width, height, row, scale;
+  progress_t * progress;
+  volatile gint done; /* columns finished */
+} render_area_t;
+
+/* Shades the columns [start, end) of the area. The only dependency between
+   pixels is lasth down a column, so a band of columns can be walked row by
+   row without looking at any other band. */
+static void render_map_columns(int start, int end, void * user_data)
+{
+  render_area_t * area = (render_area_t *)user_data;
+  int i, j, stride;
+  int scale = area->scale;
+  double * lasth;
+  gint64 stats = stats_start();
+
+  if(progress_cancelled(area->progress))
+    return;
+
+  lasth = malloc((end - start) * sizeof(double));
+  stride = area->width << scale;
+
+  for(i = start; i < end; i++)
+    lasth[i - start] = (area->lasth != NULL) ? area->lasth[i] : 0.0;
+
+  for(j = 0; j < area->height; j++)
+    for(i = start; i < end; i++)
+      {
+	map_cell_t cell;
+	int row = j + area->row;
+
+	if(area->cells != NULL)
+	  cell = area->cells[i + j * area->width];
+	else
+	  render_reduce_cell(area->blocks, stride, scale, i, j, &cell);
+	area->data[i + j * area->width] = render_shade_cell(&cell, lasth[i - start], scale, i, row);
+	if(area->heights != NULL)
+	  area->heights[i + j * area->width] = cell.h;
+
+	lasth[i - start] = cell.h;
+      }
+
+  if(area->lasth != NULL)
+    for(i = start; i < end; i++)
+      area->lasth[i] = lasth[i - start];
+
+  free(lasth);
+  /* bytes are the blocks read, items the pixels shaded */
+  stats_add(STATS_RENDER, stats, area->blocks ? ((gint64)(end - start) * area->height << (scale * 2)) * sizeof(block_info_t) : 0,
+	    (gint64)(end - start) * area->height);
+  progress_set(area->progress, g_atomic_int_add(&area->done, end - start) + end - start, area->width);
+}
+
+/* Shades a whole area, one band of columns per task. */
+static void render_run(parallel_pool_t * pool, block_info_t * blocks, map_cell_t * cells, unsigned char * data, double * heights, double * lasth,
+		       int width, int height, int row, int scale, progress_t * progress)
+{
+  render_area_t area;
+
+  area.blocks = blocks;
+  area.cells = cells;
+  area.data = data;
+  area.heights = heights;
+  area.lasth = lasth;
+  area.width = width;
+  area.height = height;
+  area.row = row;
+  area.scale = scale;
+  area.progress = progress;
+  area.done = 0;
+
+  parallel_pool_for(pool, width, 8, render_map_columns, &area);
+}
+
+void render_map_area(block_info_t * blocks, unsigned char * data, double * heights, int width, int height, int scale)
+{
+  render_run(NULL, blocks, NULL, data, heights, NULL, width, height, 0, scale, NULL);
+}
+
+void render_map_rows(block_info_t * blocks, unsigned char * data, double * lasth, int width, int height, int row, int scale)
+{
+  render_run(NULL, blocks, NULL, data, NULL, lasth, width, height, row, scale, NULL);
+}
+
+void render_shade_area(map_cell_t * cells, unsigned char * data, int width, int height, int scale)
+{
+  render_run(NULL, NULL, cells, data, NULL, NULL, width, height, 0, scale, NULL);
+}
+
+void render_map(parallel_pool_t * pool, block_info_t * blocks, unsigned char * data, int scale, progress_t * progress)
+{
+  render_run(pool, blocks, NULL, data, NULL, NULL, 128, 128, 0, scale, progress);
 }
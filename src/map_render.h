@@ -1,6 +1,34 @@
 #ifndef MAP_RENDER_H
 #define MAP_RENDER_H
 
-void render_map(block_info_t * blocks, unsigned char * data, int scale);
+/* One map pixel reduced from the (1 << scale)^2 block columns under it. */
+typedef struct map_cell
+{
+  double h;
+  int d, blockid;
+} map_cell_t;
+
+/* Shades the columns on pool, the shared one if it is NULL. Columns that
+   haven't started once progress is cancelled are skipped. */
+void render_map(parallel_pool_t * pool, block_info_t * blocks, unsigned char * data, int scale, progress_t * progress);
+
+/* blocks holds (width << scale) * (height << scale) columns, data receives
+   width * height map colors and heights, if not NULL, the mean height of
+   every pixel. Columns are shaded in parallel. */
+void render_map_area(block_info_t * blocks, unsigned char * data, double * heights, int width, int height, int scale);
+
+/* Renders one band of rows of a larger image. lasth holds the heights of
+   the row above the band (zeros for the first band) and receives the
+   heights of its last row, row is the index of the band's first row. */
+void render_map_rows(block_info_t * blocks, unsigned char * data, double * lasth, int width, int height, int row, int scale);
+
+/* Like render_map_area, for pixels that have already been reduced. */
+void render_shade_area(map_cell_t * cells, unsigned char * data, int width, int height, int scale);
+
+void render_reduce_cell(block_info_t * blocks, int stride, int scale, int i, int j, map_cell_t * cell);
+unsigned char render_shade_cell(map_cell_t * cell, double lasth, int scale, int i, int j);
+/* Recomputes the height shading of an already rendered pixel whose
+   northern neighbour changed, keeping its base color. */
+unsigned char render_reshade_pixel(unsigned char color, double h, double lasth, int scale, int i, int j);
 
 #endif
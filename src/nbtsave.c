@@ -13,23 +13,29 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <string.h>
 #include <zlib.h>
 #include <assert.h>
-#include <gtk/gtk.h>
+#include <glib.h>
 
 #include "data_structures.h"
+#include "progress.h"
 #include "nbtsave.h"
+#include "stats.h"
+#include "trace.h"
 
 #define DEBUG_MESSAGE printf("Debug Message line %d file %s function %s\n", __LINE__, __FILE__, __FUNCTION__)
 
 void nbt_jump_raw_list(unsigned char * data, int * offset);
+void nbt_jump_raw_compound(unsigned char * data, int * offset);
 
 #define CHUNK 8192
 #define MAPLEN 0x4060
 #define DATALEN 0x38
 #define ENDDATALEN 40
+#define REGION_HEADER_SIZE 8192
 
 typedef enum nbttag
   {
@@ -53,6 +59,7 @@ int deflatenbt(unsigned char * source, long src_len, FILE * dest, int level)
   unsigned have;
   z_stream strm;
   unsigned char out[CHUNK];
+  gint64 start = stats_start();
 	
   strm.zalloc = Z_NULL;
   strm.zfree = Z_NULL;
@@ -74,16 +81,23 @@ int deflatenbt(unsigned char * source, long src_len, FILE * dest, int level)
 	
   do
     {
+      uLong read = strm.total_in;
+
       strm.avail_out = CHUNK;
       strm.next_out = out;
       ret = deflate(&strm, Z_FINISH);
       assert(ret != Z_STREAM_ERROR);
       have = CHUNK - strm.avail_out;
+      stats_add(STATS_DEFLATE, start, strm.total_in - read, ret == Z_STREAM_END);
+
+      start = stats_start();
       if(fwrite(out, 1, have, dest) != have || ferror(dest))
 	{
 	  (void)deflateEnd(&strm);
 	  return Z_ERRNO;
 	}
+      stats_add(STATS_FILE_WRITE, start, have, 1);
+      start = stats_start();
     } while (strm.avail_out == 0);
 	
   (void)deflateEnd(&strm);
@@ -235,11 +249,13 @@ void nbt_write_raw_tag(unsigned char * data, char type, const char * name, int *
   va_end (arguments);
 }
 
-void nbt_save_map(const char * filename, char dimension, char scale, int16_t height, int16_t width,
+int nbt_write_map(FILE * dest, char dimension, char scale, int16_t height, int16_t width,
 		  int64_t xCenter, int64_t zCenter, unsigned char * mapdata)
 {
   int offset = 0;
   unsigned char data[MAPLEN];
+  gint64 start = stats_start(), save = trace_now();
+  int ret;
   
   nbt_write_raw_tag(data, 0x0A, NULL, &offset);
   nbt_write_raw_tag(data, 0x0A, "data", &offset);
@@ -253,9 +269,18 @@ void nbt_save_map(const char * filename, char dimension, char scale, int16_t hei
   /* data and root end tag */
   data[offset + 0] = 0x00;
   data[offset + 1] = 0x00;
+  stats_add(STATS_NBT_BUILD, start, MAPLEN, 1);
   
+  ret = deflatenbt(data, MAPLEN, dest, 9);
+  trace_span("save", "write_map", save, g_get_monotonic_time(), 1);
+  return ret;
+}
+
+void nbt_save_map(const char * filename, char dimension, char scale, int16_t height, int16_t width,
+		  int64_t xCenter, int64_t zCenter, unsigned char * mapdata)
+{
   FILE * dest = fopen(filename, "wb");
-  deflatenbt(data, MAPLEN, dest, 9);
+  nbt_write_map(dest, dimension, scale, height, width, xCenter, zCenter, mapdata);
   fclose(dest);
 }
 
@@ -287,87 +312,92 @@ char * nbt_read_raw_string(unsigned char * data, int * offset)
   return str;
 }
 
-void nbt_jump_raw_compound(unsigned char * data, int * offset)
+/* Skips one named tag and returns its type. */
+static int nbt_jump_raw_tag(unsigned char * data, int * offset)
 {
-  int r = 1, arraylen = 0;
-  
-  while(r)
+  int arraylen = 0;
+  int tagid = data[*offset];
+
+  *offset += 1;
+  switch(tagid)
     {
-      *offset += 1;
-      switch(data[*offset - 1])
-	{
-	case 0:
-	  r = 0;
-	  break;
+    case 0:
+      break;
 
-	case 1:
-	  nbt_jump_raw_string(data, offset);
-	  *offset += 1;
-	  break;
+    case 1:
+      nbt_jump_raw_string(data, offset);
+      *offset += 1;
+      break;
 
-	case 2:
-	  nbt_jump_raw_string(data, offset);
-	  *offset += 2;
-	  break;
+    case 2:
+      nbt_jump_raw_string(data, offset);
+      *offset += 2;
+      break;
 
-	case 3:
-	  nbt_jump_raw_string(data, offset);
-	  *offset += 4;
-	  break;
+    case 3:
+      nbt_jump_raw_string(data, offset);
+      *offset += 4;
+      break;
 
-	case 4:
-	  nbt_jump_raw_string(data, offset);
-	  *offset += 8;
-	  break;
+    case 4:
+      nbt_jump_raw_string(data, offset);
+      *offset += 8;
+      break;
 
-	case 5:
-	  nbt_jump_raw_string(data, offset);
-	  *offset += 4;
-	  break;
+    case 5:
+      nbt_jump_raw_string(data, offset);
+      *offset += 4;
+      break;
 
-	case 6:
-	  nbt_jump_raw_string(data, offset);
-	  *offset += 8;
-	  break;
+    case 6:
+      nbt_jump_raw_string(data, offset);
+      *offset += 8;
+      break;
 
-	case 7:
-	  arraylen = 0;
-	  nbt_jump_raw_string(data, offset);
-	  arraylen |= (data[*offset + 0] & 0xFF) << 24;
-	  arraylen |= (data[*offset + 1] & 0xFF) << 16;
-	  arraylen |= (data[*offset + 2] & 0xFF) << 8;
-	  arraylen |= (data[*offset + 3] & 0xFF) << 0;
-	  *offset += 4;
-	  *offset += arraylen;
-	  break;
+    case 7:
+      arraylen = 0;
+      nbt_jump_raw_string(data, offset);
+      arraylen |= (data[*offset + 0] & 0xFF) << 24;
+      arraylen |= (data[*offset + 1] & 0xFF) << 16;
+      arraylen |= (data[*offset + 2] & 0xFF) << 8;
+      arraylen |= (data[*offset + 3] & 0xFF) << 0;
+      *offset += 4;
+      *offset += arraylen;
+      break;
 
-	case 8:
-	  nbt_jump_raw_string(data, offset);
-	  nbt_jump_raw_string(data, offset);
-	  break;
+    case 8:
+      nbt_jump_raw_string(data, offset);
+      nbt_jump_raw_string(data, offset);
+      break;
 
-	case 9:
-	  nbt_jump_raw_string(data, offset);
-	  nbt_jump_raw_list(data, offset);
-	  break;
+    case 9:
+      nbt_jump_raw_string(data, offset);
+      nbt_jump_raw_list(data, offset);
+      break;
 
-	case 10:
-	  nbt_jump_raw_string(data, offset);
-	  nbt_jump_raw_compound(data, offset);
-	  break;
+    case 10:
+      nbt_jump_raw_string(data, offset);
+      nbt_jump_raw_compound(data, offset);
+      break;
 
-	case 11:
-	  arraylen = 0;
-	  nbt_jump_raw_string(data, offset);
-	  arraylen |= (data[*offset + 0] & 0xFF) << 24;
-	  arraylen |= (data[*offset + 1] & 0xFF) << 16;
-	  arraylen |= (data[*offset + 2] & 0xFF) << 8;
-	  arraylen |= (data[*offset + 3] & 0xFF) << 0;
-	  *offset += 4;
-	  *offset += 4 * arraylen;
-	  break;
-	}
+    case 11:
+      arraylen = 0;
+      nbt_jump_raw_string(data, offset);
+      arraylen |= (data[*offset + 0] & 0xFF) << 24;
+      arraylen |= (data[*offset + 1] & 0xFF) << 16;
+      arraylen |= (data[*offset + 2] & 0xFF) << 8;
+      arraylen |= (data[*offset + 3] & 0xFF) << 0;
+      *offset += 4;
+      *offset += 4 * arraylen;
+      break;
     }
+  return tagid;
+}
+
+void nbt_jump_raw_compound(unsigned char * data, int * offset)
+{
+  while(nbt_jump_raw_tag(data, offset) != NBT_END)
+    ;
 }
 
 void nbt_jump_raw_list(unsigned char * data, int * offset)
@@ -450,64 +480,70 @@ void nbt_jump_raw_list(unsigned char * data, int * offset)
     }
 }
 
-void nbt_load_map(const char * filename, unsigned char * mapdata)
+int nbt_load_map(const char * filename, unsigned char * mapdata, int * data_version)
 {
-  int r = 1;
+  int found = 0, depth = 0;
   unsigned char * data;
   long size = -1;
-  int offset;
-  FILE * dest = fopen(filename, "rb");
+  int offset = 0;
+  FILE * dest;
+
+  if(data_version != NULL)
+    *data_version = -1;
+  dest = fopen(filename, "rb");
+  if(dest == NULL)
+    return -1;
   data = inflatenbt(dest, &size, 1);
   fclose(dest);
+  if(data == NULL)
+    return -1;
 
-  offset = 0;
-
-  while(offset < size && r)
+  /* walks the root compound and the data compound inside it, where the
+     order of the tags isn't fixed, and skips every other tag whole */
+  while(offset < size)
     {
-      switch(data[offset])
-	{
-	case 0x0A:
-	  offset += 1;
-	  nbt_jump_raw_string(data, &offset);
-	  break;
-
-	case 0x01:
-	  offset += 1;
-	  nbt_jump_raw_string(data, &offset);
-	  offset += 1;
-	  break;
-
-	case 0x02:
-	  offset += 1;
-	  nbt_jump_raw_string(data, &offset);
-	  offset += 2;
-	  break;
+      int type = data[offset], len;
+      const char * name;
 
-	case 0x03:
-	  offset += 1;
-	  nbt_jump_raw_string(data, &offset);
-	  offset += 4;
-	  break;
-
-	case 0x07:
-	  offset += 1;
-	  nbt_jump_raw_string(data, &offset);
-	  offset += 4;
-	  memcpy(mapdata, &(data[offset]), 0x4000);
-	  break;
-
-	case 0x00:
-	  r = 0;
-	  break;
+      if(type == NBT_END)
+	{
+	  if(--depth <= 0)
+	    break;
+	  offset++;
+	  continue;
+	}
+      if(offset + 3 > size)
+	break;
+      len = (data[offset + 1] << 8) | data[offset + 2];
+      if(offset + 3 + len > size)
+	break;
+      name = (const char *)&(data[offset + 3]);
 
-	default:
-	  r = 0;
-	  break;
+      if(type == NBT_COMPOUND)
+	{
+	  offset += 3 + len;
+	  depth++;
+	  continue;
 	}
-      offset += 0;
+      if(type == NBT_BYTEARRAY && len == 6 && memcmp(name, "colors", 6) == 0 &&
+	 offset + 3 + len + 4 + 0x4000 <= size)
+	{
+	  memcpy(mapdata, &(data[offset + 3 + len + 4]), 0x4000);
+	  found = 1;
+	}
+      else if(type == NBT_INT && len == 11 && memcmp(name, "DataVersion", 11) == 0 &&
+	      offset + 3 + len + 4 <= size && data_version != NULL)
+	{
+	  unsigned char * p = &(data[offset + 3 + len]);
+	  *data_version = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+      if(type > NBT_INTARRAY)
+	break;
+      nbt_jump_raw_tag(data, &offset);
     }
 
   free(data);
+  return found ? 0 : -1;
 }
 
 void save_raw_map(const char * filename, unsigned char * mapdata)
@@ -517,37 +553,47 @@ void save_raw_map(const char * filename, unsigned char * mapdata)
   fclose(dest);
 }
 
-void load_raw_map(const char * filename, unsigned char * mapdata)
+int load_raw_map(const char * filename, unsigned char * mapdata)
 {
   FILE * source = fopen(filename, "rb");
   long size = -1;
-  unsigned char * tbuffer = inflatenbt(source, &size, 1);
+  unsigned char * tbuffer;
+
+  if(source == NULL)
+    return -1;
+  tbuffer = inflatenbt(source, &size, 1);
+  fclose(source);
+  if(tbuffer == NULL || size < 128 * 128)
+    {
+      free(tbuffer);
+      return -1;
+    }
   memcpy(mapdata, tbuffer, 128 * 128);
   free(tbuffer);
-  fclose(source);
+  return 0;
 }
 
-void save_colors(color_t * colors, char * filename)
+void save_colors(const color_t * colors, int count, char * filename)
 {
   FILE * dest = fopen(filename, "wb");
-  deflatenbt((unsigned char *)colors, NUM_COLORS * sizeof(color_t), dest, 9);
+  deflatenbt((unsigned char *)colors, count * sizeof(color_t), dest, 9);
   fclose(dest);
   /*FILE * dest = fopen(filename, "wb");
     int i = 0;
-    for(i = 0; i < NUM_COLORS; i++)
+    for(i = 0; i < count; i++)
     {
     fwrite(&(colors[i]), sizeof(color_t), 1, dest);
     }
     fclose(dest);*/
 }
 
-void load_colors(color_t * colors, char * filename)
+void load_colors(color_t * colors, int count, char * filename)
 {
   FILE * source = fopen(filename, "rb");
   long size = -1;
   unsigned char * tbuffer = inflatenbt(source, &size, 1);
-  if(size == NUM_COLORS * sizeof(color_t))
-    memcpy(colors, tbuffer, NUM_COLORS * sizeof(color_t));
+  if(size == count * sizeof(color_t))
+    memcpy(colors, tbuffer, count * sizeof(color_t));
   free(tbuffer);
   fclose(source);
 }
@@ -623,216 +669,362 @@ void get_chunk_row_info(int * h, int * id, int * d, unsigned char ** blocks, int
     }
 }
 
-block_info_t * read_region_files(const char * regionpath, const int x, const int z, const int w, const int h)
+static uint32_t read_be32(unsigned char * p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+int read_region_header(const char * regionpath, int rx, int rz, uint32_t * locations, uint32_t * timestamps)
+{
+  char pathbuffer[1024];
+  FILE * regionfile;
+  int ret;
+
+  if(snprintf(pathbuffer, sizeof(pathbuffer), "%s/r.%i.%i.mca", regionpath, rx, rz) >= (int)sizeof(pathbuffer))
+    return -1;
+  regionfile = fopen(pathbuffer, "rb");
+  if(regionfile == NULL)
+    return -1;
+
+  ret = read_region_file_header(regionfile, locations, timestamps);
+  fclose(regionfile);
+  return ret;
+}
+
+int read_region_file_header(FILE * regionfile, uint32_t * locations, uint32_t * timestamps)
+{
+  unsigned char header[REGION_HEADER_SIZE];
+  int i;
+
+  if(fread(header, 1, REGION_HEADER_SIZE, regionfile) != REGION_HEADER_SIZE)
+    return -1;
+
+  for(i = 0; i < 1024; i++)
+    {
+      if(locations != NULL)
+	locations[i] = read_be32(header + i * 4);
+      if(timestamps != NULL)
+	timestamps[i] = read_be32(header + 4096 + i * 4);
+    }
+  return 0;
+}
+
+unsigned char * read_region_chunk_data(FILE * regionfile, uint32_t location, long * size)
+{
+  uint32_t lenght;
+  //unsigned char usedsectors;
+  unsigned char compression;
+  unsigned char * data;
+  int offset;
+  gint64 start;
+
+  //usedsectors = location & 0xFF;
+  offset = location >> 8;
+
+  if(offset == 0)
+    return NULL;
+
+  start = stats_start();
+  fseek(regionfile, offset * 4096, SEEK_SET);
+  if (fread(&lenght, sizeof(uint32_t), 1, regionfile)) {}
+  lenght = ((lenght >> 24) & 0xFF)
+    | ((lenght >> 8) & 0xFF00)
+    | ((lenght << 8) & 0xFF0000)
+    | ((lenght << 24) & 0xFF000000);
+  if (fread(&compression, 1, 1, regionfile)) {}
+
+  *size = lenght;
+  data = inflatenbt(regionfile, size, compression);
+  if(data != NULL)
+    stats_add(STATS_CHUNK_INFLATE, start, *size, 1);
+  return data;
+}
+
+int read_chunk_sections(unsigned char * data, long size, chunk_sections_t * sections)
+{
+  int bufferoffset = 0;
+  int r = 1, arraylen = 0;
+  int i, j;
+
+  sections->count = 0;
+
+  bufferoffset += 4;
+  nbt_jump_raw_string(data, &bufferoffset);
+
+  while(bufferoffset < size && r)
+    {
+      char * name = NULL;
+      nbttag_t tagid = (nbttag_t)data[bufferoffset];
+      bufferoffset += 1;
+      if(tagid != NBT_END)
+	name = nbt_read_raw_string(data, &bufferoffset);
+
+      switch(tagid)
+	{
+	case NBT_BYTE:
+	  bufferoffset += 1;
+	  break;
+
+	case NBT_SHORT:
+	  bufferoffset += 2;
+	  break;
+
+	case NBT_INT:
+	  bufferoffset += 4;
+	  break;
+
+	case NBT_LONG:
+	  bufferoffset += 8;
+	  break;
+
+	case NBT_FLOAT:
+	  bufferoffset += 4;
+	  break;
+
+	case NBT_DOUBLE:
+	  bufferoffset += 8;
+	  break;
+
+	case NBT_BYTEARRAY:
+	  arraylen = 0;
+	  arraylen |= (data[bufferoffset + 0] & 0xFF) << 24;
+	  arraylen |= (data[bufferoffset + 1] & 0xFF) << 16;
+	  arraylen |= (data[bufferoffset + 2] & 0xFF) << 8;
+	  arraylen |= (data[bufferoffset + 3] & 0xFF) << 0;
+	  bufferoffset += 4;
+	  bufferoffset += arraylen;
+	  break;
+
+	case NBT_STRING:
+	  nbt_jump_raw_string(data, &bufferoffset);
+	  break;
+
+	case NBT_LIST:
+	  {
+	    int count = 0;
+	    if(strcmp(name, "Sections") == 0)
+	      {
+		bufferoffset += 1;
+		count |= (data[bufferoffset + 0] & 0xFF) << 24;
+		count |= (data[bufferoffset + 1] & 0xFF) << 16;
+		count |= (data[bufferoffset + 2] & 0xFF) << 8;
+		count |= (data[bufferoffset + 3] & 0xFF) << 0;
+		bufferoffset += 4;
+
+		/* sections without blocks or past the 16 of a chunk are
+		   skipped */
+		for(i = 0; i < count; i++)
+		  {
+		    unsigned char * blocks = NULL;
+		    int y = 0;
+
+		    get_chunk_info(&blocks, &y, data, &bufferoffset);
+		    if(blocks != NULL && sections->count < CHUNK_MAX_SECTIONS)
+		      {
+			sections->blocks[sections->count] = blocks;
+			sections->ylist[sections->count] = y;
+			sections->count++;
+		      }
+		  }
+
+		for(i = 0; i < sections->count; i++)
+		  for(j = 0; j < sections->count - 1; j++)
+		    {
+		      int temp;
+		      unsigned char * tempd;
+		      if(sections->ylist[j] < sections->ylist[j + 1])
+			{
+			  temp = sections->ylist[j];
+			  sections->ylist[j] = sections->ylist[j + 1];
+			  sections->ylist[j + 1] = temp;
+
+			  tempd = sections->blocks[j];
+			  sections->blocks[j] = sections->blocks[j + 1];
+			  sections->blocks[j + 1] = tempd;
+			}
+		    }
+		r = 0;
+	      }
+	    else
+	      nbt_jump_raw_list(data, &bufferoffset);
+	  }
+	  break;
+
+	case NBT_COMPOUND:
+	  nbt_jump_raw_compound(data, &bufferoffset);
+	  break;
+
+	case NBT_INTARRAY:
+	  arraylen = 0;
+	  arraylen |= (data[bufferoffset + 0] & 0xFF) << 24;
+	  arraylen |= (data[bufferoffset + 1] & 0xFF) << 16;
+	  arraylen |= (data[bufferoffset + 2] & 0xFF) << 8;
+	  arraylen |= (data[bufferoffset + 3] & 0xFF) << 0;
+	  bufferoffset += 4;
+	  bufferoffset += 4 * arraylen;
+	  break;
+
+	case NBT_END:
+	  r = 0;
+	  break;
+	}
+      free(name);
+    }
+  return sections->count;
+}
+
+void read_chunk_columns(chunk_sections_t * sections, int chunkx, int chunkz,
+			block_info_t * rmap, const int x, const int z, const int w, const int h)
+{
+  int i, j;
+
+  if(sections->count == 0)
+    return;
+
+  for(i = 0; i < 16; i++)
+    for(j = 0; j < 16; j++)
+      {
+	int globalx, globalz;
+	int id, bh, bd;
+
+	globalx = i + chunkx * 16;
+	globalz = j + chunkz * 16;
+
+	if((globalx >= x) && (globalx < x + w) && (globalz >= z) && (globalz < z + h))
+	  {
+	    get_chunk_row_info(&bh, &id, &bd, sections->blocks, sections->ylist, sections->count, i, j);
+	    rmap[(globalx - x) + (globalz - z) * w].h = bh;
+	    rmap[(globalx - x) + (globalz - z) * w].d = bd;
+	    rmap[(globalx - x) + (globalz - z) * w].blockid = id;
+	  }
+      }
+}
+
+/* Reads the chunk at location (from the region header) whose first block is
+   at globalx, globalz, and writes the columns that fall inside the
+   w * h area starting at x, z into rmap. */
+static void read_region_chunk(FILE * regionfile, uint32_t location, int chunkx, int chunkz,
+			      block_info_t * rmap, const int x, const int z, const int w, const int h)
+{
+  chunk_sections_t sections;
+  long size;
+  unsigned char * data = read_region_chunk_data(regionfile, location, &size);
+  gint64 start;
+
+  if(data == NULL)
+    return;
+
+  start = stats_start();
+  read_chunk_sections(data, size, &sections);
+  stats_add(STATS_CHUNK_PARSE, start, size, 1);
+  start = stats_start();
+  read_chunk_columns(&sections, chunkx, chunkz, rmap, x, z, w, h);
+  stats_add(STATS_COLUMNS, start, 0, 16 * 16);
+  free(data);
+}
+
+int read_region_chunk_heightmap(FILE * regionfile, uint32_t location, int * heightmap)
+{
+  long size;
+  int bufferoffset = 0;
+  int ret = -1;
+  unsigned char * data = read_region_chunk_data(regionfile, location, &size);
+  int i;
+
+  if(data == NULL)
+    return -1;
+
+  /* skip the root compound and the start of Level */
+  bufferoffset += 4;
+  nbt_jump_raw_string(data, &bufferoffset);
+
+  while(bufferoffset < size && data[bufferoffset] != NBT_END)
+    {
+      if(data[bufferoffset] == NBT_INTARRAY)
+	{
+	  int start = bufferoffset + 1;
+	  char * name = nbt_read_raw_string(data, &start);
+	  int len = (data[start] << 24) | (data[start + 1] << 16) | (data[start + 2] << 8) | data[start + 3];
+
+	  if(strcmp(name, "HeightMap") == 0 && len == 256)
+	    {
+	      for(i = 0; i < 256; i++)
+		heightmap[i] = read_be32(data + start + 4 + i * 4);
+	      ret = 0;
+	    }
+	  free(name);
+	  if(ret == 0)
+	    break;
+	}
+      nbt_jump_raw_tag(data, &bufferoffset);
+    }
+
+  free(data);
+  return ret;
+}
+
+void read_region_area(const char * regionpath, block_info_t * rmap, const int x, const int z, const int w, const int h,
+		      progress_t * progress)
 {
   int startrx, startrz, endrx, endrz;
   int startcx, startcz, endcx, endcz;
-  volatile int ri /*region x*/, rj /*reigon z*/;
-  volatile int ci /*chunk  x*/, cj /*chunk  y*/;
-  volatile int i  /*block  x*/, j  /*block  z*/;
-  char pathbuffer[256];
+  int ri /*region x*/, rj /*reigon z*/;
+  int ci /*chunk  x*/, cj /*chunk  y*/;
+  char pathbuffer[1024];
+  uint32_t locations[1024];
   FILE * regionfile;
-  block_info_t * rmap = malloc(w * h * sizeof(block_info_t));
-  memset(rmap, 0, w * h * sizeof(block_info_t));
-  
-  startrx = x >> 9;
-  startrz = z >> 9;
-  endrx = (x + w) >> 9;
-  endrz = (z + h) >> 9;
+  gint64 start;
 
   startcx = x >> 4;
   startcz = z >> 4;
-  endcx = (x + w) >> 4;
-  endcz = (z + h) >> 4;
+  endcx = (x + w - 1) >> 4;
+  endcz = (z + h - 1) >> 4;
+
+  startrx = startcx >> 5;
+  startrz = startcz >> 5;
+  endrx = endcx >> 5;
+  endrz = endcz >> 5;
   
   for(ri = startrx; ri <= endrx; ri++)
     for(rj = startrz; rj <= endrz; rj++)
       {
-        sprintf(pathbuffer, "%s/r.%i.%i.mca", regionpath, ri, rj);
-	printf("%s\n", pathbuffer);
+	if(progress_set(progress, (ri - startrx) * (endrz - startrz + 1) + rj - startrz,
+			(endrx - startrx + 1) * (endrz - startrz + 1)))
+	  return;
+
+	if(snprintf(pathbuffer, sizeof(pathbuffer), "%s/r.%i.%i.mca", regionpath, ri, rj) >= (int)sizeof(pathbuffer))
+	  continue;
+	start = stats_start();
         regionfile = fopen(pathbuffer, "rb");
 	if(regionfile == NULL)
 	    continue;
+
+	if(read_region_file_header(regionfile, locations, NULL) != 0)
+	  {
+	    fclose(regionfile);
+	    continue;
+	  }
+	stats_add(STATS_REGION_READ, start, REGION_HEADER_SIZE, 1);
 	
 	for(ci = 0; ci < 32; ci++)
 	  for(cj = 0; cj < 32; cj++)
 	    {
-	      uint32_t header;
-	      uint32_t lenght;
-	      long lenghtv;
-	      //unsigned char usedsectors;
-	      unsigned char compression;
-	      unsigned char * data = NULL;
-	      int offset;
-	      int bufferoffset = 0;
-	      int r = 1, arraylen = 0;
-
-	      if(!((ci + ri * 32 >= startcx) && (ci + ri * 32 < endcx) && (cj + rj * 32 >= startcz) && (cj + rj * 32 < endcz)))
+	      if(!((ci + ri * 32 >= startcx) && (ci + ri * 32 <= endcx) && (cj + rj * 32 >= startcz) && (cj + rj * 32 <= endcz)))
 		continue;
-	      
-	      fseek(regionfile, (ci + cj * 32) * sizeof(uint32_t), SEEK_SET);
-	      
-	      if (fread(&header, sizeof(uint32_t), 1, regionfile)) {}
-	      header = ((header >> 24) & 0xFF)
-		| ((header >> 8) & 0xFF00)
-		| ((header << 8) & 0xFF0000)
-		| ((header << 24) & 0xFF000000);
-	      
-	      //usedsectors = header & 0xFF;
-	      offset = header >> 8;
-	      
-	      if(offset == 0)
-		continue;
-	      
-	      fseek(regionfile, offset * 4096, SEEK_SET);
-	      if (fread(&lenght, sizeof(uint32_t), 1, regionfile)) {}
-	      lenght = ((lenght >> 24) & 0xFF)
-		| ((lenght >> 8) & 0xFF00)
-		| ((lenght << 8) & 0xFF0000)
-		| ((lenght << 24) & 0xFF000000);
-	      if (fread(&compression, 1, 1, regionfile)) {}
-	      
-	      lenghtv = lenght;
-	      data = inflatenbt(regionfile, &lenghtv, compression);
-	      
-	      
-	      bufferoffset += 4;
-	      nbt_jump_raw_string(data, &bufferoffset);
-	      
-	      while(bufferoffset < lenghtv && r)
-		{
-		  char * name;
-		  nbttag_t tagid = (nbttag_t)data[bufferoffset];
-		  bufferoffset += 1;
-		  if(tagid != NBT_END)
-		    {
-		      name = nbt_read_raw_string(data, &bufferoffset);
-		      printf("name: %s\n", name);
-		    }
 
-		  switch(tagid)
-		    {
-		    case NBT_BYTE:
-		      bufferoffset += 1;
-		      break;
-		      
-		    case NBT_SHORT:
-		      bufferoffset += 2;
-		      break;
-		      
-		    case NBT_INT:
-		      bufferoffset += 4;
-		      break;
-		      
-		    case NBT_LONG:
-		      bufferoffset += 8;
-		      break;
-		      
-		    case NBT_FLOAT:
-		      bufferoffset += 4;
-		      break;
-		      
-		    case NBT_DOUBLE:
-		      bufferoffset += 8;
-		      break;
-		      
-		    case NBT_BYTEARRAY:
-		      arraylen = 0;
-		      arraylen |= (data[bufferoffset + 0] & 0xFF) << 24;
-		      arraylen |= (data[bufferoffset + 1] & 0xFF) << 16;
-		      arraylen |= (data[bufferoffset + 2] & 0xFF) << 8;
-		      arraylen |= (data[bufferoffset + 3] & 0xFF) << 0;
-		      bufferoffset += 4;
-		      bufferoffset += arraylen;
-		      break;
-		      
-		    case NBT_STRING:
-		      nbt_jump_raw_string(data, &bufferoffset);
-		      break;
-		      
-		    case NBT_LIST:
-		      {
-		        int count = 0;
-			if(strcmp(name, "Sections") == 0)
-			  {
-			    bufferoffset += 1;
-			    count |= (data[bufferoffset + 0] & 0xFF) << 24;
-			    count |= (data[bufferoffset + 1] & 0xFF) << 16;
-			    count |= (data[bufferoffset + 2] & 0xFF) << 8;
-			    count |= (data[bufferoffset + 3] & 0xFF) << 0;
-			    bufferoffset += 4;
-			    
-			    int ylist[count];
-			    unsigned char * blocks[count];
-			    for(i = 0; i < count; i++)
-			      {
-			        get_chunk_info(&(blocks[i]), &(ylist[i]), data, &bufferoffset);
-			      }
-
-			    for(i = 0; i < count; i++)
-			      for(j = 0; j < count - 1; j++)
-				{
-				  int temp;
-				  unsigned char * tempd;
-				  if(ylist[j] < ylist[j + 1])
-				    {
-				      temp = ylist[j];
-				      ylist[j] = ylist[j + 1];
-				      ylist[j + 1] = temp;
-
-				      tempd = blocks[j];
-				      blocks[j] = blocks[j + 1];
-				      blocks[j + 1] = tempd;
-				    }
-				}
-
-			    if(count != 0)
-			      for(i = 0; i < 16; i++)
-				for(j = 0; j < 16; j++)
-				  {
-				    int globalx, globalz;
-				    int id, bh, bd;
-				    
-				    globalx = i + ci * 16 + ri * 512;
-				    globalz = j + cj * 16 + rj * 512;
-				    
-				    if((globalx >= x) && (globalx < x + w) && (globalz >= z) && (globalz < z + h))
-				    {
-				      get_chunk_row_info(&bh, &id, &bd, blocks, ylist, count, i, j);
-				      rmap[(globalx - x) + (globalz - z) * w].h = bh;
-				      rmap[(globalx - x) + (globalz - z) * w].d = bd;
-				      rmap[(globalx - x) + (globalz - z) * w].blockid = id;
-				    }
-				  }
-			    r = 0;
-			  }
-			else
-			  nbt_jump_raw_list(data, &bufferoffset);
-		      }
-		      break;
-		      
-		    case NBT_COMPOUND:
-		      nbt_jump_raw_compound(data, &bufferoffset);
-		      break;
-		      
-		    case NBT_INTARRAY:
-		      arraylen = 0;
-		      arraylen |= (data[bufferoffset + 0] & 0xFF) << 24;
-		      arraylen |= (data[bufferoffset + 1] & 0xFF) << 16;
-		      arraylen |= (data[bufferoffset + 2] & 0xFF) << 8;
-		      arraylen |= (data[bufferoffset + 3] & 0xFF) << 0;
-		      bufferoffset += 4;
-		      bufferoffset += 4 * arraylen;
-		      break;
-		      
-		    case NBT_END:
-		      r = 0;
-		      break;
-		    }
-		}
-	      free(data);
+	      read_region_chunk(regionfile, locations[ci + cj * 32], ci + ri * 32, cj + rj * 32, rmap, x, z, w, h);
 	    }
 	fclose(regionfile);
       }
+  progress_set(progress, 1, 1);
+}
+
+block_info_t * read_region_files(const char * regionpath, const int x, const int z, const int w, const int h)
+{
+  block_info_t * rmap = malloc(w * h * sizeof(block_info_t));
+  memset(rmap, 0, w * h * sizeof(block_info_t));
+
+  read_region_area(regionpath, rmap, x, z, w, h, NULL);
+
   return rmap;
 }
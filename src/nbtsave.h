@@ -6,14 +6,61 @@ typedef struct block_info
   int h, d, blockid;
 } block_info_t;
 
+int deflatenbt(unsigned char * source, long src_len, FILE * dest, int level);
+unsigned char * inflatenbt(FILE * source, long * rsize, int compression);
+
+/* Write a named tag at offset and move past it. The value follows as an
+   int for bytes, shorts and ints, as a length and a pointer for byte
+   arrays; compounds only get their name. */
+void nbt_write_raw_tagstart(unsigned char * data, char type, const char * name, int * offset);
+void nbt_write_raw_tag(unsigned char * data, char type, const char * name, int * offset, ...);
+
+/* Writes a map_N.dat to dest, returns Z_OK or a zlib error. */
+int nbt_write_map(FILE * dest, char dimension, char scale, int16_t height, int16_t width, int64_t xCenter, int64_t zCenter, unsigned char * mapdata);
 void nbt_save_map(const char * filename, char dimension, char scale, int16_t height, int16_t width, int64_t xCenter, int64_t zCenter, unsigned char * mapdata);
-void nbt_load_map(const char * filename, unsigned char * mapdata);
+/* The loaders return -1 if the file can't be read or holds no map, mapdata
+   is left as it is then. nbt_load_map also stores the DataVersion of the
+   file in data_version, if not NULL, or -1 if it has none (before 1.9). */
+int nbt_load_map(const char * filename, unsigned char * mapdata, int * data_version);
 void save_raw_map(const char * filename, unsigned char * mapdata);
-void load_raw_map(const char * filename, unsigned char * mapdata);
+int load_raw_map(const char * filename, unsigned char * mapdata);
 
-void save_colors(color_t * colors, char * filename);
-void load_colors(color_t * colors, char * filename);
+void save_colors(const color_t * colors, int count, char * filename);
+void load_colors(color_t * colors, int count, char * filename);
 
 block_info_t * read_region_files(const char * regionpath, const int x, const int z, const int w, const int h);
+/* Same as read_region_files, into an already allocated w * h rmap. Columns
+   of chunks that don't exist are left untouched. Stops between region
+   files once progress is cancelled. */
+void read_region_area(const char * regionpath, block_info_t * rmap, const int x, const int z, const int w, const int h,
+		      progress_t * progress);
+
+/* Reads the 1024 chunk locations and modification timestamps of r.<rx>.<rz>.mca,
+   either may be NULL. Returns -1 if the region file doesn't exist. */
+int read_region_header(const char * regionpath, int rx, int rz, uint32_t * locations, uint32_t * timestamps);
+int read_region_file_header(FILE * regionfile, uint32_t * locations, uint32_t * timestamps);
+/* The steps read_region_area reads a chunk in, so they can be timed on
+   their own. read_region_chunk_data inflates the NBT of the chunk at
+   location (from the region header), NULL if there is none, and writes
+   its size to size. */
+#define CHUNK_MAX_SECTIONS 16
+typedef struct chunk_sections
+{
+  int count;
+  int ylist[CHUNK_MAX_SECTIONS]; /* highest first */
+  unsigned char * blocks[CHUNK_MAX_SECTIONS]; /* point into the NBT data */
+} chunk_sections_t;
+
+unsigned char * read_region_chunk_data(FILE * regionfile, uint32_t location, long * size);
+/* Finds the block arrays of the chunk's sections, returns how many. */
+int read_chunk_sections(unsigned char * data, long size, chunk_sections_t * sections);
+/* Writes the columns of the chunk at chunkx, chunkz that fall inside the
+   w * h area at x, z into rmap. */
+void read_chunk_columns(chunk_sections_t * sections, int chunkx, int chunkz,
+			block_info_t * rmap, const int x, const int z, const int w, const int h);
+
+/* Reads the 16 * 16 HeightMap of the chunk at location, indexed x + z * 16.
+   Returns -1 if the chunk doesn't exist or has no HeightMap. */
+int read_region_chunk_heightmap(FILE * regionfile, uint32_t location, int * heightmap);
 
 #endif
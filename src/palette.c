@@ -0,0 +1,198 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "quantize.h"
+#include "palette_tables.h"
+#include "palette.h"
+
+/* The transparency checkerboard has 4 * 4 map pixel squares, so it
+   repeats every 8 pixels in both directions. */
+static uint32_t checker_tile[8][8];
+static uint32_t checker_tile_argb[8][8];
+static int checker_ready = 0;
+
+static uint32_t rgba_tables[PALETTES][256];
+static uint32_t argb_tables[PALETTES][256];
+
+static uint32_t pack(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  uint32_t pixel;
+  unsigned char * p = (unsigned char *)&pixel;
+
+  p[0] = r;
+  p[1] = g;
+  p[2] = b;
+  p[3] = a;
+  return pixel;
+}
+
+static void build_checker_tile()
+{
+  int x, y;
+
+  for(y = 0; y < 8; y++)
+    for(x = 0; x < 8; x++)
+      {
+	unsigned char c = ((x / 4 + (y / 4) % 2) % 2) ? 0xFF : 0xAA;
+	checker_tile[y][x] = pack(c, c, c, 0xFF);
+	checker_tile_argb[y][x] = 0xFF000000 | (c << 16) | (c << 8) | c;
+      }
+  checker_ready = 1;
+}
+
+void palette_pack_rgba(const color_t * colors, int count, uint32_t * table)
+{
+  int i;
+
+  if(!checker_ready)
+    build_checker_tile();
+
+  for(i = 0; i < 256; i++)
+    {
+      if(i < 4 || i >= count)
+	table[i] = 0;
+      else
+	table[i] = pack(colors[i].r, colors[i].g, colors[i].b, 0xFF);
+    }
+}
+
+void palette_expand(const unsigned char * data, const uint32_t * table, int zoom,
+		    int channels, int keep_alpha, unsigned char * dest, int rowstride)
+{
+  int width = 128 * zoom;
+  int i, j, k;
+
+  if(!checker_ready)
+    build_checker_tile();
+
+  for(j = 0; j < 128; j++)
+    {
+      const unsigned char * src = &(data[j * 128]);
+      const uint32_t * checker = checker_tile[j & 7];
+      unsigned char * row = &(dest[j * zoom * rowstride]);
+
+      if(channels == 4)
+	{
+	  uint32_t * out = (uint32_t *)row;
+	  for(i = 0; i < 128; i++)
+	    {
+	      uint32_t pixel = (src[i] < 4 && !keep_alpha) ? checker[i & 7] : table[src[i]];
+	      for(k = 0; k < zoom; k++)
+		out[i * zoom + k] = pixel;
+	    }
+	}
+      else
+	{
+	  unsigned char * out = row;
+	  for(i = 0; i < 128; i++)
+	    {
+	      uint32_t pixel = (src[i] < 4) ? checker[i & 7] : table[src[i]];
+	      for(k = 0; k < zoom; k++, out += 3)
+		memcpy(out, &pixel, 3);
+	    }
+	}
+
+      /* the other rows of a zoomed pixel are copies */
+      for(k = 1; k < zoom; k++)
+	memcpy(row + k * rowstride, row, width * channels);
+    }
+}
+
+void palette_pack_argb(const color_t * colors, int count, uint32_t * table)
+{
+  int i;
+
+  if(!checker_ready)
+    build_checker_tile();
+
+  for(i = 0; i < 256; i++)
+    {
+      if(i < 4 || i >= count)
+	table[i] = 0;
+      else
+	table[i] = 0xFF000000 | (colors[i].r << 16) | (colors[i].g << 8) | colors[i].b;
+    }
+}
+
+static void pack_tables()
+{
+  static gsize packed = 0;
+  int i;
+
+  if(g_once_init_enter(&packed))
+    {
+      for(i = 0; i < PALETTES; i++)
+	{
+	  palette_pack_rgba(palettes[i].colors, palettes[i].count, rgba_tables[i]);
+	  palette_pack_argb(palettes[i].colors, palettes[i].count, argb_tables[i]);
+	}
+      g_once_init_leave(&packed, 1);
+    }
+}
+
+const uint32_t * palette_rgba(int palette)
+{
+  pack_tables();
+  return rgba_tables[palette];
+}
+
+const uint32_t * palette_argb(int palette)
+{
+  pack_tables();
+  return argb_tables[palette];
+}
+
+void palette_expand_view(const unsigned char * data, const uint32_t * table, int mul, int div,
+			 int x, int y, int width, int height, uint32_t * dest, int stride)
+{
+  int i, j;
+
+  if(!checker_ready)
+    build_checker_tile();
+
+  for(j = 0; j < height; j++)
+    {
+      int my = (y + j) * div / mul;
+      const unsigned char * src = &(data[my * 128]);
+      const uint32_t * checker = checker_tile_argb[my & 7];
+      uint32_t * out = &(dest[j * stride]);
+
+      if(div == 1)
+	{
+	  /* walk the map pixels, repeating each one mul times */
+	  int mx = x / mul, left = mul - x % mul;
+	  for(i = 0; i < width; i++)
+	    {
+	      out[i] = (src[mx] < 4) ? checker[mx & 7] : table[src[mx]];
+	      if(--left == 0)
+		{
+		  mx++;
+		  left = mul;
+		}
+	    }
+	}
+      else
+	{
+	  int mx = x * div;
+	  for(i = 0; i < width; i++, mx += div)
+	    out[i] = (src[mx] < 4) ? checker[mx & 7] : table[src[mx]];
+	}
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+/* Packs colors into a 256 entry table of pixels, stored R, G, B, A in
+   memory. Map indices below 4 and past count are transparent (0). */
+void palette_pack_rgba(const color_t * colors, int count, uint32_t * table);
+
+/* Expands a 128 * 128 map to 128 * zoom square pixels at dest, with
+   rowstride bytes per row. channels is 3 (RGB) or 4 (RGBA). Transparent
+   indices show the checkerboard unless keep_alpha is set and channels is
+   4, then they stay transparent. */
+void palette_expand(const unsigned char * data, const uint32_t * table, int zoom,
+		    int channels, int keep_alpha, unsigned char * dest, int rowstride);
+
+/* Same as palette_pack_rgba, with native endian 0xAARRGGBB pixels for
+   cairo image surfaces. */
+void palette_pack_argb(const color_t * colors, int count, uint32_t * table);
+
+/* The palette_pack_rgba and palette_pack_argb tables of a palette from
+   palette_tables.h, packed once for the whole program. */
+const uint32_t * palette_rgba(int palette);
+const uint32_t * palette_argb(int palette);
+
+/* Writes the width * height rectangle at x, y of a 128 * 128 map shown at
+   mul / div pixels per map pixel (one of them is 1) with nearest
+   neighbour sampling. table is from palette_pack_argb, stride is in
+   pixels. The rectangle must lie inside the 128 * mul / div image. */
+void palette_expand_view(const unsigned char * data, const uint32_t * table, int mul, int div,
+			 int x, int y, int width, int height, uint32_t * dest, int stride);
+
+#endif
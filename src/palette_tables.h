@@ -0,0 +1,41 @@
+#ifndef PALETTE_TABLES_H
+#define PALETTE_TABLES_H
+
+/* The palettes of the Minecraft versions whose maps have different
+   colors, oldest first. Buffers and conversions refer to them by their
+   position here. */
+enum
+  {
+    PALETTE_LEGACY,
+    PALETTE_1_8,
+    PALETTE_1_12,
+    PALETTE_1_16,
+    PALETTE_1_17,
+    PALETTES
+  };
+
+#define PALETTE_DEFAULT PALETTE_1_8
+
+typedef struct palette
+{
+  const char * name; /* for the command line */
+  const char * label; /* for the menu */
+  int count;
+  const color_t * colors;
+  int data_version; /* of the first release using it, -1 before 1.12 */
+} palette_t;
+
+extern const palette_t palettes[PALETTES];
+
+/* The position of the palette called name, -1 if there is none. */
+int palette_find(const char * name);
+/* The palette of the maps saved with data_version, the DataVersion of a
+   map file. Maps without one, -1, are taken to be 1.8 maps. */
+int palette_for_data_version(int data_version);
+
+/* The lookup table of a palette, quantize_get_lut of its colors kept
+   with the palette so conversions don't search for it every time. Needs
+   quantize.h. */
+quantize_lut_t * palette_lut(int palette, int yuv);
+
+#endif
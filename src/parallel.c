@@ -0,0 +1,197 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+ 
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include "glib_compat.h"
+#include "parallel.h"
+#include "trace.h"
+
+typedef struct parallel_job
+{
+  parallel_func_t func;
+  void * user_data;
+  int count, grain;
+
+  volatile gint next; /* first index nobody has claimed yet */
+  volatile gint pending; /* indices claimed or not, that haven't finished */
+  volatile gint refs;
+
+  GMutex mutex;
+  GCond cond;
+} parallel_job_t;
+
+struct parallel_pool
+{
+  GMutex mutex;
+  GThreadPool * threads;
+  int thread_count; /* counting the caller, 0 until started */
+};
+
+/* the shared pool, started on first use */
+static parallel_pool_t shared_pool;
+
+static void parallel_job_unref(parallel_job_t * job)
+{
+  if(g_atomic_int_dec_and_test((gint *)&job->refs))
+    {
+      g_mutex_clear(&job->mutex);
+      g_cond_clear(&job->cond);
+      free(job);
+    }
+}
+
+static void parallel_run(parallel_job_t * job)
+{
+  int start, end;
+
+  while((start = g_atomic_int_add(&job->next, job->grain)) < job->count)
+    {
+      gint64 band = trace_now();
+
+      end = start + job->grain;
+      if(end > job->count)
+	end = job->count;
+
+      job->func(start, end, job->user_data);
+      trace_span("parallel", "band", band, g_get_monotonic_time(), end - start);
+
+      if(g_atomic_int_add(&job->pending, -(end - start)) == end - start)
+	{
+	  g_mutex_lock(&job->mutex);
+	  g_cond_broadcast(&job->cond);
+	  g_mutex_unlock(&job->mutex);
+	}
+    }
+}
+
+static void parallel_worker(gpointer data, gpointer user_data)
+{
+  trace_name_thread("parallel worker");
+  parallel_run((parallel_job_t *)data);
+  parallel_job_unref((parallel_job_t *)data);
+}
+
+static void parallel_pool_start(parallel_pool_t * pool, int threads)
+{
+  pool->thread_count = threads;
+  if(pool->thread_count < 1)
+    pool->thread_count = g_get_num_processors();
+  if(pool->thread_count < 1)
+    pool->thread_count = 1;
+
+  pool->threads = NULL;
+  if(pool->thread_count > 1)
+    pool->threads = g_thread_pool_new(parallel_worker, NULL, pool->thread_count - 1, FALSE, NULL);
+  if(pool->threads == NULL)
+    pool->thread_count = 1;
+}
+
+parallel_pool_t * parallel_pool_new(int threads)
+{
+  parallel_pool_t * pool = malloc(sizeof(parallel_pool_t));
+
+  g_mutex_init(&pool->mutex);
+  parallel_pool_start(pool, threads);
+  return pool;
+}
+
+void parallel_pool_free(parallel_pool_t * pool)
+{
+  if(pool == NULL)
+    return;
+  if(pool->threads != NULL)
+    g_thread_pool_free(pool->threads, FALSE, TRUE);
+  g_mutex_clear(&pool->mutex);
+  free(pool);
+}
+
+int parallel_pool_get_thread_count(parallel_pool_t * pool)
+{
+  int count;
+
+  if(pool == NULL)
+    pool = &shared_pool;
+
+  g_mutex_lock(&pool->mutex);
+  if(pool->thread_count == 0)
+    parallel_pool_start(pool, 0);
+  count = pool->thread_count;
+  g_mutex_unlock(&pool->mutex);
+
+  return count;
+}
+
+int parallel_get_thread_count(void)
+{
+  return parallel_pool_get_thread_count(NULL);
+}
+
+void parallel_pool_for(parallel_pool_t * pool, int count, int grain, parallel_func_t func, void * user_data)
+{
+  parallel_job_t * job;
+  int i, chunks, helpers;
+  gint64 start;
+
+  if(count <= 0)
+    return;
+  if(grain < 1)
+    grain = 1;
+  if(pool == NULL)
+    pool = &shared_pool;
+
+  chunks = (count + grain - 1) / grain;
+  helpers = parallel_pool_get_thread_count(pool) - 1;
+  if(helpers > chunks - 1)
+    helpers = chunks - 1;
+
+  if(helpers <= 0)
+    {
+      start = trace_now();
+      func(0, count, user_data);
+      trace_span("parallel", "band", start, g_get_monotonic_time(), count);
+      return;
+    }
+
+  job = malloc(sizeof(parallel_job_t));
+  job->func = func;
+  job->user_data = user_data;
+  job->count = count;
+  job->grain = grain;
+  job->next = 0;
+  job->pending = count;
+  job->refs = helpers + 1;
+  g_mutex_init(&job->mutex);
+  g_cond_init(&job->cond);
+
+  for(i = 0; i < helpers; i++)
+    g_thread_pool_push(pool->threads, job, NULL);
+
+  parallel_run(job);
+
+  /* the caller is out of work until the last band is done */
+  start = trace_now();
+  g_mutex_lock(&job->mutex);
+  while(g_atomic_int_get(&job->pending) > 0)
+    g_cond_wait(&job->cond, &job->mutex);
+  g_mutex_unlock(&job->mutex);
+  trace_span("parallel", "wait", start, g_get_monotonic_time(), 0);
+
+  parallel_job_unref(job);
+}
+
+void parallel_for(int count, int grain, parallel_func_t func, void * user_data)
+{
+  parallel_pool_for(NULL, count, grain, func, user_data);
+}
@@ -0,0 +1,24 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* Called with a half-open range [start, end) of the indices being processed. */
+typedef void (*parallel_func_t)(int start, int end, void * user_data);
+
+int parallel_get_thread_count(void);
+
+/* Runs func over [0, count) in chunks of grain indices on the shared worker
+   pool. The calling thread takes part in the work, so nesting is safe. */
+void parallel_for(int count, int grain, parallel_func_t func, void * user_data);
+
+/* A pool of its own, for callers that shouldn't share threads with the
+   rest of the program. threads counts the caller, 0 is one per processor.
+   Freeing waits for the work that was pushed to it. */
+typedef struct parallel_pool parallel_pool_t;
+
+parallel_pool_t * parallel_pool_new(int threads);
+void parallel_pool_free(parallel_pool_t * pool);
+int parallel_pool_get_thread_count(parallel_pool_t * pool);
+/* parallel_for on pool, or on the shared pool if it is NULL. */
+void parallel_pool_for(parallel_pool_t * pool, int count, int grain, parallel_func_t func, void * user_data);
+
+#endif
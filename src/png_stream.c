@@ -0,0 +1,177 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+ 
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <glib.h>
+
+#include "png_stream.h"
+#include "stats.h"
+
+#define IDAT_SIZE 65536
+
+struct png_stream
+{
+  FILE * file;
+  z_stream strm;
+  int width, height, channels;
+  int rows, error;
+  unsigned char * line;
+  unsigned char idat[IDAT_SIZE];
+};
+
+static void put_be32(unsigned char * p, uint32_t v)
+{
+  p[0] = (v >> 24) & 0xFF;
+  p[1] = (v >> 16) & 0xFF;
+  p[2] = (v >> 8) & 0xFF;
+  p[3] = (v >> 0) & 0xFF;
+}
+
+static void write_chunk(png_stream_t * png, const char * type, const unsigned char * data, uint32_t len)
+{
+  unsigned char buffer[4];
+  gint64 start = stats_start();
+  uLong crc;
+
+  put_be32(buffer, len);
+  crc = crc32(0, (const Bytef *)type, 4);
+  if(len > 0)
+    crc = crc32(crc, data, len);
+
+  if(fwrite(buffer, 1, 4, png->file) != 4
+     || fwrite(type, 1, 4, png->file) != 4
+     || (len > 0 && fwrite(data, 1, len, png->file) != len))
+    png->error = 1;
+
+  put_be32(buffer, (uint32_t)crc);
+  if(fwrite(buffer, 1, 4, png->file) != 4)
+    png->error = 1;
+  stats_add(STATS_FILE_WRITE, start, len + 12, 1);
+}
+
+static int deflate_rows(png_stream_t * png, int flush)
+{
+  int ret;
+
+  do
+    {
+      gint64 start = stats_start();
+      uLong read = png->strm.total_in;
+
+      ret = deflate(&(png->strm), flush);
+      if(ret == Z_STREAM_ERROR)
+	return -1;
+      stats_add(STATS_DEFLATE, start, png->strm.total_in - read, ret == Z_STREAM_END);
+
+      if(png->strm.avail_out == 0 || (flush == Z_FINISH && png->strm.avail_out != IDAT_SIZE))
+	{
+	  write_chunk(png, "IDAT", png->idat, IDAT_SIZE - png->strm.avail_out);
+	  png->strm.next_out = png->idat;
+	  png->strm.avail_out = IDAT_SIZE;
+	}
+    } while(png->strm.avail_in != 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+  return png->error ? -1 : 0;
+}
+
+png_stream_t * png_stream_open(const char * filename, int width, int height, int channels, int level)
+{
+  static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  unsigned char ihdr[13];
+  png_stream_t * png;
+
+  if(width <= 0 || height <= 0 || (channels != 3 && channels != 4))
+    return NULL;
+
+  png = malloc(sizeof(png_stream_t));
+  png->file = fopen(filename, "wb");
+  if(png->file == NULL)
+    {
+      free(png);
+      return NULL;
+    }
+
+  png->width = width;
+  png->height = height;
+  png->channels = channels;
+  png->rows = 0;
+  png->error = 0;
+  png->line = malloc(1 + width * channels);
+
+  png->strm.zalloc = Z_NULL;
+  png->strm.zfree = Z_NULL;
+  png->strm.opaque = Z_NULL;
+  if(deflateInit(&(png->strm), level) != Z_OK)
+    {
+      fclose(png->file);
+      free(png->line);
+      free(png);
+      return NULL;
+    }
+  png->strm.next_out = png->idat;
+  png->strm.avail_out = IDAT_SIZE;
+
+  if(fwrite(signature, 1, 8, png->file) != 8)
+    png->error = 1;
+
+  put_be32(ihdr, width);
+  put_be32(ihdr + 4, height);
+  ihdr[8] = 8; /* bit depth */
+  ihdr[9] = (channels == 4) ? 6 : 2; /* RGBA or RGB */
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+  write_chunk(png, "IHDR", ihdr, 13);
+
+  return png;
+}
+
+int png_stream_write_row(png_stream_t * png, const unsigned char * row)
+{
+  int i, n = png->width * png->channels;
+
+  if(png->rows >= png->height)
+    return -1;
+
+  /* map renders are mostly flat colors, the Sub filter turns runs into zeros */
+  png->line[0] = 1;
+  memcpy(png->line + 1, row, png->channels);
+  for(i = png->channels; i < n; i++)
+    png->line[1 + i] = row[i] - row[i - png->channels];
+
+  png->strm.next_in = png->line;
+  png->strm.avail_in = 1 + n;
+  png->rows++;
+
+  return deflate_rows(png, Z_NO_FLUSH);
+}
+
+int png_stream_close(png_stream_t * png)
+{
+  int ret;
+
+  ret = deflate_rows(png, Z_FINISH);
+  deflateEnd(&(png->strm));
+
+  write_chunk(png, "IEND", NULL, 0);
+  if(fclose(png->file) != 0 || png->error || png->rows != png->height)
+    ret = -1;
+
+  free(png->line);
+  free(png);
+  return ret;
+}
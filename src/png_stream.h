@@ -0,0 +1,14 @@
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+typedef struct png_stream png_stream_t;
+
+/* Writes an 8 bit RGB (channels 3) or RGBA (channels 4) PNG one row at a
+   time, only a deflate window and one IDAT chunk are ever buffered. level
+   is the zlib compression level, 0-9. */
+png_stream_t * png_stream_open(const char * filename, int width, int height, int channels, int level);
+int png_stream_write_row(png_stream_t * png, const unsigned char * row);
+/* Finishes the file, returns -1 if anything failed or rows are missing. */
+int png_stream_close(png_stream_t * png);
+
+#endif
@@ -0,0 +1,61 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <glib.h>
+
+#include "progress.h"
+
+void progress_init(progress_t * progress)
+{
+  g_atomic_int_set(&(progress->fraction), 0);
+  g_atomic_int_set(&(progress->cancelled), 0);
+  progress->start = 0.0;
+  progress->span = 1.0;
+}
+
+void progress_range(progress_t * progress, double start, double end)
+{
+  if(progress == NULL)
+    return;
+  progress->start = start;
+  progress->span = end - start;
+  g_atomic_int_set(&(progress->fraction), (gint)(start * PROGRESS_MAX));
+}
+
+int progress_set(progress_t * progress, long done, long total)
+{
+  double f;
+
+  if(progress == NULL)
+    return 0;
+
+  f = (total > 0) ? (double)done / (double)total : 1.0;
+  g_atomic_int_set(&(progress->fraction), (gint)((progress->start + progress->span * f) * PROGRESS_MAX));
+  return g_atomic_int_get(&(progress->cancelled));
+}
+
+int progress_cancelled(progress_t * progress)
+{
+  return (progress != NULL) && g_atomic_int_get(&(progress->cancelled));
+}
+
+void progress_cancel(progress_t * progress)
+{
+  if(progress != NULL)
+    g_atomic_int_set(&(progress->cancelled), 1);
+}
+
+double progress_get(progress_t * progress)
+{
+  return (double)g_atomic_int_get(&(progress->fraction)) / PROGRESS_MAX;
+}
@@ -0,0 +1,27 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+/* Lets long running functions report how far they got and notice that
+   they should stop. Every function taking a progress_t accepts NULL. A
+   caller running several steps can map each one to a part of the total
+   with progress_range. */
+typedef struct progress
+{
+  volatile gint fraction; /* of PROGRESS_MAX */
+  volatile gint cancelled;
+  double start, span;
+} progress_t;
+
+#define PROGRESS_MAX 1000000
+
+void progress_init(progress_t * progress);
+/* Following progress_set calls cover [start, end) of the total. */
+void progress_range(progress_t * progress, double start, double end);
+/* Records that done of total units are finished, returns non-zero if the
+   work should stop. Safe to call from several threads. */
+int progress_set(progress_t * progress, long done, long total);
+int progress_cancelled(progress_t * progress);
+void progress_cancel(progress_t * progress);
+double progress_get(progress_t * progress);
+
+#endif
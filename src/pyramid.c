@@ -0,0 +1,306 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+ 
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "nbtsave.h"
+#include "parallel.h"
+#include "map_render.h"
+#include "pyramid.h"
+
+#define PYRAMID_MAGIC 0x50544D49 /* "IMTP" */
+#define TILE_CELLS (PYRAMID_TILE * PYRAMID_TILE)
+
+typedef struct tile_header
+{
+  int32_t magic, level, tx, tz;
+  int64_t mtime;
+} tile_header_t;
+
+typedef struct tile_request
+{
+  pyramid_t * pyramid;
+  int level, tx, tz;
+  pyramid_cell_t * children[4];
+} tile_request_t;
+
+static void get_tile(pyramid_t * pyramid, int level, int tx, int tz, pyramid_cell_t * cells);
+
+pyramid_t * pyramid_open(const char * regionpath, const char * cachedir)
+{
+  pyramid_t * pyramid;
+
+  if(g_mkdir_with_parents(cachedir, 0755) != 0)
+    return NULL;
+
+  pyramid = malloc(sizeof(pyramid_t));
+  snprintf(pyramid->regionpath, sizeof(pyramid->regionpath), "%s", regionpath);
+  snprintf(pyramid->cachedir, sizeof(pyramid->cachedir), "%s", cachedir);
+  return pyramid;
+}
+
+void pyramid_close(pyramid_t * pyramid)
+{
+  free(pyramid);
+}
+
+/* Newest modification time of the region files under a tile. */
+static int64_t get_tile_mtime(pyramid_t * pyramid, int level, int tx, int tz)
+{
+  char pathbuffer[1024];
+  struct stat info;
+  int size = PYRAMID_TILE << level;
+  int rx, rz;
+  int64_t mtime = 0;
+
+  for(rx = (tx * size) >> 9; rx <= (tx * size + size - 1) >> 9; rx++)
+    for(rz = (tz * size) >> 9; rz <= (tz * size + size - 1) >> 9; rz++)
+      {
+	/* a path that doesn't fit is a region that isn't there */
+	if(snprintf(pathbuffer, sizeof(pathbuffer), "%s/r.%i.%i.mca", pyramid->regionpath, rx, rz) >= (int)sizeof(pathbuffer))
+	  continue;
+	if(stat(pathbuffer, &info) == 0 && (int64_t)info.st_mtime > mtime)
+	  mtime = (int64_t)info.st_mtime;
+      }
+
+  return mtime;
+}
+
+static void get_tile_path(pyramid_t * pyramid, int level, int tx, int tz, char * path, int len)
+{
+  snprintf(path, len, "%s/t.%i.%i.%i", pyramid->cachedir, level, tx, tz);
+}
+
+static int load_tile(pyramid_t * pyramid, int level, int tx, int tz, int64_t mtime, pyramid_cell_t * cells)
+{
+  char path[1024];
+  tile_header_t * header;
+  unsigned char * data;
+  long size = -1;
+  FILE * source;
+  int ret = -1;
+
+  get_tile_path(pyramid, level, tx, tz, path, sizeof(path));
+  source = fopen(path, "rb");
+  if(source == NULL)
+    return -1;
+  data = inflatenbt(source, &size, 1);
+  fclose(source);
+  if(data == NULL)
+    return -1;
+
+  header = (tile_header_t *)data;
+  if(size == sizeof(tile_header_t) + TILE_CELLS * sizeof(pyramid_cell_t)
+     && header->magic == PYRAMID_MAGIC && header->level == level
+     && header->tx == tx && header->tz == tz && header->mtime == mtime)
+    {
+      memcpy(cells, data + sizeof(tile_header_t), TILE_CELLS * sizeof(pyramid_cell_t));
+      ret = 0;
+    }
+
+  free(data);
+  return ret;
+}
+
+static void save_tile(pyramid_t * pyramid, int level, int tx, int tz, int64_t mtime, pyramid_cell_t * cells)
+{
+  char path[1024], tmppath[1100];
+  unsigned char * data = malloc(sizeof(tile_header_t) + TILE_CELLS * sizeof(pyramid_cell_t));
+  tile_header_t header = {PYRAMID_MAGIC, level, tx, tz, mtime};
+  FILE * dest;
+
+  memcpy(data, &header, sizeof(tile_header_t));
+  memcpy(data + sizeof(tile_header_t), cells, TILE_CELLS * sizeof(pyramid_cell_t));
+
+  /* two jobs may build the same tile, each writes its own file and
+     readers only ever see whole tiles */
+  get_tile_path(pyramid, level, tx, tz, path, sizeof(path));
+  snprintf(tmppath, sizeof(tmppath), "%s.%p", path, (void *)g_thread_self());
+  dest = fopen(tmppath, "wb");
+  if(dest != NULL)
+    {
+      deflatenbt(data, sizeof(tile_header_t) + TILE_CELLS * sizeof(pyramid_cell_t), dest, 9);
+      fclose(dest);
+#ifdef OS_WINDOWS
+      remove(path);
+#endif
+      if(rename(tmppath, path) != 0)
+	remove(tmppath);
+    }
+  free(data);
+}
+
+static void build_base_tile(pyramid_t * pyramid, int tx, int tz, pyramid_cell_t * cells)
+{
+  block_info_t * blocks = read_region_files(pyramid->regionpath, tx * PYRAMID_TILE, tz * PYRAMID_TILE,
+					    PYRAMID_TILE, PYRAMID_TILE);
+  int i;
+
+  for(i = 0; i < TILE_CELLS; i++)
+    {
+      cells[i].hsum = blocks[i].h + 1;
+      cells[i].dsum = blocks[i].d;
+      cells[i].count = 1;
+      cells[i].blockid = blocks[i].blockid;
+      cells[i].pad = 0;
+    }
+
+  free(blocks);
+}
+
+static void merge_cells(pyramid_cell_t ** in, pyramid_cell_t * out)
+{
+  int k, l, best = 0;
+  int counts[4];
+
+  out->hsum = 0;
+  out->dsum = 0;
+  for(k = 0; k < 4; k++)
+    {
+      out->hsum += in[k]->hsum;
+      out->dsum += in[k]->dsum;
+      counts[k] = 0;
+      for(l = 0; l < 4; l++)
+	if(in[l]->blockid == in[k]->blockid)
+	  counts[k] += in[l]->count;
+    }
+
+  /* ties go to the lowest id, like get_block_id_info */
+  for(k = 1; k < 4; k++)
+    if(counts[k] > counts[best] || (counts[k] == counts[best] && in[k]->blockid < in[best]->blockid))
+      best = k;
+
+  out->blockid = in[best]->blockid;
+  out->count = counts[best];
+  out->pad = 0;
+}
+
+static void get_child_tiles(int start, int end, void * user_data)
+{
+  tile_request_t * request = (tile_request_t *)user_data;
+  int k;
+
+  for(k = start; k < end; k++)
+    get_tile(request->pyramid, request->level - 1, request->tx * 2 + (k & 1), request->tz * 2 + (k >> 1),
+	     request->children[k]);
+}
+
+static void build_tile(pyramid_t * pyramid, int level, int tx, int tz, pyramid_cell_t * cells)
+{
+  tile_request_t request;
+  int i, j, k;
+
+  request.pyramid = pyramid;
+  request.level = level;
+  request.tx = tx;
+  request.tz = tz;
+  for(k = 0; k < 4; k++)
+    request.children[k] = malloc(TILE_CELLS * sizeof(pyramid_cell_t));
+
+  parallel_for(4, 1, get_child_tiles, &request);
+
+  for(i = 0; i < PYRAMID_TILE; i++)
+    for(j = 0; j < PYRAMID_TILE; j++)
+      {
+	pyramid_cell_t * child = request.children[(i / 64) + (j / 64) * 2];
+	int ci = (i % 64) * 2, cj = (j % 64) * 2;
+	pyramid_cell_t * in[4];
+
+	in[0] = &(child[ci + cj * PYRAMID_TILE]);
+	in[1] = &(child[ci + 1 + cj * PYRAMID_TILE]);
+	in[2] = &(child[ci + (cj + 1) * PYRAMID_TILE]);
+	in[3] = &(child[ci + 1 + (cj + 1) * PYRAMID_TILE]);
+	merge_cells(in, &(cells[i + j * PYRAMID_TILE]));
+      }
+
+  for(k = 0; k < 4; k++)
+    free(request.children[k]);
+}
+
+static void get_tile(pyramid_t * pyramid, int level, int tx, int tz, pyramid_cell_t * cells)
+{
+  int64_t mtime = get_tile_mtime(pyramid, level, tx, tz);
+
+  if(load_tile(pyramid, level, tx, tz, mtime, cells) == 0)
+    return;
+
+  if(level == 0)
+    build_base_tile(pyramid, tx, tz, cells);
+  else
+    build_tile(pyramid, level, tx, tz, cells);
+
+  save_tile(pyramid, level, tx, tz, mtime, cells);
+}
+
+void pyramid_read(pyramid_t * pyramid, int scale, int x, int z, int width, int height, map_cell_t * cells,
+		  progress_t * progress)
+{
+  pyramid_cell_t * tile = malloc(TILE_CELLS * sizeof(pyramid_cell_t));
+  int startx = x >> scale, startz = z >> scale;
+  int area = 1 << (scale * 2);
+  int tx, tz, i, j;
+  int tiles_x = ((startx + width - 1) >> 7) - (startx >> 7) + 1;
+  int tiles_z = ((startz + height - 1) >> 7) - (startz >> 7) + 1;
+
+  if(scale < 0 || scale > PYRAMID_MAX_LEVEL)
+    {
+      memset(cells, 0, width * height * sizeof(map_cell_t));
+      free(tile);
+      return;
+    }
+
+  for(tx = startx >> 7; tx <= (startx + width - 1) >> 7; tx++)
+    for(tz = startz >> 7; tz <= (startz + height - 1) >> 7; tz++)
+      {
+	if(progress_set(progress, (tx - (startx >> 7)) * tiles_z + tz - (startz >> 7), tiles_x * tiles_z))
+	  break;
+	get_tile(pyramid, scale, tx, tz, tile);
+
+	for(i = 0; i < PYRAMID_TILE; i++)
+	  for(j = 0; j < PYRAMID_TILE; j++)
+	    {
+	      int px = tx * PYRAMID_TILE + i - startx;
+	      int pz = tz * PYRAMID_TILE + j - startz;
+	      pyramid_cell_t * in = &(tile[i + j * PYRAMID_TILE]);
+	      map_cell_t * out;
+
+	      if(px < 0 || px >= width || pz < 0 || pz >= height)
+		continue;
+
+	      out = &(cells[px + pz * width]);
+	      out->h = (double)in->hsum / (double)area;
+	      out->d = in->dsum / area;
+	      out->blockid = in->blockid;
+	    }
+      }
+
+  free(tile);
+}
+
+void pyramid_render_map(pyramid_t * pyramid, unsigned char * data, int x, int z, int scale, progress_t * progress)
+{
+  map_cell_t * cells = calloc(128 * 128, sizeof(map_cell_t));
+  int rs = 128 << scale;
+
+  pyramid_read(pyramid, scale, x - rs / 2, z - rs / 2, 128, 128, cells, progress);
+  render_shade_area(cells, data, 128, 128, scale);
+
+  free(cells);
+}
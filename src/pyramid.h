@@ -0,0 +1,39 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#define PYRAMID_TILE 128
+#define PYRAMID_MAX_LEVEL 7
+
+/* Block columns summed over the 4^level blocks a cell covers. blockid is
+   the majority id of the cell and count how many of its blocks had it;
+   above level 0 it's the majority of the children's majorities, weighted
+   by their counts, so it can differ from a direct render in mixed areas. */
+typedef struct pyramid_cell
+{
+  int32_t hsum, dsum;
+  uint16_t count;
+  unsigned char blockid, pad;
+} pyramid_cell_t;
+
+typedef struct pyramid
+{
+  char regionpath[512];
+  char cachedir[512];
+} pyramid_t;
+
+/* Level 0 tiles are built from read_region_files, every other level from
+   the four tiles below it. Tiles are kept in cachedir and rebuilt when a
+   region file under them is newer than the tile. */
+pyramid_t * pyramid_open(const char * regionpath, const char * cachedir);
+void pyramid_close(pyramid_t * pyramid);
+
+/* Fills width * height map pixels at the given scale, starting at block
+   x, z. The start is snapped down to a multiple of 1 << scale. Stops
+   between tiles once progress is cancelled. */
+void pyramid_read(pyramid_t * pyramid, int scale, int x, int z, int width, int height, map_cell_t * cells,
+		  progress_t * progress);
+
+/* Renders the map centered on x, z the same way "Render World" does. */
+void pyramid_render_map(pyramid_t * pyramid, unsigned char * data, int x, int z, int scale, progress_t * progress);
+
+#endif
@@ -0,0 +1,320 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "glib_compat.h"
+#include "data_structures.h"
+#include "quantize.h"
+
+#define CELL_BITS 5
+#define CELLS (1 << (CELL_BITS * 3))
+#define CELL_SIZE (256 >> CELL_BITS)
+
+struct quantize_lut
+{
+  color_t palette[256];
+  int count, yuv;
+  float y[256], u[256], v[256];
+  /* the candidates of cell c are candidates[offsets[c], offsets[c + 1]),
+     in palette order so ties go to the lowest index like closest_color.
+     Both point into the cache file when it was mapped. */
+  const uint32_t * offsets;
+  const unsigned char * candidates;
+};
+
+/* tables are never freed, other threads may still be using them */
+static quantize_lut_t ** luts = NULL;
+static int lut_count = 0;
+static GMutex lut_lock;
+static gchar * cache_dir = NULL;
+
+/* A cache file is this header, the offsets and the candidates, in native
+   byte order. Everything before candidates is the key of the table, the
+   file name is its hash. */
+#define CACHE_MAGIC 0x4954514C
+
+typedef struct cache_header
+{
+  uint32_t magic, cell_bits, count, yuv;
+  unsigned char palette[256 * 3];
+  uint32_t candidates;
+} cache_header_t;
+
+/* The same arithmetic as RGB_to_YUV and YUV_to_dist in generate.c, a
+   different rounding could pick a different color on a tie. */
+static void to_yuv(int ri, int gi, int bi, float * y, float * u, float * v)
+{
+  float r, g, b;
+  r = ri / 255.;
+  g = gi / 255.;
+  b = bi / 255.;
+  *y = r * 0.299 + g * 0.587 + b * 0.114;
+  *u = r * -0.14713 + g * -0.28886 + b * 0.436;
+  *v = r * 0.615 + g * -0.51499 + b * -0.0001;
+}
+
+static double distance(quantize_lut_t * lut, int i, int r, int g, int b)
+{
+  if(lut->yuv)
+    {
+      float y, u, v, yd, ud, vd;
+      to_yuv(r, g, b, &y, &u, &v);
+      yd = y - lut->y[i];
+      ud = u - lut->u[i];
+      vd = v - lut->v[i];
+      return sqrt(yd * yd + ud * ud + vd * vd);
+    }
+  return sqrt(pow(lut->palette[i].r - r, 2) + pow(lut->palette[i].g - g, 2) + pow(lut->palette[i].b - b, 2));
+}
+
+/* The length of a difference of two colors without any rounding, for
+   building the table. */
+static double length(int yuv, double dr, double dg, double db)
+{
+  if(yuv)
+    {
+      double y = (dr * 0.299 + dg * 0.587 + db * 0.114) / 255.;
+      double u = (dr * -0.14713 + dg * -0.28886 + db * 0.436) / 255.;
+      double v = (dr * 0.615 + dg * -0.51499 + db * -0.0001) / 255.;
+      return sqrt(y * y + u * u + v * v);
+    }
+  return sqrt(dr * dr + dg * dg + db * db);
+}
+
+/* Every point of a cell is within radius of its centre, so a color can
+   only be nearest somewhere in the cell if it is within the nearest
+   distance from the centre plus twice the radius. */
+static uint32_t build_lut(quantize_lut_t * lut)
+{
+  double radius = 0, half = (CELL_SIZE - 1) / 2.0;
+  double * d = malloc(lut->count * sizeof(double));
+  uint32_t * offsets = malloc((CELLS + 1) * sizeof(uint32_t));
+  unsigned char * candidates;
+  int size = CELLS * 4, used = 0;
+  int cell, i, corner;
+
+  for(corner = 0; corner < 8; corner++)
+    {
+      double cr = length(lut->yuv, (corner & 1) ? half : -half, (corner & 2) ? half : -half,
+			 (corner & 4) ? half : -half);
+      if(cr > radius)
+	radius = cr;
+    }
+  /* room for the float rounding of the lookups */
+  radius = radius * 1.01 + 1e-4;
+
+  candidates = malloc(size);
+  for(cell = 0; cell < CELLS; cell++)
+    {
+      double r = (cell >> (CELL_BITS * 2)) * CELL_SIZE + half;
+      double g = ((cell >> CELL_BITS) & ((1 << CELL_BITS) - 1)) * CELL_SIZE + half;
+      double b = (cell & ((1 << CELL_BITS) - 1)) * CELL_SIZE + half;
+      double nearest = HUGE_VAL;
+
+      for(i = 4; i < lut->count; i++)
+	{
+	  d[i] = length(lut->yuv, r - lut->palette[i].r, g - lut->palette[i].g, b - lut->palette[i].b);
+	  if(d[i] < nearest)
+	    nearest = d[i];
+	}
+
+      offsets[cell] = used;
+      for(i = 4; i < lut->count; i++)
+	if(d[i] <= nearest + 2 * radius)
+	  {
+	    if(used == size)
+	      {
+		size *= 2;
+		candidates = realloc(candidates, size);
+	      }
+	    candidates[used++] = i;
+	  }
+    }
+  offsets[CELLS] = used;
+  lut->offsets = offsets;
+  lut->candidates = realloc(candidates, used ? used : 1);
+  free(d);
+  return used;
+}
+
+static int load_cached(quantize_lut_t * lut, const cache_header_t * key, const char * path)
+{
+  GMappedFile * file = g_mapped_file_new(path, FALSE, NULL);
+  const size_t table_size = sizeof(cache_header_t) + (CELLS + 1) * sizeof(uint32_t);
+  const cache_header_t * header;
+  const uint32_t * offsets;
+  int cell, valid;
+
+  if(file == NULL)
+    return -1;
+
+  header = (const cache_header_t *)g_mapped_file_get_contents(file);
+  valid = g_mapped_file_get_length(file) >= table_size
+    && memcmp(header, key, offsetof(cache_header_t, candidates)) == 0
+    && g_mapped_file_get_length(file) == table_size + header->candidates;
+  offsets = valid ? (const uint32_t *)(header + 1) : NULL;
+  valid = valid && offsets[0] == 0 && offsets[CELLS] == header->candidates;
+  /* a damaged file must not send lookups past the candidates */
+  for(cell = 0; valid && cell < CELLS; cell++)
+    valid = offsets[cell] <= offsets[cell + 1];
+
+  if(!valid)
+    {
+      g_mapped_file_unref(file);
+      return -1;
+    }
+
+  /* stays mapped for as long as the table is kept, which is forever */
+  lut->offsets = offsets;
+  lut->candidates = (const unsigned char *)(offsets + CELLS + 1);
+  return 0;
+}
+
+static void save_cached(quantize_lut_t * lut, const cache_header_t * header, const char * path)
+{
+  size_t offsets_size = (CELLS + 1) * sizeof(uint32_t);
+  size_t size = sizeof(cache_header_t) + offsets_size + header->candidates;
+  char * blob = malloc(size);
+
+  memcpy(blob, header, sizeof(cache_header_t));
+  memcpy(blob + sizeof(cache_header_t), lut->offsets, offsets_size);
+  memcpy(blob + sizeof(cache_header_t) + offsets_size, lut->candidates, header->candidates);
+
+  /* written to a temporary file and renamed, other processes never map
+     half a table */
+  g_mkdir_with_parents(cache_dir, 0755);
+  g_file_set_contents(path, blob, size, NULL);
+  free(blob);
+}
+
+/* Maps the table from the cache directory, or builds it and saves it
+   there. */
+static void cached_lut(quantize_lut_t * lut)
+{
+  cache_header_t header;
+  gchar * hash, * name, * path;
+  int i;
+
+  if(cache_dir == NULL)
+    {
+      build_lut(lut);
+      return;
+    }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = CACHE_MAGIC;
+  header.cell_bits = CELL_BITS;
+  header.count = lut->count;
+  header.yuv = lut->yuv;
+  for(i = 0; i < lut->count; i++)
+    {
+      header.palette[i * 3] = lut->palette[i].r;
+      header.palette[i * 3 + 1] = lut->palette[i].g;
+      header.palette[i * 3 + 2] = lut->palette[i].b;
+    }
+
+  hash = g_compute_checksum_for_data(G_CHECKSUM_MD5, (const guchar *)&header, offsetof(cache_header_t, candidates));
+  name = g_strdup_printf("%s.lut", hash);
+  path = g_build_filename(cache_dir, name, NULL);
+  if(load_cached(lut, &header, path) != 0)
+    {
+      header.candidates = build_lut(lut);
+      save_cached(lut, &header, path);
+    }
+  g_free(path);
+  g_free(name);
+  g_free(hash);
+}
+
+void quantize_set_cache_dir(const char * dir)
+{
+  g_mutex_lock(&lut_lock);
+  g_free(cache_dir);
+  cache_dir = g_strdup(dir);
+  g_mutex_unlock(&lut_lock);
+}
+
+quantize_lut_t * quantize_get_lut(const color_t * colors, int count, int yuv)
+{
+  quantize_lut_t * lut = NULL;
+  int i;
+
+  if(count > 256)
+    count = 256;
+
+  g_mutex_lock(&lut_lock);
+  for(i = 0; i < lut_count; i++)
+    if(luts[i]->count == count && luts[i]->yuv == yuv
+       && memcmp(luts[i]->palette, colors, count * sizeof(color_t)) == 0)
+      {
+	lut = luts[i];
+	break;
+      }
+
+  if(lut == NULL)
+    {
+      lut = calloc(1, sizeof(quantize_lut_t));
+      memcpy(lut->palette, colors, count * sizeof(color_t));
+      lut->count = count;
+      lut->yuv = yuv;
+      for(i = 0; i < count; i++)
+	to_yuv(colors[i].r, colors[i].g, colors[i].b, &(lut->y[i]), &(lut->u[i]), &(lut->v[i]));
+      cached_lut(lut);
+
+      luts = realloc(luts, (lut_count + 1) * sizeof(quantize_lut_t *));
+      luts[lut_count++] = lut;
+    }
+  g_mutex_unlock(&lut_lock);
+
+  return lut;
+}
+
+int quantize_closest(quantize_lut_t * lut, int r, int g, int b)
+{
+  int cell = ((r >> (8 - CELL_BITS)) << (CELL_BITS * 2)) | ((g >> (8 - CELL_BITS)) << CELL_BITS) | (b >> (8 - CELL_BITS));
+  uint32_t k, end = lut->offsets[cell + 1];
+  double closest_dist = 0xFFFFFFFF, ndist;
+  int closest_id = 0;
+
+  for(k = lut->offsets[cell]; k < end; k++)
+    {
+      ndist = distance(lut, lut->candidates[k], r, g, b);
+      if(ndist < closest_dist)
+	{
+	  closest_id = lut->candidates[k];
+	  closest_dist = ndist;
+	}
+    }
+  return closest_id;
+}
+
+void quantize_remap_table(const color_t * from, int from_count, const color_t * to, int to_count, int yuv, unsigned char * table)
+{
+  quantize_lut_t * lut = quantize_get_lut(to, to_count, yuv);
+  int i;
+
+  for(i = 0; i < 256; i++)
+    if(i < 4)
+      table[i] = i;
+    else if(i < from_count)
+      table[i] = quantize_closest(lut, from[i].r, from[i].g, from[i].b);
+    else
+      table[i] = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+/* Nearest palette color lookups. The RGB cube is split into 32^3 cells
+   that each list the few palette colors which can be nearest to some
+   point inside them, so a lookup only compares those and still returns
+   exactly what closest_color does. */
+typedef struct quantize_lut quantize_lut_t;
+
+/* The table for the first count colors of colors, in RGB or YUV distance.
+   Built on first use and kept for as long as the program runs; safe to
+   call from any thread. */
+quantize_lut_t * quantize_get_lut(const color_t * colors, int count, int yuv);
+
+/* Tables are saved in dir and mapped from there by later runs, instead of
+   being built again. NULL, the default, keeps them in memory only. */
+void quantize_set_cache_dir(const char * dir);
+
+int quantize_closest(quantize_lut_t * lut, int r, int g, int b);
+
+/* Fills the 256 entry table with the nearest to color of every from
+   color. The transparent indices below 4 stay as they are, indices past
+   from_count become 0. */
+void quantize_remap_table(const color_t * from, int from_count, const color_t * to, int to_count, int yuv, unsigned char * table);
+
+#endif
@@ -0,0 +1,100 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "glib_compat.h"
+#include "stats.h"
+#include "trace.h"
+
+static const char * stage_names[STATS_STAGES] =
+  {
+    "decode", "resample", "quantize", "dither", "nbt_build", "deflate", "file_write",
+    "region_read", "chunk_inflate", "chunk_parse", "columns", "render"
+  };
+
+static stats_entry_t entries[STATS_STAGES];
+static gint64 reset_time = 0;
+static GMutex stats_lock;
+
+gint64 stats_start(void)
+{
+  return g_get_monotonic_time();
+}
+
+void stats_add(stats_stage_t stage, gint64 start, gint64 bytes, gint64 items)
+{
+  gint64 end = g_get_monotonic_time();
+  stats_entry_t * entry = &(entries[stage]);
+
+  g_mutex_lock(&stats_lock);
+  if(entry->calls == 0 || start < entry->first)
+    entry->first = start;
+  if(end > entry->last)
+    entry->last = end;
+  entry->calls++;
+  entry->time += end - start;
+  entry->bytes += bytes;
+  entry->items += items;
+  g_mutex_unlock(&stats_lock);
+
+  trace_span("stage", stage_names[stage], start, end, items);
+}
+
+void stats_reset(void)
+{
+  g_mutex_lock(&stats_lock);
+  memset(entries, 0, sizeof(entries));
+  reset_time = g_get_monotonic_time();
+  g_mutex_unlock(&stats_lock);
+}
+
+void stats_get(stats_entry_t * copy)
+{
+  g_mutex_lock(&stats_lock);
+  memcpy(copy, entries, sizeof(entries));
+  g_mutex_unlock(&stats_lock);
+}
+
+const char * stats_stage_name(stats_stage_t stage)
+{
+  return stage_names[stage];
+}
+
+void stats_write_json(FILE * file)
+{
+  stats_entry_t copy[STATS_STAGES];
+  gint64 now = g_get_monotonic_time(), since;
+  int i;
+
+  g_mutex_lock(&stats_lock);
+  memcpy(copy, entries, sizeof(entries));
+  since = reset_time;
+  g_mutex_unlock(&stats_lock);
+
+  /* without a reset, from the first stage on */
+  if(since == 0)
+    for(i = 0; i < STATS_STAGES; i++)
+      if(copy[i].calls && (since == 0 || copy[i].first < since))
+	since = copy[i].first;
+
+  fprintf(file, "{\n  \"elapsed_ms\": %.3f,\n  \"stages\": {", since ? (now - since) / 1000.0 : 0.0);
+  for(i = 0; i < STATS_STAGES; i++)
+    fprintf(file, "%s\n    \"%s\": {\"calls\": %" G_GINT64_FORMAT ", \"total_ms\": %.3f, \"wall_ms\": %.3f, "
+	    "\"bytes\": %" G_GINT64_FORMAT ", \"items\": %" G_GINT64_FORMAT "}",
+	    i ? "," : "", stage_names[i], copy[i].calls, copy[i].time / 1000.0,
+	    (copy[i].last - copy[i].first) / 1000.0, copy[i].bytes, copy[i].items);
+  fprintf(file, "\n  }\n}\n");
+}
@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* Time, bytes and item counts of every stage of the image and world
+   pipelines, summed over all threads since the start or the last reset.
+   Needs glib.h and stdio.h. Recording costs two clock reads and a lock,
+   so stages are recorded per map, chunk or band of rows, never per
+   pixel. */
+
+typedef enum stats_stage
+{
+  STATS_DECODE,		/* image files to pixels */
+  STATS_RESAMPLE,	/* scaling images to the map size before dithering */
+  STATS_QUANTIZE,	/* nearest colors, with the scaling when not dithering */
+  STATS_DITHER,
+  STATS_NBT_BUILD,
+  STATS_DEFLATE,
+  STATS_FILE_WRITE,
+  STATS_REGION_READ,	/* opening region files and reading their headers */
+  STATS_CHUNK_INFLATE,	/* reading and inflating chunks */
+  STATS_CHUNK_PARSE,	/* finding the sections of chunks */
+  STATS_COLUMNS,	/* top blocks of the columns of chunks */
+  STATS_RENDER,		/* shading blocks into maps */
+  STATS_STAGES
+} stats_stage_t;
+
+typedef struct stats_entry
+{
+  gint64 calls, bytes, items;
+  gint64 time; /* microseconds, summed over threads */
+  gint64 first, last; /* monotonic time of the first start and last end */
+} stats_entry_t;
+
+/* The start of a stage, to pass to stats_add when it ends. */
+gint64 stats_start(void);
+void stats_add(stats_stage_t stage, gint64 start, gint64 bytes, gint64 items);
+
+void stats_reset(void);
+/* Copies STATS_STAGES entries to entries. */
+void stats_get(stats_entry_t * entries);
+const char * stats_stage_name(stats_stage_t stage);
+void stats_write_json(FILE * file);
+
+#endif
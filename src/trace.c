@@ -0,0 +1,204 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "glib_compat.h"
+#include "trace.h"
+
+#define TRACE_EVENTS 32768 /* per thread */
+#define TRACE_NAME 32
+
+typedef struct trace_event
+{
+  const char * category, * name;
+  gint64 start, end, items;
+} trace_event_t;
+
+/* Only its thread writes to a buffer. Buffers are never freed, one of a
+   thread that ended is taken over by the next new thread, so a row of
+   the timeline can show several threads one after the other. */
+typedef struct trace_thread
+{
+  struct trace_thread * next;
+  volatile gint owned;
+  int id;
+  char name[TRACE_NAME];
+  gint generation; /* of the events in the buffer */
+  volatile gint count; /* events recorded, the last TRACE_EVENTS are kept */
+  trace_event_t events[TRACE_EVENTS];
+} trace_thread_t;
+
+static volatile gint enabled = 0;
+static volatile gint generation = 0;
+static gint64 origin = 0;
+static trace_thread_t * volatile threads = NULL;
+static volatile gint thread_count = 0;
+
+static void trace_release_thread(gpointer data)
+{
+  g_atomic_int_set(&((trace_thread_t *)data)->owned, 0);
+}
+
+static GPrivate current_thread = G_PRIVATE_INIT(trace_release_thread);
+
+static trace_thread_t * trace_get_thread(void)
+{
+  trace_thread_t * thread = g_private_get(&current_thread);
+
+  if(thread != NULL)
+    return thread;
+
+  for(thread = g_atomic_pointer_get(&threads); thread != NULL; thread = thread->next)
+    if(g_atomic_int_compare_and_exchange(&thread->owned, 0, 1))
+      break;
+
+  if(thread == NULL)
+    {
+      thread = calloc(1, sizeof(trace_thread_t));
+      thread->owned = 1;
+      thread->id = g_atomic_int_add(&thread_count, 1) + 1;
+      do
+	thread->next = g_atomic_pointer_get(&threads);
+      while(!g_atomic_pointer_compare_and_exchange(&threads, thread->next, thread));
+    }
+  sprintf(thread->name, "thread %i", thread->id);
+  g_private_set(&current_thread, thread);
+  return thread;
+}
+
+void trace_enable(void)
+{
+  origin = g_get_monotonic_time();
+  g_atomic_int_add(&generation, 1);
+  g_atomic_int_set(&enabled, 1);
+}
+
+void trace_disable(void)
+{
+  g_atomic_int_set(&enabled, 0);
+}
+
+int trace_is_enabled(void)
+{
+  return g_atomic_int_get(&enabled);
+}
+
+gint64 trace_now(void)
+{
+  return g_atomic_int_get(&enabled) ? g_get_monotonic_time() : 0;
+}
+
+void trace_span(const char * category, const char * name, gint64 start, gint64 end, gint64 items)
+{
+  trace_thread_t * thread;
+  trace_event_t * event;
+  gint count, current;
+
+  if(start == 0 || !g_atomic_int_get(&enabled))
+    return;
+
+  thread = trace_get_thread();
+  current = g_atomic_int_get(&generation);
+  if(thread->generation != current)
+    {
+      thread->generation = current;
+      g_atomic_int_set(&thread->count, 0);
+    }
+
+  count = thread->count;
+  event = &(thread->events[count % TRACE_EVENTS]);
+  event->category = category;
+  event->name = name;
+  event->start = start;
+  event->end = end;
+  event->items = items;
+  /* published after the event, so a reader never sees it half done */
+  g_atomic_int_set(&thread->count, count + 1);
+}
+
+void trace_name_thread(const char * name)
+{
+  if(g_atomic_int_get(&enabled))
+    g_strlcpy(trace_get_thread()->name, name, TRACE_NAME);
+}
+
+static void write_json_string(FILE * file, const char * string)
+{
+  fputc('"', file);
+  for(; *string != '\0'; string++)
+    {
+      unsigned char c = (unsigned char)*string;
+
+      if(c == '"' || c == '\\')
+	fprintf(file, "\\%c", c);
+      else if(c < 0x20)
+	fprintf(file, "\\u%04x", c);
+      else
+	fputc(c, file);
+    }
+  fputc('"', file);
+}
+
+int trace_write_json(const char * path)
+{
+  FILE * file = fopen(path, "w");
+  trace_thread_t * thread;
+  gint current = g_atomic_int_get(&generation);
+  const char * separator = "\n";
+  char name[TRACE_NAME];
+  int i, count;
+
+  if(file == NULL)
+    return -1;
+
+  fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for(thread = g_atomic_pointer_get(&threads); thread != NULL; thread = thread->next)
+    {
+      if(thread->generation != current)
+	continue;
+
+      /* the thread may rename itself while we read */
+      memcpy(name, thread->name, TRACE_NAME);
+      name[TRACE_NAME - 1] = '\0';
+      fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": ",
+	      separator, thread->id);
+      write_json_string(file, name);
+      fprintf(file, "}}");
+      separator = ",\n";
+
+      count = g_atomic_int_get(&thread->count);
+      for(i = MAX(0, count - TRACE_EVENTS); i < count; i++)
+	{
+	  trace_event_t event = thread->events[i % TRACE_EVENTS];
+
+	  /* the slot is reused for event i + TRACE_EVENTS, which may have
+	     been started while it was copied */
+	  if(g_atomic_int_get(&thread->count) >= i + TRACE_EVENTS || event.start < origin)
+	    continue;
+	  fprintf(file, ",\n{\"name\": ");
+	  write_json_string(file, event.name);
+	  fprintf(file, ", \"cat\": ");
+	  write_json_string(file, event.category);
+	  fprintf(file, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %i, "
+		  "\"ts\": %" G_GINT64_FORMAT ", \"dur\": %" G_GINT64_FORMAT ", \"args\": {\"items\": %" G_GINT64_FORMAT "}}",
+		  thread->id, event.start - origin, event.end - event.start, event.items);
+	}
+    }
+  fprintf(file, "\n]}\n");
+
+  return fclose(file) == 0 ? 0 : -1;
+}
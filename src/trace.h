@@ -0,0 +1,28 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* An optional timeline of what every thread did, written as Chrome
+   trace_event JSON for chrome://tracing or Perfetto. Needs glib.h. Every
+   thread writes its spans into a ring buffer of its own without locking,
+   so the oldest spans of a thread are lost once it recorded more than
+   the buffer holds. Nothing is recorded while disabled, which is the
+   default. */
+
+void trace_enable(void);
+void trace_disable(void);
+int trace_is_enabled(void);
+
+/* The start of a span to pass to trace_span, 0 while disabled so spans
+   started before enabling are dropped. */
+gint64 trace_now(void);
+/* Records a span of the calling thread. name and category must stay
+   valid, they are only written out by trace_write_json. */
+void trace_span(const char * category, const char * name, gint64 start, gint64 end, gint64 items);
+/* Names the calling thread in the timeline. */
+void trace_name_thread(const char * name);
+
+/* Writes the spans since trace_enable, returns -1 if path can't be
+   written. Spans recorded meanwhile may be missing. */
+int trace_write_json(const char * path);
+
+#endif
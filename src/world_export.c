@@ -0,0 +1,167 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+ 
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "nbtsave.h"
+#include "parallel.h"
+#include "map_render.h"
+#include "png_stream.h"
+#include "world_export.h"
+
+/* The world is rendered in bands of rows so that the block columns held at
+   once stay within this budget, whatever the size of the export. */
+#define BAND_BUDGET (32 * 1024 * 1024)
+/* the width of a region file */
+#define STRIP_WIDTH 512
+
+typedef struct band_request
+{
+  const char * regionpath;
+  block_info_t * blocks;
+  int x, z, width, height;
+} band_request_t;
+
+/* Splits reading a band into strips for the worker threads. The strips
+   are aligned to region files, so each file and chunk is read by one of
+   them only, and each one in flight holds its own copy on top of the
+   band. */
+static int count_strips(band_request_t * request)
+{
+  return ((request->x + request->width - 1) >> 9) - (request->x >> 9) + 1;
+}
+
+static void read_band_strips(int start, int end, void * user_data)
+{
+  band_request_t * request = (band_request_t *)user_data;
+  int k, j;
+
+  for(k = start; k < end; k++)
+    {
+      int rx = (request->x >> 9) + k;
+      int sx = MAX(rx * STRIP_WIDTH - request->x, 0);
+      int sw = MIN((rx + 1) * STRIP_WIDTH - request->x, request->width) - sx;
+      block_info_t * strip = read_region_files(request->regionpath, request->x + sx, request->z,
+					       sw, request->height);
+
+      for(j = 0; j < request->height; j++)
+	memcpy(&(request->blocks[sx + j * request->width]), &(strip[j * sw]), sw * sizeof(block_info_t));
+      free(strip);
+    }
+}
+
+int world_export_png(const char * regionpath, const char * filename, int x, int z, int width, int height,
+		     int scale, const color_t * colors, int level, progress_t * progress)
+{
+  int out_width = width >> scale, out_height = height >> scale;
+  int band_rows, first_rows, rows, row, i, j;
+  long row_bytes;
+  double * lasth;
+  unsigned char * data, * rgba;
+  band_request_t request;
+  png_stream_t * png;
+  int ret = 0;
+
+  if(out_width <= 0 || out_height <= 0)
+    return -1;
+
+  png = png_stream_open(filename, out_width, out_height, 4, level);
+  if(png == NULL)
+    return -1;
+
+  row_bytes = (long)(out_width << scale) * sizeof(block_info_t) << scale;
+  band_rows = BAND_BUDGET / row_bytes;
+  if(band_rows < 1)
+    band_rows = 1;
+  /* bands end on the chunk grid when z and the band size allow it, the
+     first one at the first chunk edge, so no chunk is inflated by two
+     bands; otherwise the chunks on band edges are read twice */
+  first_rows = band_rows;
+  if(scale < 4 && (z & ((1 << scale) - 1)) == 0 && (band_rows << scale) >= 16)
+    {
+      int step = 16 >> scale, lead = ((-z) & 15) >> scale;
+
+      band_rows -= band_rows % step;
+      if(lead > 0)
+	first_rows = band_rows - step + lead;
+      else
+	first_rows = band_rows;
+    }
+  if(band_rows > out_height)
+    band_rows = out_height;
+
+  request.regionpath = regionpath;
+  request.blocks = malloc(row_bytes * band_rows);
+  request.x = x;
+  request.width = out_width << scale;
+
+  data = malloc(out_width * band_rows);
+  rgba = malloc(out_width * 4);
+  lasth = calloc(out_width, sizeof(double));
+
+  for(row = 0; row < out_height && ret == 0; row += rows)
+    {
+      rows = (row == 0) ? first_rows : band_rows;
+      if(row + rows > out_height)
+	rows = out_height - row;
+
+      if(progress_set(progress, row, out_height))
+	{
+	  ret = -1;
+	  break;
+	}
+      request.z = z + (row << scale);
+      request.height = rows << scale;
+      memset(request.blocks, 0, row_bytes * rows);
+      parallel_for(count_strips(&request), 1, read_band_strips, &request);
+
+      render_map_rows(request.blocks, data, lasth, out_width, rows, row, scale);
+
+      for(j = 0; j < rows && ret == 0; j++)
+	{
+	  for(i = 0; i < out_width; i++)
+	    {
+	      unsigned char c = data[i + j * out_width];
+	      if(c > 3)
+		{
+		  rgba[i * 4] = colors[c].r;
+		  rgba[i * 4 + 1] = colors[c].g;
+		  rgba[i * 4 + 2] = colors[c].b;
+		  rgba[i * 4 + 3] = 0xFF;
+		}
+	      else
+		memset(&(rgba[i * 4]), 0, 4);
+	    }
+	  ret = png_stream_write_row(png, rgba);
+	}
+    }
+
+  free(lasth);
+  free(rgba);
+  free(data);
+  free(request.blocks);
+
+  if(png_stream_close(png) != 0)
+    ret = -1;
+  if(progress_cancelled(progress))
+    remove(filename);
+  else
+    progress_set(progress, 1, 1);
+  return ret;
+}
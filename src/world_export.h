@@ -0,0 +1,12 @@
+#ifndef WORLD_EXPORT_H
+#define WORLD_EXPORT_H
+
+/* Renders the blocks [x, x + width) x [z, z + height) to a PNG with one
+   pixel per 1 << scale blocks, using the same shading as map renders.
+   Rows are rendered and encoded in bands, so the image is never held in
+   memory. Returns -1 if the file couldn't be written or progress was
+   cancelled, a cancelled export removes the partial file. */
+int world_export_png(const char * regionpath, const char * filename, int x, int z, int width, int height,
+		     int scale, const color_t * colors, int level, progress_t * progress);
+
+#endif
@@ -0,0 +1,345 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "nbtsave.h"
+#include "parallel.h"
+#include "png_stream.h"
+#include "world_overview.h"
+
+#define SEA_LEVEL 63
+/* 8192 * 8192 chunks, a stray region file far from the rest shouldn't
+   make the overview take gigabytes */
+#define MAX_CELLS (64 * 1024 * 1024)
+
+typedef struct overview_pass
+{
+  world_overview_t * overview;
+  const char * regionpath;
+  int * regions; /* rx, rz pairs */
+} overview_pass_t;
+
+static FILE * open_region(const char * regionpath, int rx, int rz)
+{
+  char pathbuffer[1024];
+  if(snprintf(pathbuffer, sizeof(pathbuffer), "%s/r.%i.%i.mca", regionpath, rx, rz) >= (int)sizeof(pathbuffer))
+    return NULL;
+  return fopen(pathbuffer, "rb");
+}
+
+static void scan_regions(int start, int end, void * user_data)
+{
+  overview_pass_t * pass = (overview_pass_t *)user_data;
+  world_overview_t * overview = pass->overview;
+  uint32_t locations[1024], timestamps[1024];
+  int k, ci, cj;
+
+  for(k = start; k < end; k++)
+    {
+      int rx = pass->regions[k * 2], rz = pass->regions[k * 2 + 1];
+      FILE * regionfile = open_region(pass->regionpath, rx, rz);
+
+      if(regionfile == NULL)
+	continue;
+      if(read_region_file_header(regionfile, locations, timestamps) == 0)
+	for(cj = 0; cj < 32; cj++)
+	  for(ci = 0; ci < 32; ci++)
+	    {
+	      int index = (rx * 32 + ci - overview->x) + (rz * 32 + cj - overview->z) * overview->width;
+	      if(locations[ci + cj * 32] >> 8 == 0)
+		continue;
+	      /* chunks without a timestamp still exist */
+	      overview->timestamps[index] = timestamps[ci + cj * 32] ? timestamps[ci + cj * 32] : 1;
+	    }
+      fclose(regionfile);
+    }
+}
+
+static void read_region_heights(int start, int end, void * user_data)
+{
+  overview_pass_t * pass = (overview_pass_t *)user_data;
+  world_overview_t * overview = pass->overview;
+  uint32_t locations[1024];
+  int heightmap[256];
+  int k, ci, cj, i;
+
+  for(k = start; k < end; k++)
+    {
+      int rx = pass->regions[k * 2], rz = pass->regions[k * 2 + 1];
+      FILE * regionfile = open_region(pass->regionpath, rx, rz);
+
+      if(regionfile == NULL)
+	continue;
+      if(read_region_file_header(regionfile, locations, NULL) == 0)
+	for(cj = 0; cj < 32; cj++)
+	  for(ci = 0; ci < 32; ci++)
+	    {
+	      int index = (rx * 32 + ci - overview->x) + (rz * 32 + cj - overview->z) * overview->width;
+	      int sum = 0;
+
+	      if(read_region_chunk_heightmap(regionfile, locations[ci + cj * 32], heightmap) != 0)
+		continue;
+	      for(i = 0; i < 256; i++)
+		sum += heightmap[i];
+	      overview->heights[index] = sum / 256;
+	    }
+      fclose(regionfile);
+    }
+}
+
+/* The region coordinates of every r.x.z.mca in regionpath as rx, rz pairs. */
+static int * list_regions(const char * regionpath, int * count)
+{
+  GDir * dir = g_dir_open(regionpath, 0, NULL);
+  const char * name;
+  int * regions = NULL;
+  int size = 0;
+
+  *count = 0;
+  if(dir == NULL)
+    return NULL;
+
+  while((name = g_dir_read_name(dir)) != NULL)
+    {
+      int rx, rz, end = 0;
+      if(sscanf(name, "r.%d.%d.mca%n", &rx, &rz, &end) != 2 || end == 0 || name[end] != '\0')
+	continue;
+
+      if(*count == size)
+	{
+	  int * grown;
+	  size = size ? size * 2 : 64;
+	  grown = realloc(regions, size * 2 * sizeof(int));
+	  if(grown == NULL)
+	    {
+	      free(regions);
+	      g_dir_close(dir);
+	      *count = 0;
+	      return NULL;
+	    }
+	  regions = grown;
+	}
+      regions[*count * 2] = rx;
+      regions[*count * 2 + 1] = rz;
+      (*count)++;
+    }
+  g_dir_close(dir);
+  return regions;
+}
+
+world_overview_t * world_overview_scan(const char * regionpath)
+{
+  world_overview_t * overview;
+  overview_pass_t pass;
+  int minx = 0, minz = 0, maxx = 0, maxz = 0;
+  int64_t columns, rows;
+  size_t cells, i;
+  int count, k;
+  int * regions = list_regions(regionpath, &count);
+
+  if(count == 0)
+    {
+      free(regions);
+      return NULL;
+    }
+
+  for(k = 0; k < count; k++)
+    {
+      if(k == 0 || regions[k * 2] < minx)
+	minx = regions[k * 2];
+      if(k == 0 || regions[k * 2] > maxx)
+	maxx = regions[k * 2];
+      if(k == 0 || regions[k * 2 + 1] < minz)
+	minz = regions[k * 2 + 1];
+      if(k == 0 || regions[k * 2 + 1] > maxz)
+	maxz = regions[k * 2 + 1];
+    }
+
+  columns = ((int64_t)maxx - minx + 1) * 32;
+  rows = ((int64_t)maxz - minz + 1) * 32;
+  if(columns > MAX_CELLS / rows)
+    {
+      free(regions);
+      return NULL;
+    }
+  cells = (size_t)(columns * rows);
+
+  overview = calloc(1, sizeof(world_overview_t));
+  if(overview == NULL)
+    {
+      free(regions);
+      return NULL;
+    }
+  overview->x = minx * 32;
+  overview->z = minz * 32;
+  overview->width = (int)columns;
+  overview->height = (int)rows;
+  overview->region_count = count;
+  overview->regions = regions;
+  overview->timestamps = calloc(cells, sizeof(uint32_t));
+  if(overview->timestamps == NULL)
+    {
+      world_overview_free(overview);
+      return NULL;
+    }
+
+  /* every region writes its own 32 * 32 cells */
+  pass.overview = overview;
+  pass.regionpath = regionpath;
+  pass.regions = regions;
+  parallel_for(count, 1, scan_regions, &pass);
+
+  for(i = 0; i < cells; i++)
+    {
+      uint32_t t = overview->timestamps[i];
+      if(t == 0)
+	continue;
+      if(overview->chunk_count == 0 || t < overview->oldest)
+	overview->oldest = t;
+      if(overview->chunk_count == 0 || t > overview->newest)
+	overview->newest = t;
+      overview->chunk_count++;
+    }
+
+  return overview;
+}
+
+void world_overview_free(world_overview_t * overview)
+{
+  if(overview == NULL)
+    return;
+  free(overview->regions);
+  free(overview->timestamps);
+  free(overview->heights);
+  free(overview);
+}
+
+int world_overview_read_heights(world_overview_t * overview, const char * regionpath)
+{
+  overview_pass_t pass;
+  size_t cells = (size_t)overview->width * overview->height, i;
+
+  if(overview->heights == NULL)
+    overview->heights = malloc(cells * sizeof(int16_t));
+  if(overview->heights == NULL)
+    return -1;
+  for(i = 0; i < cells; i++)
+    overview->heights[i] = -1;
+
+  /* the regions of the scan, a file added since would fall outside the
+     overview */
+  pass.overview = overview;
+  pass.regionpath = regionpath;
+  pass.regions = overview->regions;
+  parallel_for(overview->region_count, 1, read_region_heights, &pass);
+  return 0;
+}
+
+/* blue -> cyan -> green -> yellow -> red */
+static void age_color(double t, unsigned char * rgb)
+{
+  static const unsigned char stops[5][3] =
+    {{0, 0, 192}, {0, 192, 224}, {0, 200, 0}, {240, 220, 0}, {224, 0, 0}};
+  int s = (int)(t * 4);
+  double f;
+  int c;
+
+  if(s >= 4)
+    s = 3;
+  f = t * 4 - s;
+  for(c = 0; c < 3; c++)
+    rgb[c] = (unsigned char)(stops[s][c] + (stops[s + 1][c] - stops[s][c]) * f);
+}
+
+static void height_color(int h, int northh, unsigned char * rgb)
+{
+  double shade = 1.0;
+  int c;
+
+  if(h <= SEA_LEVEL)
+    {
+      rgb[0] = 40;
+      rgb[1] = 60;
+      rgb[2] = 140 + h * 80 / SEA_LEVEL;
+      return;
+    }
+
+  /* lit from the north, like map renders */
+  if(northh >= 0)
+    shade = (h > northh) ? 1.15 : (h < northh) ? 0.8 : 1.0;
+
+  if(h < 90)
+    {
+      rgb[0] = 80;
+      rgb[1] = 150 - (h - SEA_LEVEL);
+      rgb[2] = 50;
+    }
+  else if(h < 128)
+    {
+      rgb[0] = 130;
+      rgb[1] = 110;
+      rgb[2] = 80;
+    }
+  else
+    rgb[0] = rgb[1] = rgb[2] = 230;
+
+  for(c = 0; c < 3; c++)
+    rgb[c] = (rgb[c] * shade > 255) ? 255 : (unsigned char)(rgb[c] * shade);
+}
+
+void world_overview_render_row(world_overview_t * overview, int row, int shaded, unsigned char * rgba)
+{
+  uint32_t span = overview->newest - overview->oldest;
+  int i;
+
+  for(i = 0; i < overview->width; i++)
+    {
+      int index = i + row * overview->width;
+      unsigned char * p = &(rgba[i * 4]);
+
+      p[3] = 255;
+      if(shaded && overview->heights != NULL && overview->heights[index] >= 0)
+	height_color(overview->heights[index], row ? overview->heights[index - overview->width] : -1, p);
+      else if(!shaded && overview->timestamps[index])
+	age_color(span ? (double)(overview->timestamps[index] - overview->oldest) / span : 1.0, p);
+      else
+	p[0] = p[1] = p[2] = p[3] = 0;
+    }
+}
+
+int world_overview_write_png(world_overview_t * overview, const char * filename, int shaded, int level)
+{
+  png_stream_t * png = png_stream_open(filename, overview->width, overview->height, 4, level);
+  unsigned char * rgba;
+  int j;
+
+  if(png == NULL)
+    return -1;
+
+  rgba = malloc(overview->width * 4);
+  for(j = 0; j < overview->height; j++)
+    {
+      world_overview_render_row(overview, j, shaded, rgba);
+      png_stream_write_row(png, rgba);
+    }
+  free(rgba);
+
+  return png_stream_close(png);
+}
@@ -0,0 +1,34 @@
+#ifndef WORLD_OVERVIEW_H
+#define WORLD_OVERVIEW_H
+
+/* One cell per chunk of every region file in a directory, built from the
+   region headers alone. */
+typedef struct world_overview
+{
+  int x, z; /* chunk coordinates of the top left cell */
+  int width, height; /* in chunks */
+  int region_count;
+  int * regions; /* rx, rz pairs of the region files scanned */
+  int chunk_count;
+  uint32_t oldest, newest;
+  uint32_t * timestamps; /* 0 where there is no chunk */
+  int16_t * heights; /* average HeightMap value per chunk, -1 where unknown, NULL until read */
+} world_overview_t;
+
+/* Reads the location and timestamp tables of every r.x.z.mca in
+   regionpath. Returns NULL if there are no region files, or if they span
+   more than 8192 * 8192 chunks or the overview doesn't fit in memory. */
+world_overview_t * world_overview_scan(const char * regionpath);
+void world_overview_free(world_overview_t * overview);
+
+/* The optional second pass, inflates every chunk of the scanned regions for
+   its HeightMap. Returns -1 if the heights don't fit in memory. */
+int world_overview_read_heights(world_overview_t * overview, const char * regionpath);
+
+/* Writes one RGBA row of width pixels. Without shading the row is an age
+   heatmap, from blue for the oldest chunks to red for the newest; shaded
+   needs world_overview_read_heights. Missing chunks are transparent. */
+void world_overview_render_row(world_overview_t * overview, int row, int shaded, unsigned char * rgba);
+int world_overview_write_png(world_overview_t * overview, const char * filename, int shaded, int level);
+
+#endif
@@ -0,0 +1,377 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+ 
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "quantize.h"
+#include "palette_tables.h"
+#include "nbtsave.h"
+#include "parallel.h"
+#include "map_render.h"
+#include "world_watch.h"
+
+#define WATCH_MAGIC 0x57544D49 /* "IMTW" */
+#define WATCH_VERSION 2
+/* a saved map without its regions */
+#define WATCH_MAP_SIZE (sizeof(((watch_map_t *)0)->filename) + sizeof(((watch_map_t *)0)->regionpath) \
+			+ sizeof(map_data_t) + sizeof(((watch_map_t *)0)->data) \
+			+ sizeof(((watch_map_t *)0)->heights) + sizeof(int))
+
+typedef struct watch_buffer
+{
+  unsigned char * data;
+  long size, capacity, offset;
+} watch_buffer_t;
+
+static int get_map_origin(map_data_t * info, int * x, int * z)
+{
+  int rs = 128 << info->scale;
+
+  *x = info->xpos - rs / 2;
+  *z = info->zpos - rs / 2;
+  return rs;
+}
+
+static int64_t get_region_mtime(const char * regionpath, int rx, int rz)
+{
+  char pathbuffer[1024];
+  struct stat info;
+
+  if(snprintf(pathbuffer, sizeof(pathbuffer), "%s/r.%i.%i.mca", regionpath, rx, rz) >= (int)sizeof(pathbuffer)
+     || stat(pathbuffer, &info) < 0)
+    return 0;
+  return (int64_t)info.st_mtime;
+}
+
+static void snapshot_region(const char * regionpath, watch_region_t * region)
+{
+  region->mtime = get_region_mtime(regionpath, region->rx, region->rz);
+  if(read_region_header(regionpath, region->rx, region->rz, NULL, region->timestamps) != 0)
+    memset(region->timestamps, 0, sizeof(region->timestamps));
+}
+
+static void save_watch_map(watch_map_t * map)
+{
+  nbt_save_map(map->filename, map->info.dimension, map->info.scale,
+	       128, 128, map->info.xpos, map->info.zpos, map->data);
+}
+
+world_watch_t * world_watch_new(void)
+{
+  world_watch_t * watch = malloc(sizeof(world_watch_t));
+  watch->map_count = 0;
+  watch->maps = NULL;
+  return watch;
+}
+
+void world_watch_free(world_watch_t * watch)
+{
+  int i;
+
+  if(watch == NULL)
+    return;
+
+  for(i = 0; i < watch->map_count; i++)
+    free(watch->maps[i].regions);
+  free(watch->maps);
+  free(watch);
+}
+
+void world_watch_add_map(world_watch_t * watch, const char * regionpath, const char * filename,
+			 int x, int z, int scale, int dimension)
+{
+  watch_map_t * map;
+  block_info_t * blocks;
+  int startx, startz, rs;
+  int rx, rz, i;
+
+  watch->maps = realloc(watch->maps, (watch->map_count + 1) * sizeof(watch_map_t));
+  map = &(watch->maps[watch->map_count]);
+  watch->map_count++;
+
+  snprintf(map->filename, sizeof(map->filename), "%s", filename);
+  snprintf(map->regionpath, sizeof(map->regionpath), "%s", regionpath);
+  map->info.xpos = x;
+  map->info.zpos = z;
+  map->info.scale = scale;
+  map->info.dimension = dimension;
+  map->info.palette = PALETTE_DEFAULT;
+
+  rs = get_map_origin(&(map->info), &startx, &startz);
+
+  /* the headers are read before the chunks, so a chunk written while we
+     render is picked up by the next update rather than lost */
+  map->region_count = ((((startx + rs - 1) >> 9) - (startx >> 9)) + 1)
+    * ((((startz + rs - 1) >> 9) - (startz >> 9)) + 1);
+  map->regions = malloc(map->region_count * sizeof(watch_region_t));
+
+  i = 0;
+  for(rx = startx >> 9; rx <= (startx + rs - 1) >> 9; rx++)
+    for(rz = startz >> 9; rz <= (startz + rs - 1) >> 9; rz++)
+      {
+	map->regions[i].rx = rx;
+	map->regions[i].rz = rz;
+	snapshot_region(regionpath, &(map->regions[i]));
+	i++;
+      }
+
+  blocks = read_region_files(regionpath, startx, startz, rs, rs);
+  render_map_area(blocks, map->data, map->heights, 128, 128, scale);
+  free(blocks);
+
+  save_watch_map(map);
+}
+
+/* Re-reads the block columns under the map pixels [px0, px1] x [pz0, pz1]. */
+static void reduce_pixels(watch_map_t * map, map_cell_t * cells, int px0, int pz0, int px1, int pz1)
+{
+  int startx, startz;
+  int scale = map->info.scale;
+  int w = px1 - px0 + 1, h = pz1 - pz0 + 1;
+  int i, j;
+  block_info_t * blocks;
+
+  get_map_origin(&(map->info), &startx, &startz);
+  blocks = read_region_files(map->regionpath, startx + (px0 << scale), startz + (pz0 << scale),
+			     w << scale, h << scale);
+
+  for(i = 0; i < w; i++)
+    for(j = 0; j < h; j++)
+      render_reduce_cell(blocks, w << scale, scale, i, j, &(cells[(px0 + i) + (pz0 + j) * 128]));
+
+  free(blocks);
+}
+
+static int watch_map_update(watch_map_t * map)
+{
+  unsigned char dirty[128 * 128];
+  map_cell_t * cells = NULL;
+  uint32_t timestamps[1024];
+  int startx, startz, rs;
+  int scale = map->info.scale;
+  int r, ci, cj, i, j;
+  int left, top, right, bottom; /* pixels covered by the changed chunks of a region */
+  int changed = 0;
+
+  memset(dirty, 0, sizeof(dirty));
+  rs = get_map_origin(&(map->info), &startx, &startz);
+
+  for(r = 0; r < map->region_count; r++)
+    {
+      watch_region_t * region = &(map->regions[r]);
+      int64_t mtime = get_region_mtime(map->regionpath, region->rx, region->rz);
+
+      if(mtime == region->mtime)
+	continue;
+
+      if(read_region_header(map->regionpath, region->rx, region->rz, NULL, timestamps) != 0)
+	memset(timestamps, 0, sizeof(timestamps));
+
+      /* the changed chunks of a region are read back in one pass over the
+	 rectangle of pixels around them */
+      left = top = 128;
+      right = bottom = -1;
+      for(ci = 0; ci < 32; ci++)
+	for(cj = 0; cj < 32; cj++)
+	  {
+	    /* chunk position relative to the map area, in blocks */
+	    int bx = (region->rx * 32 + ci) * 16 - startx;
+	    int bz = (region->rz * 32 + cj) * 16 - startz;
+	    int px0, pz0, px1, pz1;
+
+	    if(bx + 16 <= 0 || bx >= rs || bz + 16 <= 0 || bz >= rs)
+	      continue;
+	    if(timestamps[ci + cj * 32] == region->timestamps[ci + cj * 32])
+	      continue;
+
+	    px0 = ((bx < 0) ? 0 : bx) >> scale;
+	    pz0 = ((bz < 0) ? 0 : bz) >> scale;
+	    px1 = (((bx + 16 > rs) ? rs : bx + 16) - 1) >> scale;
+	    pz1 = (((bz + 16 > rs) ? rs : bz + 16) - 1) >> scale;
+
+	    if(px0 < left)
+	      left = px0;
+	    if(pz0 < top)
+	      top = pz0;
+	    if(px1 > right)
+	      right = px1;
+	    if(pz1 > bottom)
+	      bottom = pz1;
+	    for(i = px0; i <= px1; i++)
+	      for(j = pz0; j <= pz1; j++)
+		dirty[i + j * 128] = 1;
+	  }
+
+      if(right >= 0)
+	{
+	  if(cells == NULL)
+	    cells = malloc(128 * 128 * sizeof(map_cell_t));
+	  reduce_pixels(map, cells, left, top, right, bottom);
+	  changed = 1;
+	}
+
+      region->mtime = mtime;
+      memcpy(region->timestamps, timestamps, sizeof(timestamps));
+    }
+
+  if(!changed)
+    return 0;
+
+  /* the new heights have to be in place before shading, a changed pixel
+     may be the northern neighbour of another one */
+  for(i = 0; i < 128 * 128; i++)
+    if(dirty[i])
+      map->heights[i] = cells[i].h;
+
+  for(i = 0; i < 128; i++)
+    for(j = 0; j < 128; j++)
+      {
+	double lasth = (j == 0) ? 0.0 : map->heights[i + (j - 1) * 128];
+
+	if(dirty[i + j * 128])
+	  map->data[i + j * 128] = render_shade_cell(&(cells[i + j * 128]), lasth, scale, i, j);
+	else if(j > 0 && dirty[i + (j - 1) * 128])
+	  map->data[i + j * 128] = render_reshade_pixel(map->data[i + j * 128], map->heights[i + j * 128],
+							lasth, scale, i, j);
+      }
+
+  free(cells);
+  save_watch_map(map);
+  return 1;
+}
+
+int world_watch_update(world_watch_t * watch)
+{
+  int i, saved = 0;
+
+  for(i = 0; i < watch->map_count; i++)
+    saved += watch_map_update(&(watch->maps[i]));
+
+  return saved;
+}
+
+static void watch_put(watch_buffer_t * buffer, const void * data, long size)
+{
+  if(buffer->size + size > buffer->capacity)
+    {
+      while(buffer->size + size > buffer->capacity)
+	buffer->capacity = (buffer->capacity == 0) ? 4096 : buffer->capacity * 2;
+      buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+static int watch_get(watch_buffer_t * buffer, void * data, long size)
+{
+  if(buffer->offset + size > buffer->size)
+    return -1;
+  memcpy(data, buffer->data + buffer->offset, size);
+  buffer->offset += size;
+  return 0;
+}
+
+int world_watch_save(world_watch_t * watch, const char * filename)
+{
+  watch_buffer_t buffer = {NULL, 0, 0, 0};
+  int32_t header[3] = {WATCH_MAGIC, WATCH_VERSION, watch->map_count};
+  FILE * dest;
+  int i, ret;
+
+  watch_put(&buffer, header, sizeof(header));
+  for(i = 0; i < watch->map_count; i++)
+    {
+      watch_map_t * map = &(watch->maps[i]);
+      watch_put(&buffer, map->filename, sizeof(map->filename));
+      watch_put(&buffer, map->regionpath, sizeof(map->regionpath));
+      watch_put(&buffer, &(map->info), sizeof(map_data_t));
+      watch_put(&buffer, map->data, sizeof(map->data));
+      watch_put(&buffer, map->heights, sizeof(map->heights));
+      watch_put(&buffer, &(map->region_count), sizeof(int));
+      watch_put(&buffer, map->regions, map->region_count * sizeof(watch_region_t));
+    }
+
+  dest = fopen(filename, "wb");
+  if(dest == NULL)
+    {
+      free(buffer.data);
+      return -1;
+    }
+  ret = deflatenbt(buffer.data, buffer.size, dest, 9);
+  fclose(dest);
+  free(buffer.data);
+
+  return (ret == 0) ? 0 : -1;
+}
+
+world_watch_t * world_watch_load(const char * filename)
+{
+  watch_buffer_t buffer = {NULL, -1, 0, 0};
+  world_watch_t * watch;
+  int32_t header[3];
+  FILE * source;
+  int i;
+
+  source = fopen(filename, "rb");
+  if(source == NULL)
+    return NULL;
+  buffer.data = inflatenbt(source, &(buffer.size), 1);
+  fclose(source);
+  if(buffer.data == NULL)
+    return NULL;
+
+  if(watch_get(&buffer, header, sizeof(header)) != 0 || header[0] != WATCH_MAGIC || header[1] != WATCH_VERSION
+     || header[2] < 0 || (size_t)header[2] > (size_t)(buffer.size - buffer.offset) / WATCH_MAP_SIZE)
+    {
+      free(buffer.data);
+      return NULL;
+    }
+
+  watch = world_watch_new();
+  watch->maps = calloc(header[2], sizeof(watch_map_t));
+  for(i = 0; i < header[2]; i++)
+    {
+      watch_map_t * map = &(watch->maps[i]);
+      if(watch_get(&buffer, map->filename, sizeof(map->filename)) != 0
+	 || watch_get(&buffer, map->regionpath, sizeof(map->regionpath)) != 0
+	 || watch_get(&buffer, &(map->info), sizeof(map_data_t)) != 0
+	 || watch_get(&buffer, map->data, sizeof(map->data)) != 0
+	 || watch_get(&buffer, map->heights, sizeof(map->heights)) != 0
+	 || watch_get(&buffer, &(map->region_count), sizeof(int)) != 0
+	 || map->region_count < 0
+	 || (size_t)map->region_count > (size_t)(buffer.size - buffer.offset) / sizeof(watch_region_t))
+	break;
+      map->filename[sizeof(map->filename) - 1] = '\0';
+      map->regionpath[sizeof(map->regionpath) - 1] = '\0';
+
+      map->regions = malloc(map->region_count * sizeof(watch_region_t));
+      watch->map_count++;
+      if(watch_get(&buffer, map->regions, map->region_count * sizeof(watch_region_t)) != 0)
+	break;
+    }
+  free(buffer.data);
+
+  if(watch->map_count != header[2])
+    {
+      world_watch_free(watch);
+      return NULL;
+    }
+  return watch;
+}
@@ -0,0 +1,48 @@
+#ifndef WORLD_WATCH_H
+#define WORLD_WATCH_H
+
+/* A region file a rendered map depends on, as it was when the map was last
+   brought up to date. */
+typedef struct watch_region
+{
+  int rx, rz;
+  int64_t mtime; /* 0 if the region file didn't exist */
+  uint32_t timestamps[1024];
+} watch_region_t;
+
+typedef struct watch_map
+{
+  char filename[512];
+  char regionpath[512];
+  map_data_t info;
+  unsigned char data[128 * 128];
+  double heights[128 * 128]; /* needed to reshade the neighbours of changed pixels */
+
+  int region_count;
+  watch_region_t * regions;
+} watch_map_t;
+
+typedef struct world_watch
+{
+  int map_count;
+  watch_map_t * maps;
+} world_watch_t;
+
+world_watch_t * world_watch_new(void);
+void world_watch_free(world_watch_t * watch);
+
+/* The state is a gzipped host-endian dump, it's a cache and not meant to be
+   moved between machines. */
+world_watch_t * world_watch_load(const char * filename);
+int world_watch_save(world_watch_t * watch, const char * filename);
+
+/* Renders the map centered on x, z like "Render World" does, saves it to
+   filename and starts tracking the chunks it was rendered from. */
+void world_watch_add_map(world_watch_t * watch, const char * regionpath, const char * filename,
+			 int x, int z, int scale, int dimension);
+
+/* Re-renders the pixels covered by chunks that changed since the last update
+   and re-saves the affected maps. Returns the number of maps saved. */
+int world_watch_update(world_watch_t * watch);
+
+#endif
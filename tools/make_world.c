@@ -0,0 +1,392 @@
+/* This file is part of ImageToMapX.
+   ImageToMapX is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   ImageToMapX is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with ImageToMapX. If not, see <http://www.gnu.org/licenses/>. */
+
+/* Writes synthetic r.<x>.<z>.mca region files in the Anvil format that
+   read_region_area reads, so the world reader and renderer can be timed
+   on the same input every time.
+
+   make_world <dir> [--regions <w> <h>] [--chunks <per region>]
+		    [--sections <1-16>] [--terrain flat|hills|noise|ocean]
+		    [--compression gzip|zlib] [--level <0-9>] [--seed <n>]
+
+   The regions cover r.0.0 to r.<w-1>.<h-1>. Of every region's 1024 chunks
+   the given number exist, picked at random; sections are stacked from the
+   bottom and the terrain is cut off at their top. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <zlib.h>
+#include <gtk/gtk.h>
+
+#include "data_structures.h"
+#include "progress.h"
+#include "nbtsave.h"
+
+#define SEA_LEVEL 62
+#define SECTION_SIZE (16 * 16 * 16)
+/* the NBT of a chunk with all 16 sections: Blocks, and Data, BlockLight
+   and SkyLight at half a byte per block, plus the tag headers of each
+   section, then the biomes, the height map and the rest of the chunk */
+#define CHUNK_NBT_SIZE (16 * (SECTION_SIZE + 3 * SECTION_SIZE / 2 + 64) + 4096)
+
+enum
+  {
+    TERRAIN_FLAT,
+    TERRAIN_HILLS,
+    TERRAIN_NOISE,
+    TERRAIN_OCEAN
+  };
+
+typedef struct world_options
+{
+  int regions_w, regions_h;
+  int chunks, sections, terrain;
+  int compression, level;
+  unsigned int seed;
+} world_options_t;
+
+static unsigned int hash(unsigned int seed, int x, int z)
+{
+  unsigned int h = seed ^ ((unsigned int)x * 374761393u) ^ ((unsigned int)z * 668265263u);
+
+  h = (h ^ (h >> 13)) * 1274126177u;
+  return h ^ (h >> 16);
+}
+
+/* Value noise in [0, 1] with cells of size blocks. */
+static double value_noise(unsigned int seed, int x, int z, int size)
+{
+  int cx = (int)floor((double)x / size), cz = (int)floor((double)z / size);
+  double fx = (double)(x - cx * size) / size, fz = (double)(z - cz * size) / size;
+  double a = (hash(seed, cx, cz) & 0xFFFF) / 65535.0;
+  double b = (hash(seed, cx + 1, cz) & 0xFFFF) / 65535.0;
+  double c = (hash(seed, cx, cz + 1) & 0xFFFF) / 65535.0;
+  double d = (hash(seed, cx + 1, cz + 1) & 0xFFFF) / 65535.0;
+
+  fx = fx * fx * (3 - 2 * fx);
+  fz = fz * fz * (3 - 2 * fz);
+  return (a * (1 - fx) + b * fx) * (1 - fz) + (c * (1 - fx) + d * fx) * fz;
+}
+
+static int terrain_height(world_options_t * options, int x, int z)
+{
+  int top = options->sections * 16 - 1;
+  int h;
+
+  switch(options->terrain)
+    {
+    case TERRAIN_FLAT:
+      h = 64;
+      break;
+
+    case TERRAIN_HILLS:
+      h = 64 + (int)(20 * sin(x / 40.0) * cos(z / 55.0));
+      break;
+
+    case TERRAIN_OCEAN:
+      h = 40 + (int)(30 * value_noise(options->seed, x, z, 64));
+      break;
+
+    default:
+      h = 30 + (int)(60 * value_noise(options->seed, x, z, 96) + 20 * value_noise(options->seed + 1, x, z, 16));
+      break;
+    }
+  return CLAMP(h, 0, top);
+}
+
+static void column_blocks(unsigned char * column, world_options_t * options, int x, int z)
+{
+  int h = terrain_height(options, x, z);
+  int top = options->sections * 16;
+  int y;
+
+  memset(column, 0, top);
+  for(y = 0; y <= h; y++)
+    if(y == 0)
+      column[y] = 7; /* bedrock */
+    else if(y < h - 3)
+      column[y] = 1; /* stone */
+    else if(y < h)
+      column[y] = 3; /* dirt */
+    else if(h < SEA_LEVEL + 2 && options->terrain != TERRAIN_FLAT)
+      column[y] = 12; /* sand */
+    else
+      column[y] = 2; /* grass */
+  for(y = h + 1; y <= SEA_LEVEL && y < top; y++)
+    column[y] = 9; /* water */
+}
+
+static void put_be32(unsigned char * p, uint32_t v)
+{
+  p[0] = (v >> 24) & 0xFF;
+  p[1] = (v >> 16) & 0xFF;
+  p[2] = (v >> 8) & 0xFF;
+  p[3] = v & 0xFF;
+}
+
+/* The uncompressed NBT of the chunk at cx, cz, returns its size. */
+static int chunk_nbt(unsigned char * data, world_options_t * options, int cx, int cz)
+{
+  static unsigned char zeros[SECTION_SIZE];
+  unsigned char blocks[16][SECTION_SIZE];
+  unsigned char column[256];
+  unsigned char biomes[256];
+  int heightmap[256];
+  int offset = 0, i, x, z, y, s;
+
+  memset(biomes, 1, sizeof(biomes));
+  for(x = 0; x < 16; x++)
+    for(z = 0; z < 16; z++)
+      {
+	column_blocks(column, options, cx * 16 + x, cz * 16 + z);
+	heightmap[x + z * 16] = 0;
+	for(y = 0; y < options->sections * 16; y++)
+	  {
+	    blocks[y >> 4][(y & 15) * 256 + z * 16 + x] = column[y];
+	    if(column[y] != 0)
+	      heightmap[x + z * 16] = y + 1;
+	  }
+      }
+
+  nbt_write_raw_tag(data, 0x0A, NULL, &offset);
+  nbt_write_raw_tag(data, 0x0A, "Level", &offset);
+  nbt_write_raw_tag(data, 0x03, "xPos", &offset, cx);
+  nbt_write_raw_tag(data, 0x03, "zPos", &offset, cz);
+  nbt_write_raw_tagstart(data, 0x04, "LastUpdate", &offset);
+  memset(data + offset, 0, 8);
+  offset += 8;
+  nbt_write_raw_tag(data, 0x01, "TerrainPopulated", &offset, 1);
+  nbt_write_raw_tag(data, 0x01, "LightPopulated", &offset, 1);
+  nbt_write_raw_tag(data, 0x07, "Biomes", &offset, 256, biomes);
+
+  nbt_write_raw_tagstart(data, 0x0B, "HeightMap", &offset);
+  put_be32(data + offset, 256);
+  offset += 4;
+  for(i = 0; i < 256; i++)
+    {
+      put_be32(data + offset, heightmap[i]);
+      offset += 4;
+    }
+
+  /* empty lists of compounds */
+  for(i = 0; i < 2; i++)
+    {
+      nbt_write_raw_tagstart(data, 0x09, i == 0 ? "Entities" : "TileEntities", &offset);
+      data[offset++] = 0x0A;
+      memset(data + offset, 0, 4);
+      offset += 4;
+    }
+
+  nbt_write_raw_tagstart(data, 0x09, "Sections", &offset);
+  data[offset++] = 0x0A;
+  data[offset++] = 0;
+  data[offset++] = 0;
+  data[offset++] = 0;
+  data[offset++] = options->sections;
+  for(s = 0; s < options->sections; s++)
+    {
+      nbt_write_raw_tag(data, 0x01, "Y", &offset, s);
+      nbt_write_raw_tag(data, 0x07, "Blocks", &offset, SECTION_SIZE, blocks[s]);
+      nbt_write_raw_tag(data, 0x07, "Data", &offset, SECTION_SIZE / 2, zeros);
+      nbt_write_raw_tag(data, 0x07, "BlockLight", &offset, SECTION_SIZE / 2, zeros);
+      nbt_write_raw_tag(data, 0x07, "SkyLight", &offset, SECTION_SIZE / 2, zeros);
+      data[offset++] = 0;
+    }
+
+  /* Level and root end tags */
+  data[offset++] = 0;
+  data[offset++] = 0;
+  assert(offset <= CHUNK_NBT_SIZE);
+  return offset;
+}
+
+/* Compresses size bytes of data the way the region file says, returns
+   the compressed size or -1. */
+static long compress_chunk(unsigned char * dest, long dest_size, unsigned char * data, int size,
+			   int compression, int level)
+{
+  z_stream strm;
+  long out;
+
+  memset(&strm, 0, sizeof(strm));
+  if(deflateInit2(&strm, level, Z_DEFLATED, compression == 1 ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  strm.next_in = data;
+  strm.avail_in = size;
+  strm.next_out = dest;
+  strm.avail_out = dest_size;
+  if(deflate(&strm, Z_FINISH) != Z_STREAM_END)
+    {
+      deflateEnd(&strm);
+      return -1;
+    }
+  out = strm.total_out;
+  deflateEnd(&strm);
+  return out;
+}
+
+static int write_region(const char * dir, world_options_t * options, int rx, int rz, long * total)
+{
+  unsigned char header[8192];
+  unsigned char * nbt = malloc(CHUNK_NBT_SIZE);
+  long packed_size = compressBound(CHUNK_NBT_SIZE) + 64;
+  unsigned char * packed = malloc(packed_size + 4096);
+  int order[1024];
+  char path[1024];
+  FILE * file;
+  uint32_t sector = 2;
+  unsigned int seed = hash(options->seed, rx, rz);
+  int i, ret = 0;
+
+  snprintf(path, sizeof(path), "%s/r.%i.%i.mca", dir, rx, rz);
+  file = fopen(path, "wb");
+  if(file == NULL)
+    {
+      free(nbt);
+      free(packed);
+      return -1;
+    }
+
+  /* which chunks exist: the first options->chunks of a shuffle */
+  for(i = 0; i < 1024; i++)
+    order[i] = i;
+  for(i = 1023; i > 0; i--)
+    {
+      int j, t;
+
+      seed = seed * 1103515245 + 12345;
+      j = (seed >> 8) % (i + 1);
+      t = order[i];
+      order[i] = order[j];
+      order[j] = t;
+    }
+
+  memset(header, 0, sizeof(header));
+  fwrite(header, 1, sizeof(header), file);
+  for(i = 0; i < options->chunks && ret == 0; i++)
+    {
+      int k = order[i];
+      int size = chunk_nbt(nbt, options, rx * 32 + (k % 32), rz * 32 + (k / 32));
+      long length = compress_chunk(packed + 5, packed_size, nbt, size, options->compression, options->level);
+      uint32_t sectors;
+
+      if(length < 0)
+	{
+	  ret = -1;
+	  break;
+	}
+      sectors = (length + 5 + 4095) / 4096;
+      put_be32(packed, length + 1);
+      packed[4] = options->compression;
+      memset(packed + 5 + length, 0, sectors * 4096 - length - 5);
+      if(fwrite(packed, 1, sectors * 4096, file) != sectors * 4096)
+	ret = -1;
+
+      put_be32(header + k * 4, (sector << 8) | sectors);
+      put_be32(header + 4096 + k * 4, 1400000000);
+      sector += sectors;
+      *total += length;
+    }
+
+  fseek(file, 0, SEEK_SET);
+  if(fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    ret = -1;
+  if(fclose(file) != 0)
+    ret = -1;
+  free(nbt);
+  free(packed);
+  return ret;
+}
+
+static void usage(const char * name)
+{
+  fprintf(stderr, "usage: %s <dir> [--regions <w> <h>] [--chunks <per region>] [--sections <1-16>]\n"
+	  "       [--terrain flat|hills|noise|ocean] [--compression gzip|zlib] [--level <0-9>] [--seed <n>]\n", name);
+}
+
+int main(int argc, char ** argv)
+{
+  world_options_t options;
+  long total = 0;
+  int rx, rz, i;
+
+  options.regions_w = 1;
+  options.regions_h = 1;
+  options.chunks = 1024;
+  options.sections = 5;
+  options.terrain = TERRAIN_NOISE;
+  options.compression = 2;
+  options.level = 6;
+  options.seed = 1;
+
+  if(argc < 2)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  for(i = 2; i < argc; i++)
+    {
+      if(strcmp(argv[i], "--regions") == 0 && i + 2 < argc)
+	{
+	  options.regions_w = atoi(argv[++i]);
+	  options.regions_h = atoi(argv[++i]);
+	}
+      else if(strcmp(argv[i], "--chunks") == 0 && i + 1 < argc)
+	options.chunks = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--sections") == 0 && i + 1 < argc)
+	options.sections = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--terrain") == 0 && i + 1 < argc)
+	{
+	  i++;
+	  if(strcmp(argv[i], "flat") == 0)
+	    options.terrain = TERRAIN_FLAT;
+	  else if(strcmp(argv[i], "hills") == 0)
+	    options.terrain = TERRAIN_HILLS;
+	  else if(strcmp(argv[i], "ocean") == 0)
+	    options.terrain = TERRAIN_OCEAN;
+	  else
+	    options.terrain = TERRAIN_NOISE;
+	}
+      else if(strcmp(argv[i], "--compression") == 0 && i + 1 < argc)
+	options.compression = strcmp(argv[++i], "gzip") == 0 ? 1 : 2;
+      else if(strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+	options.level = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+	options.seed = strtoul(argv[++i], NULL, 10);
+      else
+	{
+	  usage(argv[0]);
+	  return 1;
+	}
+    }
+
+  options.chunks = CLAMP(options.chunks, 0, 1024);
+  options.sections = CLAMP(options.sections, 1, 16);
+  options.level = CLAMP(options.level, 0, 9);
+
+  for(rx = 0; rx < options.regions_w; rx++)
+    for(rz = 0; rz < options.regions_h; rz++)
+      if(write_region(argv[1], &options, rx, rz, &total) != 0)
+	{
+	  fprintf(stderr, "Could not write r.%i.%i.mca in %s\n", rx, rz, argv[1]);
+	  return 1;
+	}
+
+  printf("%i regions of %i chunks, %i sections each, %.1f MB compressed\n", options.regions_w * options.regions_h,
+	 options.chunks, options.sections, total / (1024.0 * 1024.0));
+  return 0;
+}